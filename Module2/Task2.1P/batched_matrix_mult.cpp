@@ -0,0 +1,110 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include "../../common/matrix.h"
+#include "../../common/gemm.h"
+#include "../../common/batched.h"
+#include "../../common/cli.h"
+
+// Namespaces added for readability
+using namespace std;
+using namespace chrono;
+
+// Default size of each square matrix when --size is not given
+constexpr int default_size = 8;
+// Default number of products in the batch when --batch is not given
+constexpr int default_batch = 100000;
+// Default number of threads when --threads is not given
+constexpr int default_threads = 8;
+
+// Function to fill matrix with random values
+void fillMatrix(Matrix &matrix, minstd_rand &gen, uniform_int_distribution<> &distrib) {
+    for (int i = 0; i < matrix.rows; i++) {
+        for (int j = 0; j < matrix.cols; j++) {
+            matrix(i, j) = distrib(gen);
+        }
+    }
+}
+
+// Multiply-adds per second, for comparing sizes
+double gops(const long long operations, const microseconds duration) {
+    return duration.count() > 0 ? operations / (duration.count() * 1e3) : 0.0;
+}
+
+int main(int argc, char **argv) {
+    // Matrix size, batch size and thread count from the command line
+    int size, batch, num_threads;
+    try {
+        size = intOptionAtLeast(argc, argv, "--size", default_size, 0);
+        batch = intOptionAtLeast(argc, argv, "--batch", default_batch, 0);
+        num_threads = threadsOption(argc, argv, default_threads);
+    }
+    catch (const exception &e) {  // Malformed or out of range options
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // Each row holds one size x size matrix, so matrix i of the batch starts at row(i) - stride size * size
+    const size_t stride = static_cast<size_t>(size) * size;
+    Matrix a(batch, stride);
+    Matrix b(batch, stride);
+    Matrix c(batch, stride);
+    Matrix reference(batch, stride);  // Per-matrix products, checked against the batched ones
+
+    // Random number generation
+    constexpr int minVal = 1, maxVal = 100;  // Min and max value for random integer
+    minstd_rand gen{random_device{}()};
+    uniform_int_distribution distrib(minVal, maxVal);
+    fillMatrix(a, gen, distrib);
+    fillMatrix(b, gen, distrib);
+
+    const long long operations = 2LL * batch * size * size * size;
+    cout << (batchKernelFor<int, int>(size) != nullptr ? "Using compile-time kernel for " : "Using generic kernel for ")
+         << size << "x" << size << endl;
+
+    // Batched interface - timed section
+    auto start = high_resolution_clock::now();  // Start timer
+    batchedMultiply(batch, size, size, size, a.data(), stride, b.data(), stride, c.data(), stride, num_threads);
+    auto stop = high_resolution_clock::now();  // Stop timer
+    const auto batched = duration_cast<microseconds>(stop - start);
+
+    // The blocked kernel called once per matrix, as before - every call packs its own B
+    start = high_resolution_clock::now();  // Start timer
+    for (int i = 0; i < batch; i++) {
+        const PackedB packed_b = packB(b.row(i), size, size, size, 1);
+        gemmPacked(size, a.row(i), size, packed_b, reference.row(i), size);
+    }
+    stop = high_resolution_clock::now();  // Stop timer
+    const auto per_matrix = duration_cast<microseconds>(stop - start);
+
+    // Check the batched products against the blocked kernel's - integer products must match exactly
+    int mismatched = 0;
+    for (int i = 0; i < batch; i++) {
+        if (!equal(c.row(i), c.row(i) + stride, reference.row(i))) {
+            mismatched++;
+        }
+    }
+    if (mismatched > 0) {
+        cerr << mismatched << " of " << batch << " batched products differ from the blocked kernel's" << endl;
+        return 1;
+    }
+
+    // Record result
+    cout << "Time taken for batched matrix multiplication: " << batched.count() << " microseconds ("
+         << gops(operations, batched) << " GOPS)" << endl;
+    cout << "Time taken calling the blocked kernel per matrix: " << per_matrix.count() << " microseconds ("
+         << gops(operations, per_matrix) << " GOPS)" << endl;
+    ofstream output("batched_output.txt");
+    if (!output.is_open()) {  // Check that the file opened, output error if it didn't
+        cerr << "Failed to open file." << endl;
+        return 1;
+    }
+    output << "Time taken for batched matrix multiplication: " << batched.count() << " microseconds" << endl;
+    output << "Time taken calling the blocked kernel per matrix: " << per_matrix.count() << " microseconds" << endl;
+    output.close();
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <utility>
+#include <unistd.h>
+#include <omp.h>
+#include "../../common/matrix.h"
+#include "../../common/gemm.h"
+#include "../../common/strassen.h"
+#include "../../common/cli.h"
+#include "../../common/random.h"
+#include "../../common/freivalds.h"
+#include "../../common/partition.h"
+#include "../../common/thread_pool.h"
+#include "../../common/work_stealing.h"
+#include "../../common/benchmark.h"
+#include "../../common/numa.h"
+
+// Namespaces added for readability
+using namespace std;
+using namespace chrono;
+
+// Benchmark driver for the single-node multiplies - sweeps every variant over sizes, thread counts and element types
+// seq is the packed kernel on one thread and the baseline for efficiency, omp and pthreads give each thread a fixed
+// slice of rows, omp-steal and pthreads-steal balance tiles by work stealing, strassen recurses down to the tuned cutoff
+// Sizes are square unless --m/--k/--n fix some dimensions for every size
+
+// Defaults for the sweep when the options are not given
+const string default_variants = "seq,omp,omp-steal,pthreads,pthreads-steal,strassen";
+const string default_sizes = "256,512,1024";
+const string default_threads = "1,2,4,8";
+const string default_types = "int32";
+constexpr int default_warmup = 1;
+constexpr int default_repeat = 5;
+
+// Every variant the driver knows
+const vector<string> known_variants = {"seq", "omp", "omp-steal", "pthreads", "pthreads-steal", "strassen"};
+
+// ThreadParams struct - one fixed slice of rows for a pool job
+template <typename T, typename Acc>
+struct ThreadParams {
+    const BasicMatrix<T> &a;
+    const BasicPackedB<T> &b;
+    BasicMatrix<Acc> &c;
+    int start;
+    int end;
+};
+
+// pthreads function - run the packed kernel over the rows designated to the job
+template <typename T, typename Acc>
+void *calcProduct(void *args) {
+    ThreadParams<T, Acc> *p = static_cast<ThreadParams<T, Acc> *>(args);
+    multiplyPacked(p->a, p->b, p->c, p->start, p->end);
+    return nullptr;
+}
+
+// StealParams struct - one per worker slot when tiles are scheduled by work stealing
+template <typename T, typename Acc>
+struct StealParams {
+    const BasicMatrix<T> &a;
+    const BasicPackedB<T> &b;
+    BasicMatrix<Acc> &c;
+    WorkStealingScheduler &scheduler;
+    int worker;
+};
+
+// pthreads function for work stealing - run tiles until none are left to claim
+template <typename T, typename Acc>
+void *calcTiles(void *args) {
+    StealParams<T, Acc> *p = static_cast<StealParams<T, Acc> *>(args);
+    p->scheduler.run(p->worker, [p](const TileTask &tile) {
+        multiplyTile(p->a, p->b, p->c, tile);
+    });
+    return nullptr;
+}
+
+// OMP multiply, as in omp_matrix_mult - fixed row slices, or tiles through the work-stealing scheduler
+template <typename T, typename Acc>
+void multiplyOmp(const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c, const int num_threads, WorkStealingScheduler *scheduler) {
+    const BasicPackedB<T> packed_b = packB(b, num_threads);
+    if (scheduler != nullptr) {
+        scheduler->reset(makeTileTasks(c.rows, c.cols, num_threads));
+        #pragma omp parallel num_threads(num_threads)
+        {
+            scheduler->run(omp_get_thread_num(), [&](const TileTask &tile) {
+                multiplyTile(a, packed_b, c, tile);
+            });
+        }
+        return;
+    }
+    #pragma omp parallel num_threads(num_threads)
+    {
+        const Range rows = balancedRange(c.rows, omp_get_num_threads(), omp_get_thread_num());
+        multiplyPacked(a, packed_b, c, rows.start, rows.end);
+    }
+}
+
+// pthreads multiply, as in pthreads_matrix_mult - jobs on the persistent pool, by row slices or by stealing tiles
+template <typename T, typename Acc>
+void multiplyPool(const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c, ThreadPool &pool, WorkStealingScheduler *scheduler) {
+    const BasicPackedB<T> packed_b = packB(b, pool.size());
+    const int num_threads = pool.size();
+    if (scheduler != nullptr) {
+        scheduler->reset(makeTileTasks(c.rows, c.cols, num_threads));
+        vector<StealParams<T, Acc>> p;
+        p.reserve(num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            p.push_back(StealParams<T, Acc>{a, packed_b, c, *scheduler, i});
+            pool.submit(calcTiles<T, Acc>, &p[i]);
+        }
+        pool.wait();
+        return;
+    }
+    vector<ThreadParams<T, Acc>> p;
+    p.reserve(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        const Range rows = balancedRange(c.rows, num_threads, i);
+        p.push_back(ThreadParams<T, Acc>{a, packed_b, c, rows.start, rows.end});
+        pool.submit(calcProduct<T, Acc>, &p[i]);
+    }
+    pool.wait();
+}
+
+// Time one variant at one thread count - pools, schedulers and the Strassen cutoff are set up outside the timing
+// Packing B is inside it, as in the programs
+template <typename T, typename Acc>
+vector<double> timeVariant(const string &variant, const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c,
+                           const int num_threads, const int cutoff, const int warmup, const int repeat) {
+    WorkStealingScheduler scheduler(num_threads);
+    if (variant == "seq") {
+        return timeRepetitions(warmup, repeat, [&] {
+            const BasicPackedB<T> packed_b = packB(b, 1);
+            multiplyPacked(a, packed_b, c, 0, c.rows);
+        });
+    }
+    if (variant == "omp" || variant == "omp-steal") {
+        WorkStealingScheduler *steal = variant == "omp-steal" ? &scheduler : nullptr;
+        return timeRepetitions(warmup, repeat, [&] { multiplyOmp(a, b, c, num_threads, steal); });
+    }
+    if (variant == "pthreads" || variant == "pthreads-steal") {
+        ThreadPool pool(num_threads);
+        WorkStealingScheduler *steal = variant == "pthreads-steal" ? &scheduler : nullptr;
+        return timeRepetitions(warmup, repeat, [&] { multiplyPool(a, b, c, pool, steal); });
+    }
+    const int leaf = cutoff > 0 ? cutoff : strassenCutoff<Acc>(num_threads);
+    return timeRepetitions(warmup, repeat, [&] { strassenMultiply(a, b, c, leaf, num_threads); });
+}
+
+// Sweep every variant and thread count over one shape with elements of type T accumulated in Acc
+// Inputs are generated once per shape, so every variant multiplies the same matrices
+// Returns the pages backing A, for the report
+template <typename T, typename Acc>
+string benchmarkShape(const string &type, const MatrixDims &dims, const vector<string> &variants, const vector<int> &thread_counts,
+                    const int warmup, const int repeat, const int cutoff, const uint64_t seed, const int verify_rounds,
+                    vector<BenchmarkResult> &results) {
+    // First touch in the row slices of the widest team, so pages spread over the nodes as the multiplies split them
+    BasicMatrix<T> a(dims.m, dims.k, uninitialized), b(dims.k, dims.n, uninitialized);
+    BasicMatrix<Acc> c(dims.m, dims.n, uninitialized);
+    const int fill_threads = *max_element(thread_counts.begin(), thread_counts.end());
+    fillRandom(a.data(), a.rows, a.cols, CounterRng(seed, matrix_a_stream), 1, 100, fill_threads);
+    fillRandom(b.data(), b.rows, b.cols, CounterRng(seed, matrix_b_stream), 1, 100, fill_threads);
+    firstTouchZero(c, fill_threads);
+
+    for (const string &variant : variants) {
+        for (const int num_threads : thread_counts) {
+            // seq has no threads to sweep - it runs once, at the first thread count
+            if (variant == "seq" && num_threads != thread_counts.front()) {
+                continue;
+            }
+            BenchmarkResult result;
+            result.variant = variant;
+            result.type = type;
+            result.m = dims.m;
+            result.k = dims.k;
+            result.n = dims.n;
+            result.threads = variant == "seq" ? 1 : num_threads;
+            result.repeat = repeat;
+            result.stats = benchmarkStats(timeVariant(variant, a, b, c, result.threads, cutoff, warmup, repeat));
+            result.gops = benchmarkGops(dims.m, dims.k, dims.n, result.stats.median_us);
+
+            // Freivalds check of the last product - outside the timing
+            if (verify_rounds > 0) {
+                result.verified = freivaldsVerify(a, b, c, verify_rounds, seed, result.threads).passed() ? "passed" : "failed";
+            }
+            cerr << benchmarkLine(result) << endl;
+            results.push_back(result);
+        }
+    }
+    return pageSizeSummary(a.data(), a.size() * sizeof(T));
+}
+
+int main(int argc, char **argv) {
+    // Sweep from the command line - comma separated lists of variants, sizes, thread counts and element types
+    // --m/--k/--n pin dimensions for every size, e.g. --sizes 256,512 --k 64 sweeps m = n with a thin k
+    vector<string> variants = listOption(argc, argv, "--variants", default_variants);
+    const vector<string> types = listOption(argc, argv, "--types", default_types);
+    vector<int> sizes, thread_counts;
+    // One shape per size, with any --m/--k/--n pinned
+    vector<MatrixDims> shapes;
+    // Untimed runs before the timed repetitions - warms caches, page tables and thread pools
+    int warmup, repeat;
+    // Strassen leaf size - 0 tunes it on first use for each accumulator type
+    int cutoff;
+    // --verify checks every configuration's product with this many Freivalds rounds
+    int verify_rounds;
+    try {
+        sizes = intListOption(argc, argv, "--sizes", default_sizes);
+        thread_counts = intListOption(argc, argv, "--threads", default_threads);
+        for (const int size : sizes) {
+            shapes.push_back({intOptionAtLeast(argc, argv, "--m", size, 0), intOptionAtLeast(argc, argv, "--k", size, 0),
+                              intOptionAtLeast(argc, argv, "--n", size, 0)});
+        }
+        warmup = intOptionAtLeast(argc, argv, "--warmup", default_warmup, 0);
+        repeat = intOptionAtLeast(argc, argv, "--repeat", default_repeat, 1);
+        cutoff = intOption(argc, argv, "--cutoff", 0);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+    }
+    catch (const exception &e) {  // Malformed or out of range options
+        cerr << e.what() << endl;
+        return 1;
+    }
+    for (const string &variant : variants) {
+        if (find(known_variants.begin(), known_variants.end(), variant) == known_variants.end()) {
+            cerr << "Unknown variant " << variant << endl;
+            return 1;
+        }
+    }
+    if (sizes.empty() || thread_counts.empty() || variants.empty() || types.empty()) {
+        cerr << "Nothing to benchmark" << endl;
+        return 1;
+    }
+    // seq runs first for each shape, so the report lists the baseline ahead of the variants compared with it
+    stable_partition(variants.begin(), variants.end(), [](const string &variant) { return variant == "seq"; });
+
+    // Report format (table, csv or json) and where it goes - standard output unless --output names a file
+    const string format = stringOption(argc, argv, "--format", "table");
+    const string output = stringOption(argc, argv, "--output", "");
+    if (!knownBenchmarkFormat(format)) {
+        cerr << "Unknown --format " << format << endl;
+        return 1;
+    }
+    // Inputs are reproducible from --seed - printed with progress and recorded in the report
+    const uint64_t seed = seedOption(argc, argv);
+    cerr << "Seed: " << seed << endl;
+    // --huge-pages off|thp|hugetlb picks how matrices of a huge page or more are backed - the pages used are reported
+    try {
+        setHugePageMode(hugePagesOption(argc, argv));
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    vector<BenchmarkResult> results;
+    vector<pair<string, string>> context;
+    for (const string &type : types) {
+        for (const MatrixDims &dims : shapes) {
+            const bool known = withGemmTypes(type, [&](auto element, auto accumulator) {
+                using T = typename decltype(element)::type;
+                using Acc = typename decltype(accumulator)::type;
+                const string pages = benchmarkShape<T, Acc>(type, dims, variants, thread_counts, warmup, repeat, cutoff, seed, verify_rounds, results);
+                context.emplace_back("kernel_" + type, microKernelName(microKernelFor<T, Acc>()));
+                context.emplace_back("pages_" + type + "_" + to_string(dims.m) + "x" + to_string(dims.k) + "x" + to_string(dims.n), pages);
+            });
+            if (!known) {
+                cerr << "Unknown type " << type << endl;
+                return 1;
+            }
+        }
+    }
+    addEfficiency(results, "seq");
+
+    // Run-wide context ahead of the per-type kernels - one entry per type is enough
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    sort(context.begin(), context.end());
+    context.erase(unique(context.begin(), context.end()), context.end());
+    context.insert(context.begin(), {{"benchmark", "matrix"}, {"host", host}, {"seed", to_string(seed)},
+                                     {"warmup", to_string(warmup)}, {"processors", to_string(omp_get_num_procs())},
+                                     {"huge_pages", hugePageModeName(hugePageMode())}, {"huge_page_size", byteSize(hugePageSize())}});
+
+    try {
+        writeBenchmarkReport(format, output, context, results);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // A failed check fails the run, so a regression job can't miss it
+    const bool verified = none_of(results.begin(), results.end(), [](const BenchmarkResult &result) { return result.verified == "failed"; });
+    return verified ? 0 : 1;
+}
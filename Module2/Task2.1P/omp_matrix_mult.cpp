@@ -5,87 +5,225 @@
 #include <fstream>
 #include <iomanip>
 #include <omp.h>
+#include "../../common/matrix.h"
+#include "../../common/gemm.h"
+#include "../../common/strassen.h"
+#include "../../common/cli.h"
+#include "../../common/matrix_file.h"
+#include "../../common/random.h"
+#include "../../common/freivalds.h"
+#include "../../common/partition.h"
+#include "../../common/work_stealing.h"
+#include "../../common/perf_counters.h"
+#include "../../common/numa.h"
 
 // Namespaces added for readability
 using namespace std;
 using namespace chrono;
 
-// Size of square matrix to generate - global
-constexpr int size_n = 1024;
-// Number of threads - global
-constexpr int num_threads = 8;
-// NOTE: size_n/num_threads needs to be a positive integer for multiplication to work
-
-// Function to print square matrix
-void printSqMatrix (const vector<vector<int> > &matrix) {
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            // Update setw if additional leading zeros required
-            cout << setw(5) << setfill('0') << matrix[i][j] << " ";
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 1024;
+// Default Strassen leaf size when --cutoff is not given - 0 tunes it on first use
+constexpr int default_cutoff = 0;
+// Default number of threads when --threads is not given
+constexpr int default_threads = 8;
+
+// Function to print matrix
+template <typename T>
+void printMatrix (const BasicMatrix<T> &matrix) {
+    for (int i = 0; i < matrix.rows; i++) {
+        for (int j = 0; j < matrix.cols; j++) {
+            // Update setw if additional leading zeros required - unary + prints int8 as a number, not a character
+            cout << setw(5) << setfill('0') << +matrix(i, j) << " ";
         }
         cout << endl;
     }
     cout << endl;
 }
 
-// Function to fill square matrix with random values - pass true if output is required
-void fillSqMatrix(vector<vector<int> > &matrix, minstd_rand &gen, uniform_int_distribution<> &distrib, const bool verbose = false) {
-    // Loop through and populate vector with random values
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            matrix[i][j] = distrib(gen);
-        }
-    }
+// Function to fill matrix with random values between minVal and maxVal - pass true if output is required
+// Each value depends only on the seed, the stream and its position, so the matrix is the same for any thread count
+template <typename T>
+void fillMatrix(BasicMatrix<T> &matrix, const CounterRng &rng, const int minVal, const int maxVal, const int num_threads, const bool verbose = false) {
+    fillRandom(matrix.data(), matrix.rows, matrix.cols, rng, minVal, maxVal, num_threads);
     // Display matrix if verbose is true
     if (verbose) {
-        printSqMatrix(matrix);
+        printMatrix(matrix);
     }
 }
 
-// Function to multiplay two square matrices together
-void multiplySqMatrix(const vector<vector<int> > &a, const vector<vector<int> > &b, vector<vector<int> > &c) {
-
-    #pragma omp parallel num_threads(num_threads)
+// Function to multiplay two matrices together
+// steal = true hands out tiles through the work-stealing scheduler, false gives each thread a fixed slice of rows
+template <typename T, typename Acc>
+void multiplyMatrix(const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c, const int num_threads, const bool steal) {
+    // Pack b into micro-panels once - shared read-only by every thread
+    BasicPackedB<T> packed_b;
+    {
+        PerfRegion region("pack");
+        packed_b = packB(b, num_threads);
+    }
 
-    #pragma omp for schedule(static, size_n/num_threads)
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            int sum = 0;
-            for (int k = 0; k < size_n; k++) {
-                sum += a[i][k] * b[k][j];
-            }
-            c[i][j] = sum;
+    if (steal) {
+        // Each thread starts on its own run of tiles and steals from others once it runs out
+        WorkStealingScheduler scheduler(num_threads);
+        scheduler.reset(makeTileTasks(c.rows, c.cols, num_threads));
+        #pragma omp parallel num_threads(num_threads)
+        {
+            PerfRegion region("multiply");  // Counted per thread
+            scheduler.run(omp_get_thread_num(), [&](const TileTask &tile) {
+                multiplyTile(a, packed_b, c, tile);
+            });
         }
+        return;
+    }
+
+    // Each thread takes a balanced slice of rows - remainder rows go one each to the first threads
+    #pragma omp parallel num_threads(num_threads)
+    {
+        PerfRegion region("multiply");  // Counted per thread
+        const Range rows = balancedRange(c.rows, omp_get_num_threads(), omp_get_thread_num());
+        multiplyPacked(a, packed_b, c, rows.start, rows.end);
     }
 
 }
 
-int main() {
-    // Init vectors a, b and c with zeros
-    vector a(size_n, vector(size_n, 0));
-    vector b(size_n, vector(size_n, 0));
-    vector c(size_n, vector(size_n, 0));
+// Fill, multiply and time one product with elements of type T accumulated in Acc
+template <typename T, typename Acc>
+microseconds runMultiply(const MatrixDims &dims, const MatrixFiles &files, const uint64_t seed, const int num_threads, const bool steal, const bool strassen, int cutoff,
+                         const int verify_rounds, const PinPlaces pin, const bool placement, bool &verified) {
+    // Pin the team before anything is touched, so first touches happen where the threads will stay
+    const vector<ThreadPlacement> threads = pinOmpThreads(pin, num_threads);
+
+    // Inputs are mapped from --a/--b when given, and C is mapped straight onto --c - otherwise new matrices
+    MappedMatrix<T> a_file, b_file;
+    MappedMatrix<Acc> c_file;
+    BasicMatrix<T> a = inputMatrix(a_file, files.a, dims.m, dims.k);
+    BasicMatrix<T> b = inputMatrix(b_file, files.b, dims.k, dims.n);
+    BasicMatrix<Acc> c = outputMatrix(c_file, files.c, dims.m, dims.n);
+    // Init c with zeros - each thread zeroes the rows its static slice computes, placing them on its node
+    if (files.c.empty()) {
+        firstTouchZero(c, num_threads);
+    }
 
-    // Random number generation
+    // Random number generation - a and b are separate streams of one seed
     constexpr int minVal = 1, maxVal = 100;  // Min and max value for random integer
-    // Usage outlined here - https://en.cppreference.com/w/cpp/numeric/random/uniform_int_distribution
-    minstd_rand gen{random_device{}()};
-    uniform_int_distribution distrib(minVal, maxVal);
 
-    // Fill vectors a and b with random values
-    fillSqMatrix(a, gen, distrib);
-    fillSqMatrix(b, gen, distrib);
+    // Fill matrices a and b with random values, unless they came from files
+    if (files.a.empty()) {
+        fillMatrix(a, CounterRng(seed, matrix_a_stream), minVal, maxVal, num_threads);
+    }
+    if (files.b.empty()) {
+        fillMatrix(b, CounterRng(seed, matrix_b_stream), minVal, maxVal, num_threads);
+    }
+
+    // Report which micro-kernel CPUID selected for this host and element type
+    cout << "Using " << microKernelName(microKernelFor<T, Acc>()) << " micro-kernel" << endl;
+    // Where the threads run and where the pages of a, b and c ended up
+    if (placement) {
+        cout << placementReport(pin, threads, {{"a", {a.data(), a.size() * sizeof(T)}}, {"b", {b.data(), b.size() * sizeof(T)}},
+                                               {"c", {c.data(), c.size() * sizeof(Acc)}}});
+    }
+
+    // Strassen leaf size - tuned outside the timed section
+    if (strassen) {
+        if (cutoff <= 0) {
+            cutoff = strassenCutoff<Acc>(num_threads);
+        }
+        cout << "Using Strassen-Winograd with a cutoff of " << cutoff << endl;
+    }
 
     // Get matrix product c - timed section
     const auto start = high_resolution_clock::now();  // Start timer
-    multiplySqMatrix(a, b, c);
+    if (strassen) {
+        PerfRegion region("multiply");  // Counts only the calling thread - Strassen's tasks run on the whole team
+        strassenMultiply(a, b, c, cutoff, num_threads);
+    }
+    else {
+        multiplyMatrix(a, b, c, num_threads, steal);
+    }
     const auto stop = high_resolution_clock::now();  // Stop timer
 
     // Test print matrix c
-    //printSqMatrix(c);
+    //printMatrix(c);
 
-    // Calculate duration and record result
-    const auto duration = duration_cast<microseconds>(stop - start);
+    // Freivalds check of c in O(n^2) - outside the timed section
+    if (verify_rounds > 0) {
+        const auto verify_start = high_resolution_clock::now();
+        const FreivaldsResult result = freivaldsVerify(a, b, c, verify_rounds, seed, num_threads);
+        const auto verify_stop = high_resolution_clock::now();
+        verified = result.passed();
+        cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+             << duration_cast<microseconds>(verify_stop - verify_start).count() << " microseconds" << endl;
+    }
+
+    return duration_cast<microseconds>(stop - start);
+}
+
+int main(int argc, char **argv) {
+    // Matrix dimensions and thread count from the command line - C (m x n) = A (m x k) * B (k x n)
+    // Matrices can come from binary matrix files instead (--a, --b), which also set the shape, and C can be saved (--c)
+    const MatrixFiles files{stringOption(argc, argv, "--a", ""), stringOption(argc, argv, "--b", ""), stringOption(argc, argv, "--c", "")};
+    MatrixDims dims;
+    string file_type = "int32";
+    // Thread count, Strassen leaf size for --algorithm strassen, and Freivalds rounds for --verify
+    int num_threads, cutoff, verify_rounds;
+    try {
+        dims = dimsFromFiles(dimsOption(argc, argv, default_size), files);
+        if (!files.a.empty()) {
+            file_type = matrixTypeName(readMatrixHeader(files.a).type);
+        }
+        num_threads = threadsOption(argc, argv, default_threads);
+        cutoff = intOption(argc, argv, "--cutoff", default_cutoff);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+    }
+    catch (const exception &e) {  // Malformed options, or unreadable or mismatched matrix files
+        cerr << e.what() << endl;
+        return 1;
+    }
+    // --schedule static restores fixed row slices, the default steal balances tiles at runtime
+    const bool steal = stringOption(argc, argv, "--schedule", "steal") != "static";
+    // Element type, optionally with a wider accumulator - int8, int16, int32, int32:int64, int64, float, float:double, double
+    // Defaults to the element type of the --a file
+    const string type = stringOption(argc, argv, "--type", file_type);
+    // --algorithm strassen recurses Strassen-Winograd down to --cutoff before the blocked kernel, the default is blocked only
+    const bool strassen = stringOption(argc, argv, "--algorithm", "blocked") == "strassen";
+    // Random inputs are reproducible from --seed - printed so any run can be repeated
+    const uint64_t seed = seedOption(argc, argv);
+    if (files.a.empty() || files.b.empty()) {
+        cout << "Seed: " << seed << endl;
+    }
+    // --verify checks the product with verify_rounds Freivalds rounds - a wrong product passes with probability 2^-rounds
+    // --perf counts cycles, instructions and cache and TLB misses of the pack and of each thread's multiply
+    const bool perf = flagOption(argc, argv, "--perf");
+    perfEnable(perf);
+    // --pin threads|cores|sockets|numa_domains binds thread i close to place i - OMP_PLACES takes precedence when set
+    // --placement reports the CPU and node of every thread and the nodes holding each matrix, implied by --pin
+    PinPlaces pin;
+    try {
+        pin = pinOption(argc, argv);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    const bool placement = pin != PinPlaces::none || flagOption(argc, argv, "--placement");
+
+    // Calculate duration for the chosen types and record result
+    microseconds duration;
+    bool known, verified = true;
+    try {
+        known = withGemmTypes(type, [&](auto element, auto accumulator) {
+            duration = runMultiply<typename decltype(element)::type, typename decltype(accumulator)::type>(dims, files, seed, num_threads, steal, strassen, cutoff, verify_rounds, pin, placement, verified);
+        });
+    }
+    catch (const exception &e) {  // Unreadable or mismatched matrix files
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!known) {
+        cerr << "Unknown --type " << type << endl;
+        return 1;
+    }
     cout << "Time taken for OMP matrix multiplication: " << duration.count() << " microseconds" << endl;
     ofstream output("omp_output.txt");
     if (!output.is_open()) {  // Check that the file opened, output error if it didn't
@@ -94,6 +232,9 @@ int main() {
     }
     output << "Time taken for OMP matrix multiplication: " << duration.count() << " microseconds" << endl;
     output.close();
+    if (perf) {
+        cout << perfReport();
+    }
 
-    return 0;
+    return verified ? 0 : 1;
 }
@@ -0,0 +1,182 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include "../../common/matrix.h"
+#include "../../common/gemm.h"
+#include "../../common/cli.h"
+#include "../../common/matrix_file.h"
+#include "../../common/random.h"
+#include "../../common/freivalds.h"
+#include "../../common/partition.h"
+#include "../../common/tiled_matrix.h"
+#include "../../common/out_of_core.h"
+
+// Namespaces added for readability
+using namespace std;
+using namespace chrono;
+
+// Out-of-core multiply - A, B and C live in tiled files and only --memory MiB of tiles are mapped at a time,
+// so the product can be far larger than RAM
+// Inputs come from --a/--b tiled files, or are generated tile by tile into out_of_core_a.tiled and out_of_core_b.tiled
+// Row-major matrix files convert with --convert in --to out (either direction, by the input's format)
+
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 2048;
+// Default tile size when --tile is not given - a 1 MiB tile of int32
+constexpr int default_tile = 512;
+// Default number of threads when --threads is not given
+constexpr int default_threads = 8;
+
+// Files the inputs are generated into, and C's default, when --a/--b/--c are not given
+const string default_a_file = "out_of_core_a.tiled";
+const string default_b_file = "out_of_core_b.tiled";
+const string default_c_file = "out_of_core_c.tiled";
+
+// Convert a row-major matrix file to a tiled one, or a tiled one back to row-major
+void convertFile(const string &from, const string &to, const int tile) {
+    const bool tiled = isTiledFile(from);
+    const string type = matrixTypeName(tiled ? tiledFileType(from) : readMatrixHeader(from).type);
+    const bool known = withGemmTypes(type, [&](auto element, auto) {
+        using T = typename decltype(element)::type;
+        if (tiled) {
+            convertFromTiled<T>(from, to);
+        }
+        else {
+            convertToTiled<T>(from, to, tile);
+        }
+    });
+    if (!known) {
+        throw runtime_error(from + ": unsupported element type " + type);
+    }
+    cout << "Converted " << from << " to " << (tiled ? "row-major " : "tiled ") << to << endl;
+}
+
+// Open or generate the inputs, multiply and time one product with elements of type T accumulated in Acc
+template <typename T, typename Acc>
+microseconds runMultiply(const MatrixDims &dims, const MatrixFiles &files, const int tile, const size_t memory_bytes, const uint64_t seed,
+                         const int num_threads, const int verify_rounds, bool &verified) {
+    // Random inputs are written one tile at a time, so generating them needs no more memory than the multiply
+    constexpr int minVal = 1, maxVal = 100;  // Min and max value for random integer
+    if (files.a.empty()) {
+        const TiledMatrix<T> a = TiledMatrix<T>::create(default_a_file, dims.m, dims.k, tile);
+        fillRandomTiles(a, Range{0, a.tileRows()}, CounterRng(seed, matrix_a_stream), minVal, maxVal, num_threads);
+        a.sync();
+    }
+    if (files.b.empty()) {
+        const TiledMatrix<T> b = TiledMatrix<T>::create(default_b_file, dims.k, dims.n, tile);
+        fillRandomTiles(b, Range{0, b.tileRows()}, CounterRng(seed, matrix_b_stream), minVal, maxVal, num_threads);
+        b.sync();
+    }
+    const TiledMatrix<T> a = TiledMatrix<T>::open(files.a.empty() ? default_a_file : files.a);
+    const TiledMatrix<T> b = TiledMatrix<T>::open(files.b.empty() ? default_b_file : files.b);
+    const TiledMatrix<Acc> c = TiledMatrix<Acc>::create(files.c.empty() ? default_c_file : files.c, a.rows(), b.cols(), a.tile());
+
+    // Report which micro-kernel CPUID selected for this host and element type
+    cout << "Using " << microKernelName(microKernelFor<T, Acc>()) << " micro-kernel" << endl;
+
+    // Get matrix product c - timed section, reads and writes of tiles included
+    const auto start = high_resolution_clock::now();  // Start timer
+    const OutOfCoreStats stats = outOfCoreMultiply(a, b, c, Range{0, a.tileRows()}, memory_bytes, num_threads);
+    const auto stop = high_resolution_clock::now();  // Stop timer
+
+    // Plan and I/O summary - tile reads against the fewest possible and against re-reading both tiles every step
+    cout << "Plan: " << stats.order << " sweep of " << stats.steps << " tile steps, " << stats.capacity << " tiles of "
+         << a.tile() << "x" << a.tile() << " resident" << endl;
+    cout << "Tile reads: " << stats.tile_loads << " (" << stats.distinct_tiles << " distinct, " << 2 * stats.steps
+         << " without reuse), stalled " << static_cast<long long>(stats.stall_us) << " microseconds waiting on prefetch" << endl;
+
+    // Freivalds check of c in O(n^2), streaming tiles - outside the timed section
+    if (verify_rounds > 0) {
+        const auto verify_start = high_resolution_clock::now();
+        const FreivaldsResult result = freivaldsTiled(a, b, c, Range{0, c.tileRows()}, Range{0, b.tileRows()}, verify_rounds, seed, num_threads,
+                                                      [](vector<typename FreivaldsArithmetic<Acc>::type> &) {});
+        const auto verify_stop = high_resolution_clock::now();
+        verified = result.passed();
+        cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+             << duration_cast<microseconds>(verify_stop - verify_start).count() << " microseconds" << endl;
+    }
+
+    return duration_cast<microseconds>(stop - start);
+}
+
+int main(int argc, char **argv) {
+    int tile;
+    try {
+        tile = intOptionAtLeast(argc, argv, "--tile", default_tile, 1);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // --convert in --to out rewrites a matrix file in the other layout and exits
+    const string convert = stringOption(argc, argv, "--convert", "");
+    if (!convert.empty()) {
+        try {
+            convertFile(convert, stringOption(argc, argv, "--to", convert + ".tiled"), tile);
+        }
+        catch (const exception &e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Matrix dimensions for generated inputs, or tiled files (--a, --b) that set the shape, and where C goes (--c)
+    const MatrixFiles files{stringOption(argc, argv, "--a", ""), stringOption(argc, argv, "--b", ""), stringOption(argc, argv, "--c", "")};
+    MatrixDims dims;
+    // Thread count, --memory cap on the tiles mapped at once (in MiB), and Freivalds rounds for --verify
+    int num_threads, memory_mib, verify_rounds;
+    // Element type, optionally with a wider accumulator - defaults to the element type of the --a file
+    string type = "int32";
+    try {
+        dims = dimsOption(argc, argv, default_size);
+        num_threads = threadsOption(argc, argv, default_threads);
+        memory_mib = intOptionAtLeast(argc, argv, "--memory", default_out_of_core_memory, 1);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+        if (!files.a.empty()) {
+            type = matrixTypeName(tiledFileType(files.a));
+        }
+    }
+    catch (const exception &e) {  // Malformed options, or an unreadable --a file
+        cerr << e.what() << endl;
+        return 1;
+    }
+    type = stringOption(argc, argv, "--type", type);
+    const size_t memory_bytes = static_cast<size_t>(memory_mib) << 20;
+    // Random inputs are reproducible from --seed, and match the in-core programs' inputs for the same seed
+    const uint64_t seed = seedOption(argc, argv);
+    if (files.a.empty() || files.b.empty()) {
+        cout << "Seed: " << seed << endl;
+    }
+    // --verify checks the product with verify_rounds Freivalds rounds - a wrong product passes with probability 2^-rounds
+
+    // Calculate duration for the chosen types and record result
+    microseconds duration;
+    bool known, verified = true;
+    try {
+        known = withGemmTypes(type, [&](auto element, auto accumulator) {
+            duration = runMultiply<typename decltype(element)::type, typename decltype(accumulator)::type>(dims, files, tile, memory_bytes, seed,
+                                                                                                          num_threads, verify_rounds, verified);
+        });
+    }
+    catch (const exception &e) {  // Unreadable or mismatched files, or too little --memory for one tile
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!known) {
+        cerr << "Unknown --type " << type << endl;
+        return 1;
+    }
+    cout << "Time taken for out-of-core matrix multiplication: " << duration.count() << " microseconds" << endl;
+    ofstream output("out_of_core_output.txt");
+    if (!output.is_open()) {  // Check that the file opened, output error if it didn't
+        cerr << "Failed to open file." << endl;
+        return 1;
+    }
+    output << "Time taken for out-of-core matrix multiplication: " << duration.count() << " microseconds" << endl;
+    output.close();
+
+    return verified ? 0 : 1;
+}
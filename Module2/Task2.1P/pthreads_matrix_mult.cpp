@@ -5,126 +5,301 @@
 #include <fstream>
 #include <iomanip>
 #include <pthread.h>
+#include "../../common/matrix.h"
+#include "../../common/gemm.h"
+#include "../../common/cli.h"
+#include "../../common/matrix_file.h"
+#include "../../common/partition.h"
+#include "../../common/random.h"
+#include "../../common/freivalds.h"
+#include "../../common/thread_pool.h"
+#include "../../common/work_stealing.h"
+#include "../../common/perf_counters.h"
+#include "../../common/numa.h"
 
 // Namespaces added for readability
 using namespace std;
 using namespace chrono;
 
-// Size of square matrix to generate - global
-constexpr int size_n = 1024;
-// Number of threads - global
-constexpr int num_threads = 8;
-// NOTE: size_n/num_threads needs to be a positive integer for multiplication to work
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 1024;
+// Default number of threads when --threads is not given
+constexpr int default_threads = 8;
+// Default number of timed multiplies when --repeat is not given
+constexpr int default_repeat = 1;
 
 // ThreadParam struct - used for creating threads with pthreads
+template <typename T, typename Acc>
 struct ThreadParams {
-    const vector<vector<int> > &a;
-    const vector<vector<int> > &b;
-    vector<vector<int> > &c;
+    const BasicMatrix<T> &a;
+    const BasicPackedB<T> &b;
+    BasicMatrix<Acc> &c;
     int start;
     int end;
 };
 
 // pthreads function
+template <typename T, typename Acc>
 void *calcProduct(void *args) {
     // Unpack params
-    ThreadParams *p = static_cast<ThreadParams *>(args);
-    const vector<vector<int> > &a = p->a;
-    const vector<vector<int> > &b = p->b;
-    vector<vector<int> > &c = p->c;
+    ThreadParams<T, Acc> *p = static_cast<ThreadParams<T, Acc> *>(args);
+    const BasicMatrix<T> &a = p->a;
+    const BasicPackedB<T> &b = p->b;
+    BasicMatrix<Acc> &c = p->c;
     int start = p->start;
     int end = p->end;
 
-    // Loop through the number of rows designated to the thread and perform matrix multiplication
-    for (int i = start; i < end; i++) {  // Loop designated rows
-        for (int j = 0; j < size_n; j++) {  // Loop columns
-            int sum = 0;  // Init sum
-            for (int k = 0; k < size_n; k++) {  // Loop through place in row or column
-                sum += a[i][k] * b[k][j];  // Increment sum
-            }
-            c[i][j] = sum;  // Assign sum to position in matrix c
-        }
-    }
+    // Run the packed kernel over the rows designated to the thread - counted per pool thread
+    PerfRegion region("multiply");
+    multiplyPacked(a, b, c, start, end);
+    return nullptr;
+}
+
+// StealParams struct - one per worker slot when tiles are scheduled by work stealing
+template <typename T, typename Acc>
+struct StealParams {
+    const BasicMatrix<T> &a;
+    const BasicPackedB<T> &b;
+    BasicMatrix<Acc> &c;
+    WorkStealingScheduler &scheduler;
+    int worker;
+};
+
+// pthreads function for work stealing - run tiles until none are left to claim
+template <typename T, typename Acc>
+void *calcTiles(void *args) {
+    StealParams<T, Acc> *p = static_cast<StealParams<T, Acc> *>(args);
+    PerfRegion region("multiply");
+    p->scheduler.run(p->worker, [p](const TileTask &tile) {
+        multiplyTile(p->a, p->b, p->c, tile);
+    });
+    return nullptr;
+}
+
+// FillParams struct - one slice of rows of a matrix to fill with random values
+template <typename T>
+struct FillParams {
+    BasicMatrix<T> &matrix;
+    const CounterRng &rng;
+    int minVal;
+    int maxVal;
+    int start;
+    int end;
+};
+
+// pthreads function for filling - values depend only on position, so the slicing doesn't change the matrix
+template <typename T>
+void *fillRows(void *args) {
+    FillParams<T> *p = static_cast<FillParams<T> *>(args);
+    fillRandomBlock(p->matrix.row(p->start), p->matrix.cols, Range{p->start, p->end}, Range{0, p->matrix.cols}, p->rng, p->minVal, p->maxVal);
     return nullptr;
 }
 
-// Function to print square matrix
-void printSqMatrix (const vector<vector<int> > &matrix) {
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            // Update setw if additional leading spaces required
-            cout << setw(6) << setfill(' ') << matrix[i][j] << " ";
+// Function to print matrix
+template <typename T>
+void printMatrix (const BasicMatrix<T> &matrix) {
+    for (int i = 0; i < matrix.rows; i++) {
+        for (int j = 0; j < matrix.cols; j++) {
+            // Update setw if additional leading spaces required - unary + prints int8 as a number, not a character
+            cout << setw(6) << setfill(' ') << +matrix(i, j) << " ";
         }
         cout << endl;
     }
     cout << endl;
 }
 
-// Function to fill square matrix with random values - pass true if output is required
-void fillSqMatrix(vector<vector<int> > &matrix, minstd_rand &gen, uniform_int_distribution<> &distrib, const bool verbose = false) {
-    // Loop through and populate vector with random values
-    for (int i = 0; i < size_n; i++) {  // Loop throw rows
-        for (int j = 0; j < size_n; j++) {  // Loop through columns
-            matrix[i][j] = distrib(gen);  // Assign random value
-        }
+// Function to fill matrix with random values between minVal and maxVal - pass true if output is required
+// Worker i fills balanced slice i of the rows - the slice it computes, so its first touch places them on its node
+template <typename T>
+void fillMatrix(BasicMatrix<T> &matrix, const CounterRng &rng, const int minVal, const int maxVal, ThreadPool &pool, const bool verbose = false) {
+    const int num_threads = pool.size();
+    vector<FillParams<T>> p;
+    p.reserve(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        const Range rows = balancedRange(matrix.rows, num_threads, i);
+        p.push_back(FillParams<T>{matrix, rng, minVal, maxVal, rows.start, rows.end});
+        pool.submitTo(i, fillRows<T>, &p[i]);
     }
+    pool.wait();
     // Display matrix if verbose is true
     if (verbose) {
-        printSqMatrix(matrix);
+        printMatrix(matrix);
     }
 }
 
-// Function to multiplay two square matrices together
-void multiplySqMatrix(const vector<vector<int> > &a, const vector<vector<int> > &b, vector<vector<int> > &c) {
-    // Create thread pool vector and reserve memory
-    vector<pthread_t> threads;
-    threads.reserve(num_threads);
+// Function to multiplay two matrices together - work is handed to the persistent worker pool
+// With a scheduler, tiles are balanced by work stealing, otherwise each job gets a fixed slice of rows
+template <typename T, typename Acc>
+void multiplyMatrix(const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c, ThreadPool &pool, WorkStealingScheduler *scheduler) {
+    // Pack b into micro-panels once - shared read-only by every thread
+    BasicPackedB<T> packed_b;
+    {
+        PerfRegion region("pack");
+        packed_b = packB(b, pool.size());  // OMP threads when built with OpenMP, otherwise the calling thread
+    }
+    const int num_threads = pool.size();
 
-    // Create params vector and reserve memory
-    vector<ThreadParams> p;
-    p.reserve(num_threads);
+    if (scheduler != nullptr) {
+        // One job per worker slot - each starts on its own run of tiles and steals once it runs out
+        scheduler->reset(makeTileTasks(c.rows, c.cols, num_threads));
+        vector<StealParams<T, Acc>> p;
+        p.reserve(num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            p.push_back(StealParams<T, Acc>{a, packed_b, c, *scheduler, i});
+            pool.submitTo(i, calcTiles<T, Acc>, &p[i]);
+        }
+        pool.wait();
+        return;
+    }
 
-    // Determine partition size value
-    int partitionSize = size_n / num_threads;
+    // Create params vector and reserve memory - reserved so the addresses handed to the pool stay valid
+    vector<ThreadParams<T, Acc>> p;
+    p.reserve(num_threads);
 
-    // For loop to fill thread param vector and create threads
+    // For loop to fill thread param vector and submit jobs to the pool
+    // Worker i takes balanced slice i of the rows - remainder rows go one each to the first workers
     for (int i = 0; i < num_threads; i++) {
-        p.push_back(ThreadParams{a, b, c, i * partitionSize, (i + 1) * partitionSize});
-        pthread_create(&threads[i], nullptr, calcProduct, &p[i]);
+        const Range rows = balancedRange(c.rows, num_threads, i);
+        p.push_back(ThreadParams<T, Acc>{a, packed_b, c, rows.start, rows.end});
+        pool.submitTo(i, calcProduct<T, Acc>, &p[i]);
     }
 
-    // Join threads
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], nullptr);
-    }
+    // Wait for every slice to finish
+    pool.wait();
 }
 
-int main() {
-    // Random number generation
+// Fill, multiply and time one product with elements of type T accumulated in Acc
+template <typename T, typename Acc>
+microseconds runMultiply(const MatrixDims &dims, const MatrixFiles &files, const uint64_t seed, ThreadPool &pool, WorkStealingScheduler *scheduler, const int repeat,
+                         const int verify_rounds, const PinPlaces pin, const vector<ThreadPlacement> &threads, const bool placement, bool &verified) {
+    // Random number generation - a and b are separate streams of one seed
     constexpr int minVal = 1, maxVal = 100;  // Min and max value for random integer
-    // Usage outlined here - https://en.cppreference.com/w/cpp/numeric/random/uniform_int_distribution
-    minstd_rand gen{random_device{}()};
-    uniform_int_distribution distrib(minVal, maxVal);
 
-    // Init vectors a, b and c with zeros
-    vector a(size_n, vector(size_n, 0));
-    vector b(size_n, vector(size_n, 0));
-    vector c(size_n, vector(size_n, 0));
+    // Inputs are mapped from --a/--b when given, and C is mapped straight onto --c - otherwise new matrices,
+    // allocated untouched so the pool's workers write every page first
+    MappedMatrix<T> a_file, b_file;
+    MappedMatrix<Acc> c_file;
+    BasicMatrix<T> a = inputMatrix(a_file, files.a, dims.m, dims.k);
+    BasicMatrix<T> b = inputMatrix(b_file, files.b, dims.k, dims.n);
+    BasicMatrix<Acc> c = outputMatrix(c_file, files.c, dims.m, dims.n);
 
-    // Fill vectors a and b with random values
-    fillSqMatrix(a, gen, distrib);
-    fillSqMatrix(b, gen, distrib);
+    // Fill matrices a and b with random values, unless they came from files, and init c with zeros,
+    // each worker on its own slice of rows
+    if (files.a.empty()) {
+        fillMatrix(a, CounterRng(seed, matrix_a_stream), minVal, maxVal, pool);
+    }
+    if (files.b.empty()) {
+        fillMatrix(b, CounterRng(seed, matrix_b_stream), minVal, maxVal, pool);
+    }
+    if (files.c.empty()) {
+        firstTouchZero(c, pool);
+    }
 
-    // Get matrix product c - timed section
+    // Report which micro-kernel CPUID selected for this host and element type
+    cout << "Using " << microKernelName(microKernelFor<T, Acc>()) << " micro-kernel" << endl;
+    // Where the workers run and where the pages of a, b and c ended up
+    if (placement) {
+        cout << placementReport(pin, threads, {{"a", {a.data(), a.size() * sizeof(T)}}, {"b", {b.data(), b.size() * sizeof(T)}},
+                                               {"c", {c.data(), c.size() * sizeof(Acc)}}});
+    }
+
+    // Get matrix product c - timed section, repeated to amortise and measure per-call overhead
     const auto start = high_resolution_clock::now();  // Start timer
-    multiplySqMatrix(a, b, c);
+    for (int r = 0; r < repeat; r++) {
+        multiplyMatrix(a, b, c, pool, scheduler);
+    }
     const auto stop = high_resolution_clock::now();  // Stop timer
 
     // Test print matrix c
-    // printSqMatrix(c);
+    // printMatrix(c);
+
+    // Freivalds check of c in O(n^2) - outside the timed section
+    if (verify_rounds > 0) {
+        const auto verify_start = high_resolution_clock::now();
+        const FreivaldsResult result = freivaldsVerify(a, b, c, verify_rounds, seed, pool.size());
+        const auto verify_stop = high_resolution_clock::now();
+        verified = result.passed();
+        cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+             << duration_cast<microseconds>(verify_stop - verify_start).count() << " microseconds" << endl;
+    }
+
+    return duration_cast<microseconds>(stop - start) / repeat;
+}
+
+int main(int argc, char **argv) {
+    // Matrix dimensions and thread count from the command line - C (m x n) = A (m x k) * B (k x n)
+    // Matrices can come from binary matrix files instead (--a, --b), which also set the shape, and C can be saved (--c)
+    const MatrixFiles files{stringOption(argc, argv, "--a", ""), stringOption(argc, argv, "--b", ""), stringOption(argc, argv, "--c", "")};
+    MatrixDims dims;
+    string file_type = "int32";
+    // Pool size, timed repetitions, and Freivalds rounds for --verify
+    int num_threads, repeat, verify_rounds;
+    try {
+        dims = dimsFromFiles(dimsOption(argc, argv, default_size), files);
+        if (!files.a.empty()) {
+            file_type = matrixTypeName(readMatrixHeader(files.a).type);
+        }
+        num_threads = threadsOption(argc, argv, default_threads);
+        repeat = intOptionAtLeast(argc, argv, "--repeat", default_repeat, 1);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+    }
+    catch (const exception &e) {  // Malformed options, or unreadable or mismatched matrix files
+        cerr << e.what() << endl;
+        return 1;
+    }
+    // --verify checks the product with verify_rounds Freivalds rounds - a wrong product passes with probability 2^-rounds
+    // --perf counts cycles, instructions and cache and TLB misses of the pack and of each pool thread's multiply
+    const bool perf = flagOption(argc, argv, "--perf");
+    perfEnable(perf);
+
+    // Element type, optionally with a wider accumulator - int8, int16, int32, int32:int64, int64, float, float:double, double
+    // Defaults to the element type of the --a file
+    const string type = stringOption(argc, argv, "--type", file_type);
+    // --schedule static restores fixed row slices, the default steal balances tiles at runtime
+    const bool steal = stringOption(argc, argv, "--schedule", "steal") != "static";
+    // --pin threads|cores|sockets|numa_domains binds worker i close to place i with pthread_setaffinity_np
+    // --placement reports the CPU and node of every worker and the nodes holding each matrix, implied by --pin
+    PinPlaces pin;
+    try {
+        pin = pinOption(argc, argv);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    const bool placement = pin != PinPlaces::none || flagOption(argc, argv, "--placement");
+
+    // Worker threads and the scheduler's deques are created once here and reused by every multiply
+    // Workers are pinned before the matrices are touched, so first touches happen where they will stay
+    ThreadPool pool(num_threads);
+    WorkStealingScheduler scheduler(num_threads);
+    const vector<ThreadPlacement> threads = pinPoolWorkers(pool, pin);
 
-    // Calculate duration and record result
-    const auto duration = duration_cast<microseconds>(stop - start);
+    // Random inputs are reproducible from --seed - printed so any run can be repeated
+    const uint64_t seed = seedOption(argc, argv);
+    if (files.a.empty() || files.b.empty()) {
+        cout << "Seed: " << seed << endl;
+    }
+
+    // Calculate duration for the chosen types and record result
+    microseconds duration;
+    bool known, verified = true;
+    try {
+        known = withGemmTypes(type, [&](auto element, auto accumulator) {
+            duration = runMultiply<typename decltype(element)::type, typename decltype(accumulator)::type>(dims, files, seed, pool, steal ? &scheduler : nullptr, repeat,
+                                                                                                          verify_rounds, pin, threads, placement, verified);
+        });
+    }
+    catch (const exception &e) {  // Unreadable or mismatched matrix files
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!known) {
+        cerr << "Unknown --type " << type << endl;
+        return 1;
+    }
+
+    // Record result
     cout << "Time taken for pthreads matrix multiplication: " << duration.count() << " microseconds" << endl;
     ofstream output("pthreads_output.txt");
     if (!output.is_open()) {  // Check that the file opened, output error if it didn't
@@ -133,6 +308,9 @@ int main() {
     }
     output << "Time taken for pthreads matrix multiplication: " << duration.count() << " microseconds" << endl;
     output.close();
+    if (perf) {
+        cout << perfReport();
+    }
 
-    return 0;
+    return verified ? 0 : 1;
 }
\ No newline at end of file
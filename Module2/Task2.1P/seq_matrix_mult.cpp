@@ -4,80 +4,176 @@
 #include <chrono>
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
+#include "../../common/matrix.h"
+#include "../../common/gemm.h"
+#include "../../common/strassen.h"
+#include "../../common/cli.h"
+#include "../../common/matrix_file.h"
+#include "../../common/random.h"
+#include "../../common/freivalds.h"
+#include "../../common/perf_counters.h"
 
 // Namespaces added for readability
 using namespace std;
 using namespace chrono;
 
-// Size of square matrix to generate - global
-constexpr int size_n = 1024;
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 1024;
+// Default Strassen leaf size when --cutoff is not given - 0 tunes it on first use
+constexpr int default_cutoff = 0;
 
-// Function to print square matrix
-void printSqMatrix (const vector<vector<int> > &matrix) {
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            // Update setw if additional leading zeros required
-            cout << setw(5) << setfill('0') << matrix[i][j] << " ";
+// Function to print matrix
+template <typename T>
+void printMatrix (const BasicMatrix<T> &matrix) {
+    for (int i = 0; i < matrix.rows; i++) {
+        for (int j = 0; j < matrix.cols; j++) {
+            // Update setw if additional leading zeros required - unary + prints int8 as a number, not a character
+            cout << setw(5) << setfill('0') << +matrix(i, j) << " ";
         }
         cout << endl;
     }
     cout << endl;
 }
 
-// Function to fill square matrix with random values - pass true if output is required
-void fillSqMatrix(vector<vector<int> > &matrix, minstd_rand &gen, uniform_int_distribution<> &distrib, const bool verbose = false) {
-    // Loop through and populate vector with random values
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            matrix[i][j] = distrib(gen);
-        }
-    }
+// Function to fill matrix with random values between minVal and maxVal - pass true if output is required
+// Each value depends only on the seed, the stream and its position, so the matrix is the same for any thread count
+template <typename T>
+void fillMatrix(BasicMatrix<T> &matrix, const CounterRng &rng, const int minVal, const int maxVal, const int num_threads, const bool verbose = false) {
+    fillRandom(matrix.data(), matrix.rows, matrix.cols, rng, minVal, maxVal, num_threads);
     // Display matrix if verbose is true
     if (verbose) {
-        printSqMatrix(matrix);
+        printMatrix(matrix);
     }
 }
 
-// Function to multiplay two square matrices together
-void multiplySqMatrix(const vector<vector<int> > &a, const vector<vector<int> > &b, vector<vector<int> > &c) {
-    // Loop through and perform matrix multiplication
-    for (int i = 0; i < size_n; i++) {
-        for (int j = 0; j < size_n; j++) {
-            int sum = 0;
-            for (int k = 0; k < size_n; k++) {
-                sum += a[i][k] * b[k][j];
-            }
-            c[i][j] = sum;
-        }
+// Function to multiplay two matrices together - pack b into micro-panels, then run the blocked kernel over all rows
+template <typename T, typename Acc>
+void multiplyMatrix(const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c) {
+    BasicPackedB<T> packed_b;
+    {
+        PerfRegion region("pack");
+        packed_b = packB(b, 1);  // Sequential, so packing stays on this thread too
     }
+    PerfRegion region("multiply");
+    multiplyPacked(a, packed_b, c, 0, c.rows);
 }
 
-int main() {
-    // Init vectors a, b and c with zeros
-    vector a(size_n, vector(size_n, 0));
-    vector b(size_n, vector(size_n, 0));
-    vector c(size_n, vector(size_n, 0));
+// Fill, multiply and time one product with elements of type T accumulated in Acc
+template <typename T, typename Acc>
+microseconds runMultiply(const MatrixDims &dims, const MatrixFiles &files, const uint64_t seed, const bool strassen, int cutoff,
+                         const int verify_rounds, bool &verified) {
+    // Inputs are mapped from --a/--b when given, and C is mapped straight onto --c - otherwise new matrices
+    MappedMatrix<T> a_file, b_file;
+    MappedMatrix<Acc> c_file;
+    BasicMatrix<T> a = inputMatrix(a_file, files.a, dims.m, dims.k);
+    BasicMatrix<T> b = inputMatrix(b_file, files.b, dims.k, dims.n);
+    BasicMatrix<Acc> c = outputMatrix(c_file, files.c, dims.m, dims.n);
+    // Init c with zeros - faults its pages in here rather than inside the timed multiply
+    if (files.c.empty()) {
+        fill(c.data(), c.data() + c.size(), Acc{});
+    }
 
-    // Random number generation
+    // Random number generation - a and b are separate streams of one seed
     constexpr int minVal = 1, maxVal = 100;  // Min and max value for random integer
-    // Usage outlined here - https://en.cppreference.com/w/cpp/numeric/random/uniform_int_distribution
-    minstd_rand gen{random_device{}()};
-    uniform_int_distribution distrib(minVal, maxVal);
 
-    // Fill vectors a and b with random values
-    fillSqMatrix(a, gen, distrib);
-    fillSqMatrix(b, gen, distrib);
+    // Fill matrices a and b with random values, unless they came from files
+    if (files.a.empty()) {
+        fillMatrix(a, CounterRng(seed, matrix_a_stream), minVal, maxVal, 1);
+    }
+    if (files.b.empty()) {
+        fillMatrix(b, CounterRng(seed, matrix_b_stream), minVal, maxVal, 1);
+    }
+
+    // Report which micro-kernel CPUID selected for this host and element type
+    cout << "Using " << microKernelName(microKernelFor<T, Acc>()) << " micro-kernel" << endl;
+
+    // Strassen leaf size - tuned outside the timed section
+    if (strassen) {
+        if (cutoff <= 0) {
+            cutoff = strassenCutoff<Acc>(1);
+        }
+        cout << "Using Strassen-Winograd with a cutoff of " << cutoff << endl;
+    }
 
     // Get matrix product c - timed section
     const auto start = high_resolution_clock::now();  // Start timer
-    multiplySqMatrix(a, b, c);
+    if (strassen) {
+        PerfRegion region("multiply");
+        strassenMultiply(a, b, c, cutoff, 1);
+    }
+    else {
+        multiplyMatrix(a, b, c);
+    }
     const auto stop = high_resolution_clock::now();  // Stop timer
 
     // Test print matrix c
-    // printSqMatrix(c);
+    // printMatrix(c);
+
+    // Freivalds check of c in O(n^2) - outside the timed section
+    if (verify_rounds > 0) {
+        const auto verify_start = high_resolution_clock::now();
+        const FreivaldsResult result = freivaldsVerify(a, b, c, verify_rounds, seed, 1);
+        const auto verify_stop = high_resolution_clock::now();
+        verified = result.passed();
+        cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+             << duration_cast<microseconds>(verify_stop - verify_start).count() << " microseconds" << endl;
+    }
 
-    // Calculate duration and record result
-    const auto duration = duration_cast<microseconds>(stop - start);
+    return duration_cast<microseconds>(stop - start);
+}
+
+int main(int argc, char **argv) {
+    // Matrix dimensions from the command line - C (m x n) = A (m x k) * B (k x n)
+    // Matrices can come from binary matrix files instead (--a, --b), which also set the shape, and C can be saved (--c)
+    const MatrixFiles files{stringOption(argc, argv, "--a", ""), stringOption(argc, argv, "--b", ""), stringOption(argc, argv, "--c", "")};
+    MatrixDims dims;
+    string file_type = "int32";
+    // Strassen leaf size for --algorithm strassen, and Freivalds rounds for --verify
+    int cutoff, verify_rounds;
+    try {
+        dims = dimsFromFiles(dimsOption(argc, argv, default_size), files);
+        if (!files.a.empty()) {
+            file_type = matrixTypeName(readMatrixHeader(files.a).type);
+        }
+        cutoff = intOption(argc, argv, "--cutoff", default_cutoff);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+    }
+    catch (const exception &e) {  // Malformed options, or unreadable or mismatched matrix files
+        cerr << e.what() << endl;
+        return 1;
+    }
+    // Element type, optionally with a wider accumulator - int8, int16, int32, int32:int64, int64, float, float:double, double
+    // Defaults to the element type of the --a file
+    const string type = stringOption(argc, argv, "--type", file_type);
+    // --algorithm strassen recurses Strassen-Winograd down to --cutoff before the blocked kernel, the default is blocked only
+    const bool strassen = stringOption(argc, argv, "--algorithm", "blocked") == "strassen";
+    // Random inputs are reproducible from --seed - printed so any run can be repeated
+    const uint64_t seed = seedOption(argc, argv);
+    if (files.a.empty() || files.b.empty()) {
+        cout << "Seed: " << seed << endl;
+    }
+    // --verify checks the product with verify_rounds Freivalds rounds - a wrong product passes with probability 2^-rounds
+    // --perf counts cycles, instructions and cache and TLB misses of the pack and multiply and prints them at the end
+    const bool perf = flagOption(argc, argv, "--perf");
+    perfEnable(perf);
+
+    // Calculate duration for the chosen types and record result
+    microseconds duration;
+    bool known, verified = true;
+    try {
+        known = withGemmTypes(type, [&](auto element, auto accumulator) {
+            duration = runMultiply<typename decltype(element)::type, typename decltype(accumulator)::type>(dims, files, seed, strassen, cutoff, verify_rounds, verified);
+        });
+    }
+    catch (const exception &e) {  // Unreadable or mismatched matrix files
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!known) {
+        cerr << "Unknown --type " << type << endl;
+        return 1;
+    }
     cout << "Time taken for sequential matrix multiplication: " << duration.count() << " microseconds" << endl;
     ofstream output("sequential_output.txt");
     if (!output.is_open()) {  // Check that the file opened, output error if it didn't
@@ -86,6 +182,9 @@ int main() {
     }
     output << "Time taken for sequential matrix multiplication: " << duration.count() << " microseconds" << endl;
     output.close();
+    if (perf) {
+        cout << perfReport();
+    }
 
-    return 0;
+    return verified ? 0 : 1;
 }
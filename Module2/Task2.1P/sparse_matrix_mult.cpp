@@ -0,0 +1,129 @@
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <omp.h>
+#include "../../common/matrix.h"
+#include "../../common/sparse.h"
+#include "../../common/cli.h"
+
+// Namespaces added for readability
+using namespace std;
+using namespace chrono;
+
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 2048;
+// Default number of threads when --threads is not given
+constexpr int default_threads = 8;
+// Default fraction of non-zero entries when --density is not given - 95% zeros
+constexpr double default_density = 0.05;
+
+// Function to fill matrix with random values
+void fillMatrix(Matrix &matrix, minstd_rand &gen, uniform_int_distribution<> &distrib) {
+    for (int i = 0; i < matrix.rows; i++) {
+        for (int j = 0; j < matrix.cols; j++) {
+            matrix(i, j) = distrib(gen);
+        }
+    }
+}
+
+// Megabytes, for the memory report
+double megabytes(const size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+int main(int argc, char **argv) {
+    // Matrix dimensions and thread count from the command line - C (m x n) = A (m x k) * B (k x n)
+    MatrixDims dims;
+    int num_threads;
+    double density;
+    try {
+        dims = dimsOption(argc, argv, default_size);
+        num_threads = threadsOption(argc, argv, default_threads);
+        density = doubleOption(argc, argv, "--density", default_density);
+    }
+    catch (const exception &e) {  // Malformed or out of range options
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // --mode spmm multiplies sparse A by dense B, csc multiplies dense A by sparse B (stored by column)
+    // and spgemm multiplies sparse A by sparse B
+    const string mode = stringOption(argc, argv, "--mode", "spmm");
+    // --partition rows splits rows evenly by count instead of by non-zeros, for comparison
+    const bool by_nnz = stringOption(argc, argv, "--partition", "nnz") != "rows";
+
+    // Random number generation - values are never zero, so the density is exactly the fraction of stored entries
+    constexpr int minVal = 1, maxVal = 100;  // Min and max value for random integer
+    minstd_rand gen{random_device{}()};
+    uniform_int_distribution distrib(minVal, maxVal);
+
+    // Size of the sparse operand as stored, and as it would be if it were dense
+    size_t sparse_bytes = 0, dense_bytes = 0, nnz = 0;
+    microseconds duration;
+
+    if (mode == "spgemm") {
+        const CsrMatrix<int> a = randomCsr<int>(dims.m, dims.k, density, gen, distrib);
+        const CsrMatrix<int> b = randomCsr<int>(dims.k, dims.n, density, gen, distrib);
+        sparse_bytes = a.bytes();
+        dense_bytes = static_cast<size_t>(dims.m) * dims.k * sizeof(int);
+        nnz = a.nnz();
+
+        // Get matrix product c - timed section
+        const auto start = high_resolution_clock::now();  // Start timer
+        const CsrMatrix<int> c = spgemm<int, int>(a, b, num_threads);
+        const auto stop = high_resolution_clock::now();  // Stop timer
+        duration = duration_cast<microseconds>(stop - start);
+
+        cout << "Non-zeros in C: " << c.nnz() << " (" << 100.0 * c.nnz() / (static_cast<double>(c.rows) * c.cols) << "%)" << endl;
+    }
+    else if (mode == "csc") {
+        Matrix a(dims.m, dims.k);
+        fillMatrix(a, gen, distrib);
+        const CscMatrix<int> b = csrToCsc(randomCsr<int>(dims.k, dims.n, density, gen, distrib));
+        Matrix c(dims.m, dims.n);
+        sparse_bytes = b.bytes();
+        dense_bytes = static_cast<size_t>(dims.k) * dims.n * sizeof(int);
+        nnz = b.nnz();
+
+        const auto start = high_resolution_clock::now();  // Start timer
+        spmmCsc(a, b, c, num_threads);
+        const auto stop = high_resolution_clock::now();  // Stop timer
+        duration = duration_cast<microseconds>(stop - start);
+    }
+    else if (mode == "spmm") {
+        const CsrMatrix<int> a = randomCsr<int>(dims.m, dims.k, density, gen, distrib);
+        Matrix b(dims.k, dims.n);
+        fillMatrix(b, gen, distrib);
+        Matrix c(dims.m, dims.n);
+        sparse_bytes = a.bytes();
+        dense_bytes = static_cast<size_t>(dims.m) * dims.k * sizeof(int);
+        nnz = a.nnz();
+
+        const auto start = high_resolution_clock::now();  // Start timer
+        spmm(a, b, c, num_threads, by_nnz);
+        const auto stop = high_resolution_clock::now();  // Stop timer
+        duration = duration_cast<microseconds>(stop - start);
+    }
+    else {
+        cerr << "Unknown --mode " << mode << endl;
+        return 1;
+    }
+
+    // Storage of the sparse operand against its dense equivalent
+    cout << "Sparse operand: " << nnz << " non-zeros, " << megabytes(sparse_bytes) << " MB stored vs "
+         << megabytes(dense_bytes) << " MB dense" << endl;
+
+    // Record result
+    cout << "Time taken for sparse (" << mode << ") matrix multiplication: " << duration.count() << " microseconds" << endl;
+    ofstream output("sparse_output.txt");
+    if (!output.is_open()) {  // Check that the file opened, output error if it didn't
+        cerr << "Failed to open file." << endl;
+        return 1;
+    }
+    output << "Time taken for sparse (" << mode << ") matrix multiplication: " << duration.count() << " microseconds" << endl;
+    output.close();
+
+    return 0;
+}
@@ -5,6 +5,10 @@
 #include <fstream>
 #include <iomanip>
 #include <omp.h>
+#include "../../common/huge_pages.h"
+#include "../../common/partition.h"
+#include "../../common/random.h"
+#include "../../common/numa.h"
 
 // Namespaces added for readability
 using namespace std;
@@ -18,7 +22,7 @@ constexpr int n_threads = 8;
 constexpr int limit = 200;
 
 // Function to print vector - used for testing
-void outputVector (const vector<int> &vec) {
+void outputVector (const HugeVector<int> &vec) {
     for (int i = 0; i < size_n; i++) {
         // Update setw if additional leading zeros required
         cout << setw(5) << setfill('0') << vec[i] << " ";
@@ -26,11 +30,17 @@ void outputVector (const vector<int> &vec) {
     cout << endl;
 }
 
-// Function to fill vector with random values
-void fillVector(vector<int> &vec, minstd_rand &gen, uniform_int_distribution<> &distrib, const bool verbose = false) {
+// Function to fill vector with random values between minVal and maxVal
+// Each thread fills a balanced slice, so its first touch places that slice on its own node - values depend only
+// on the seed and index, so the vector is the same for any thread count
+void fillVector(HugeVector<int> &vec, const CounterRng &rng, const int minVal, const int maxVal, const bool verbose = false) {
     // Loop through and populate vector with random values
-    for (int i = 0; i < size_n; i++){
-        vec[i] = distrib(gen);
+    #pragma omp parallel num_threads(n_threads)
+    {
+        const Range slice = balancedRange(size_n, omp_get_num_threads(), omp_get_thread_num());
+        for (int i = slice.start; i < slice.end; i++) {
+            vec[i] = rng.uniformInt(i, minVal, maxVal);
+        }
     }
     // Display vector if verbose is true
     if (verbose) {
@@ -39,7 +49,7 @@ void fillVector(vector<int> &vec, minstd_rand &gen, uniform_int_distribution<> &
 }
 
 // Partition around pivot
-auto partition(vector<int> &vec, int lo, int hi) -> int {
+auto partition(HugeVector<int> &vec, int lo, int hi) -> int {
     const int pivot = vec[hi];
     int i = lo;
 
@@ -54,7 +64,7 @@ auto partition(vector<int> &vec, int lo, int hi) -> int {
 }
 
 // Quicksort algorithm
-void quicksort(vector<int> &vec, int lo, int hi) {
+void quicksort(HugeVector<int> &vec, int lo, int hi) {
     if (lo >= hi) {
         return;
     }
@@ -74,18 +84,47 @@ void quicksort(vector<int> &vec, int lo, int hi) {
     }
 }
 
-int main() {
-    // Init vector a of size_n
-    vector<int> a(size_n);
+int main(int argc, char **argv) {
+    // --huge-pages off|thp|hugetlb picks how the vector is backed - transparent huge pages by default
+    try {
+        setHugePageMode(hugePagesOption(argc, argv));
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
 
-    // Random number generation
-    constexpr int minVal = 1, maxVal = 999999999;  // Min and max value for random integer
-    // Usage outlined here - https://en.cppreference.com/w/cpp/numeric/random/uniform_int_distribution
-    minstd_rand gen{random_device{}()};
-    uniform_int_distribution distrib(minVal, maxVal);
+    // --pin threads|cores|sockets|numa_domains binds thread i close to place i - OMP_PLACES takes precedence when set
+    // --placement reports the CPU and node of every thread and the nodes holding the vector, implied by --pin
+    PinPlaces pin;
+    try {
+        pin = pinOption(argc, argv);
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    const bool placement = pin != PinPlaces::none || flagOption(argc, argv, "--placement");
+    // Pin the team before the vector is touched, so first touches happen where the threads will stay
+    const vector<ThreadPlacement> threads = pinOmpThreads(pin, n_threads);
+
+    // Init vector a of size_n - 400 MB, so it comes from huge pages unless --huge-pages off
+    // Left untouched here, so the fill decides which node each page lands on
+    HugeVector<int> a(size_n);
 
-    // Fill vector a with random ints
-    fillVector(a, gen, distrib);
+    // Random number generation - reproducible from --seed, printed so the run can be repeated
+    constexpr int minVal = 1, maxVal = 999999999;  // Min and max value for random integer
+    const uint64_t seed = seedOption(argc, argv);
+    cout << "Seed: " << seed << endl;
+
+    // Fill vector a with random ints, each thread on its own slice
+    fillVector(a, CounterRng(seed, matrix_a_stream), minVal, maxVal);
+    // Report the pages backing the vector - read after the fill, since transparent huge pages back only touched memory
+    cout << "Pages: " << pageSizeSummary(a.data(), a.size() * sizeof(int)) << endl;
+    // Where the threads run and where the pages of the vector ended up
+    if (placement) {
+        cout << placementReport(pin, threads, {{"a", {a.data(), a.size() * sizeof(int)}}});
+    }
 
     // Get matrix product c - timed section
     const auto start = high_resolution_clock::now();  // Start timer
@@ -4,6 +4,7 @@
 #include <chrono>
 #include <fstream>
 #include <iomanip>
+#include "../../common/huge_pages.h"
 
 // Namespaces added for readability
 using namespace std;
@@ -13,7 +14,7 @@ using namespace chrono;
 constexpr int size_n = 10000000;
 
 // Function to print vector - used for testing
-void outputVector (const vector<int> &vec) {
+void outputVector (const HugeVector<int> &vec) {
     for (int i = 0; i < size_n; i++) {
         // Update setw if additional leading zeros required
         cout << setw(5) << setfill('0') << vec[i] << " ";
@@ -22,7 +23,7 @@ void outputVector (const vector<int> &vec) {
 }
 
 // Function to fill vector with random values
-void fillVector(vector<int> &vec, minstd_rand &gen, uniform_int_distribution<> &distrib, const bool verbose = false) {
+void fillVector(HugeVector<int> &vec, minstd_rand &gen, uniform_int_distribution<> &distrib, const bool verbose = false) {
     // Loop through and populate vector with random values
     for (int i = 0; i < size_n; i++){
         vec[i] = distrib(gen);
@@ -34,7 +35,7 @@ void fillVector(vector<int> &vec, minstd_rand &gen, uniform_int_distribution<> &
 }
 
 // Lomuto partitioning adapted from pseudocode at https://en.wikipedia.org/wiki/Quicksort
-auto partition(vector<int> &vec, const int lo, const int hi) -> int {
+auto partition(HugeVector<int> &vec, const int lo, const int hi) -> int {
     // Last element is designated as pivot
     const int pivot = vec[hi];
     // Temp pivot index
@@ -52,7 +53,7 @@ auto partition(vector<int> &vec, const int lo, const int hi) -> int {
 }
 
 // Quicksort algorithm
-void quicksort(vector<int> &vec, int lo, int hi) {
+void quicksort(HugeVector<int> &vec, int lo, int hi) {
     if (lo >= hi) {
         return;
     }
@@ -64,9 +65,18 @@ void quicksort(vector<int> &vec, int lo, int hi) {
 
 }
 
-int main() {
-    // Init vector a of size_n
-    vector<int> a(size_n);
+int main(int argc, char **argv) {
+    // --huge-pages off|thp|hugetlb picks how the vector is backed - transparent huge pages by default
+    try {
+        setHugePageMode(hugePagesOption(argc, argv));
+    }
+    catch (const exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // Init vector a of size_n - 40 MB, so it comes from huge pages unless --huge-pages off
+    HugeVector<int> a(size_n);
 
     // Random number generation
     constexpr int minVal = 1, maxVal = 999999999;  // Min and max value for random integer
@@ -76,6 +86,8 @@ int main() {
 
     // Fill vectors a and b with random values
     fillVector(a, gen, distrib);
+    // Report the pages backing the vector - read after the fill, since transparent huge pages back only touched memory
+    cout << "Pages: " << pageSizeSummary(a.data(), a.size() * sizeof(int)) << endl;
 
     // Get matrix product c - timed section
     const auto start = high_resolution_clock::now();  // Start timer
@@ -0,0 +1,324 @@
+#include <mpi.h>
+#include <iostream>
+#include <chrono>
+#include <omp.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <utility>
+#include "../../common/gemm.h"
+#include "../../common/cli.h"
+#include "../../common/partition.h"
+#include "../../common/random.h"
+#include "../../common/freivalds_mpi.h"
+#include "../../common/summa.h"
+#include "../../common/mpi_pipeline.h"
+#include "../../common/node_shared.h"
+#include "../../common/benchmark.h"
+#include "../../common/huge_pages.h"
+
+using namespace std::chrono;
+using namespace std;
+
+// Benchmark driver for the MPI multiplies - run under mpirun, it sweeps every algorithm of matrix_mult_mpi_omp over
+// sizes and OMP thread counts per process, in int32 like the programs
+// rows scatters A and broadcasts B, rows-shared keeps one packed B per node (--shared-b), summa runs the 2D block
+// decomposition and pipelined overlaps chunked transfers with compute
+// Each timed sample is the slowest process's time, after a barrier lines them up, and serial is the packed kernel on
+// one thread of the master - the baseline for efficiency over processes x threads
+
+// Defaults for the sweep when the options are not given
+const string default_variants = "serial,rows,rows-shared,summa,pipelined";
+const string default_sizes = "512,1024";
+const string default_threads = "1,2";
+constexpr int default_warmup = 1;
+constexpr int default_repeat = 5;
+
+// Every variant the driver knows
+const vector<string> known_variants = {"serial", "rows", "rows-shared", "summa", "pipelined"};
+
+// Fill rows block_rows and columns block_cols of a matrix with cols columns with random values from 0 to 99, as in the programs
+void fillMatrix(int* block, const int cols, const Range &block_rows, const Range &block_cols, const CounterRng &rng, const int num_threads) {
+    fillRandomBlock(block, cols, block_rows, block_cols, rng, 0, 99, num_threads);
+}
+
+// Time fn on every process and keep the slowest process's time for each repetition - collective, the master gets the samples
+template <typename Fn>
+vector<double> timeCollective(const int warmup, const int repeat, Fn &&fn) {
+    const vector<double> samples = timeRepetitions(warmup, repeat, fn, [] { MPI_Barrier(MPI_COMM_WORLD); });
+    vector<double> slowest(samples.size());
+    MPI_Reduce(samples.data(), slowest.data(), static_cast<int>(samples.size()), MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    return slowest;
+}
+
+// Freivalds check of the last product - collective, returns "passed" or "failed", or nothing when rounds is 0
+string verifyProduct(const int m, const int k, const int n, const MatrixBlock<int> &a, const MatrixBlock<int> &b,
+                     const MatrixBlock<int> &c, const int rounds, const uint64_t seed, const int num_threads) {
+    if (rounds <= 0) {
+        return "";
+    }
+    return mpiFreivaldsVerify(MPI_COMM_WORLD, m, k, n, a, b, c, rounds, seed, num_threads).passed() ? "passed" : "failed";
+}
+
+// Serial baseline - the master multiplies on one thread while the other processes wait
+vector<double> timeSerial(const int m, const int k, const int n, const int rank, const uint64_t seed, const int warmup,
+                          const int repeat, const int verify_rounds, string &verified) {
+    vector<int> A, B, C;
+    if (rank == 0) {
+        A.resize(static_cast<size_t>(m) * k);
+        B.resize(static_cast<size_t>(k) * n);
+        C.resize(static_cast<size_t>(m) * n);
+        fillMatrix(A.data(), k, Range{0, m}, Range{0, k}, CounterRng(seed, matrix_a_stream), 1);
+        fillMatrix(B.data(), n, Range{0, k}, Range{0, n}, CounterRng(seed, matrix_b_stream), 1);
+    }
+    const vector<double> samples = timeCollective(warmup, repeat, [&] {
+        if (rank == 0) {
+            const PackedB packed_B = packB(B.data(), n, k, n, 1);
+            gemmPacked(m, A.data(), k, packed_B, C.data(), n);
+        }
+    });
+    const int held = rank == 0 ? 1 : 0;
+    verified = verifyProduct(m, k, n, MatrixBlock<int>{A.data(), Range{0, m * held}, Range{0, k}},
+                             MatrixBlock<int>{B.data(), Range{0, k * held}, Range{0, n}},
+                             MatrixBlock<int>{C.data(), Range{0, m * held}, Range{0, n}}, verify_rounds, seed, 1);
+    return samples;
+}
+
+// rows path, as in matrix_mult_mpi_omp - scatter A, broadcast B (or share one packed copy per node), multiply, gather C
+vector<double> timeRows(const int m, const int k, const int n, const int rank, const int numtasks, const int num_threads,
+                        const bool shared_B, const uint64_t seed, const int warmup, const int repeat, const int verify_rounds,
+                        string &verified) {
+    vector<int> counts_A, displs_A, counts_C, displs_C;
+    balancedCounts(m, numtasks, k, counts_A, displs_A);
+    balancedCounts(m, numtasks, n, counts_C, displs_C);
+    const Range process_rows = balancedRange(m, numtasks, rank);
+    const int partition_rows = process_rows.size();
+
+    // Full matrices on the master only - every process holds B unless it is shared
+    vector<int> A, B, C;
+    if (rank == 0 || !shared_B) {
+        B.resize(static_cast<size_t>(k) * n);
+    }
+    if (rank == 0) {
+        A.resize(static_cast<size_t>(m) * k);
+        C.resize(static_cast<size_t>(m) * n);
+        fillMatrix(A.data(), k, Range{0, m}, Range{0, k}, CounterRng(seed, matrix_a_stream), num_threads);
+        fillMatrix(B.data(), n, Range{0, k}, Range{0, n}, CounterRng(seed, matrix_b_stream), num_threads);
+    }
+    vector<int> process_A(static_cast<size_t>(partition_rows) * k);
+    vector<int> process_C(static_cast<size_t>(partition_rows) * n);
+
+    const vector<double> samples = timeCollective(warmup, repeat, [&] {
+        MPI_Scatterv(A.data(), counts_A.data(), displs_A.data(), MPI_INT, process_A.data(), partition_rows * k, MPI_INT, 0, MPI_COMM_WORLD);
+        if (shared_B) {
+            NodeShared node_B;
+            const PackedB packed_B = broadcastPackedBShared(B.data(), k, n, MPI_COMM_WORLD, node_B, num_threads);
+            gemmPackedThreads(partition_rows, process_A.data(), k, packed_B, process_C.data(), n, num_threads);
+            // Every process on the node must be done with the window before it goes
+            MPI_Barrier(MPI_COMM_WORLD);
+            freeNodeShared(node_B);
+        } else {
+            MPI_Bcast(B.data(), k * n, MPI_INT, 0, MPI_COMM_WORLD);
+            const PackedB packed_B = packB(B.data(), n, k, n, num_threads);
+            gemmPackedThreads(partition_rows, process_A.data(), k, packed_B, process_C.data(), n, num_threads);
+        }
+        MPI_Gatherv(process_C.data(), partition_rows * n, MPI_INT, C.data(), counts_C.data(), displs_C.data(), MPI_INT, 0, MPI_COMM_WORLD);
+    });
+
+    // B is split by rows between the processes holding it - the master alone when it is shared
+    const Range b_share = shared_B ? Range{0, rank == 0 ? k : 0} : balancedRange(k, numtasks, rank);
+    verified = verifyProduct(m, k, n, MatrixBlock<int>{process_A.data(), process_rows, Range{0, k}},
+                             MatrixBlock<int>{B.data() + static_cast<size_t>(b_share.start) * n, b_share, Range{0, n}},
+                             MatrixBlock<int>{process_C.data(), process_rows, Range{0, n}}, verify_rounds, seed, num_threads);
+    return samples;
+}
+
+// summa path - each process generates its own blocks where they sit in the full matrices
+vector<double> timeSumma(const int m, const int k, const int n, const int num_threads, const uint64_t seed, const int warmup,
+                         const int repeat, const int verify_rounds, string &verified) {
+    ProcessGrid grid = createProcessGrid(MPI_COMM_WORLD);
+    const BlockRange a_block = localBlock(grid, m, k);
+    const BlockRange b_block = localBlock(grid, k, n);
+    vector<int> local_A(static_cast<size_t>(a_block.rows.size()) * a_block.cols.size());
+    vector<int> local_B(static_cast<size_t>(b_block.rows.size()) * b_block.cols.size());
+    vector<int> local_C(static_cast<size_t>(a_block.rows.size()) * b_block.cols.size());
+    fillMatrix(local_A.data(), k, a_block.rows, a_block.cols, CounterRng(seed, matrix_a_stream), num_threads);
+    fillMatrix(local_B.data(), n, b_block.rows, b_block.cols, CounterRng(seed, matrix_b_stream), num_threads);
+
+    const vector<double> samples = timeCollective(warmup, repeat, [&] {
+        summaMultiply(grid, m, k, n, local_A.data(), local_B.data(), local_C.data(), num_threads);
+    });
+
+    verified = verifyProduct(m, k, n, MatrixBlock<int>{local_A.data(), a_block.rows, a_block.cols},
+                             MatrixBlock<int>{local_B.data(), b_block.rows, b_block.cols},
+                             MatrixBlock<int>{local_C.data(), a_block.rows, b_block.cols}, verify_rounds, seed, num_threads);
+    freeProcessGrid(grid);
+    return samples;
+}
+
+// pipelined path - the master holds the full matrices and chunks of A and B stream out while the previous chunk multiplies
+vector<double> timePipelined(const int m, const int k, const int n, const int rank, const int num_threads, const int chunk_width,
+                             const uint64_t seed, const int warmup, const int repeat, const int verify_rounds, string &verified) {
+    vector<int> A, B, C;
+    if (rank == 0) {
+        A.resize(static_cast<size_t>(m) * k);
+        B.resize(static_cast<size_t>(k) * n);
+        C.resize(static_cast<size_t>(m) * n);
+        fillMatrix(A.data(), k, Range{0, m}, Range{0, k}, CounterRng(seed, matrix_a_stream), num_threads);
+        fillMatrix(B.data(), n, Range{0, k}, Range{0, n}, CounterRng(seed, matrix_b_stream), num_threads);
+    }
+
+    const vector<double> samples = timeCollective(warmup, repeat, [&] {
+        pipelinedRowMultiply(m, k, n, A.data(), B.data(), C.data(), num_threads, chunk_width, MPI_COMM_WORLD);
+    });
+
+    const int held = rank == 0 ? 1 : 0;
+    verified = verifyProduct(m, k, n, MatrixBlock<int>{A.data(), Range{0, m * held}, Range{0, k}},
+                             MatrixBlock<int>{B.data(), Range{0, k * held}, Range{0, n}},
+                             MatrixBlock<int>{C.data(), Range{0, m * held}, Range{0, n}}, verify_rounds, seed, num_threads);
+    return samples;
+}
+
+int main(int argc, char** argv) {
+
+    // MPI setup
+    int numtasks, rank;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Sweep from the command line - comma separated lists of variants, sizes and OMP threads per process
+    // --m/--k/--n pin dimensions for every size, as in matrix_benchmark
+    vector<string> variants = listOption(argc, argv, "--variants", default_variants);
+    vector<int> sizes, thread_counts;
+    // One shape per size, with any --m/--k/--n pinned
+    vector<MatrixDims> shapes;
+    int warmup = 0, repeat = 1, chunk_width = 1;
+    // --verify checks every configuration's product with this many Freivalds rounds
+    int verify_rounds = 0;
+    string error;
+    try {
+        sizes = intListOption(argc, argv, "--sizes", default_sizes);
+        thread_counts = intListOption(argc, argv, "--threads", default_threads);
+        for (const int size : sizes) {
+            shapes.push_back({intOptionAtLeast(argc, argv, "--m", size, 0), intOptionAtLeast(argc, argv, "--k", size, 0),
+                              intOptionAtLeast(argc, argv, "--n", size, 0)});
+        }
+        warmup = intOptionAtLeast(argc, argv, "--warmup", default_warmup, 0);
+        repeat = intOptionAtLeast(argc, argv, "--repeat", default_repeat, 1);
+        chunk_width = intOptionAtLeast(argc, argv, "--chunk", pipeline_chunk_width, 1);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+    }
+    catch (const exception &e) {
+        error = e.what();
+    }
+    for (const string &variant : variants) {
+        if (error.empty() && find(known_variants.begin(), known_variants.end(), variant) == known_variants.end()) {
+            error = "Unknown variant " + variant;
+        }
+    }
+    const string format = stringOption(argc, argv, "--format", "table");
+    const string output = stringOption(argc, argv, "--output", "");
+    if (error.empty() && !knownBenchmarkFormat(format)) {
+        error = "Unknown --format " + format;
+    }
+    if (error.empty() && (sizes.empty() || thread_counts.empty() || variants.empty())) {
+        error = "Nothing to benchmark";
+    }
+    // --huge-pages off|thp|hugetlb picks how matrices of a huge page or more are backed - the pages used are reported
+    try {
+        setHugePageMode(hugePagesOption(argc, argv));
+    }
+    catch (const exception &e) {
+        if (error.empty()) error = e.what();
+    }
+    if (!error.empty()) {  // Every process parses the same arguments, so every process stops here
+        if (rank == 0) cerr << error << endl;
+        MPI_Finalize();
+        return 1;
+    }
+    // serial runs first for each shape, so the report lists the baseline ahead of the variants compared with it
+    stable_partition(variants.begin(), variants.end(), [](const string &variant) { return variant == "serial"; });
+
+    // Inputs are reproducible from --seed - every process uses the master's seed
+    uint64_t seed = seedOption(argc, argv);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        cerr << "Seed: " << seed << endl;
+    }
+
+    vector<BenchmarkResult> results;
+    vector<pair<string, string>> pages;
+    for (const MatrixDims &shape : shapes) {
+        const int m = shape.m, k = shape.k, n = shape.n;
+        // Pages the master's A gets at this shape - the matrices themselves live inside each variant
+        if (rank == 0) {
+            pages.emplace_back("pages_int32_" + to_string(m) + "x" + to_string(k) + "x" + to_string(n),
+                               pageSizeProbe(static_cast<size_t>(m) * k * sizeof(int)));
+        }
+        for (const string &variant : variants) {
+            for (const int num_threads : thread_counts) {
+                // serial has no processes or threads to sweep - it runs once, at the first thread count
+                if (variant == "serial" && num_threads != thread_counts.front()) {
+                    continue;
+                }
+                BenchmarkResult result;
+                result.variant = variant;
+                result.type = "int32";
+                result.m = m;
+                result.k = k;
+                result.n = n;
+                result.processes = variant == "serial" ? 1 : numtasks;
+                result.threads = variant == "serial" ? 1 : num_threads;
+                result.repeat = repeat;
+
+                vector<double> samples;
+                if (variant == "serial") {
+                    samples = timeSerial(m, k, n, rank, seed, warmup, repeat, verify_rounds, result.verified);
+                } else if (variant == "rows" || variant == "rows-shared") {
+                    samples = timeRows(m, k, n, rank, numtasks, num_threads, variant == "rows-shared", seed, warmup, repeat,
+                                       verify_rounds, result.verified);
+                } else if (variant == "summa") {
+                    samples = timeSumma(m, k, n, num_threads, seed, warmup, repeat, verify_rounds, result.verified);
+                } else {
+                    samples = timePipelined(m, k, n, rank, num_threads, chunk_width, seed, warmup, repeat, verify_rounds, result.verified);
+                }
+
+                // Only the master's samples are the reduced ones
+                if (rank == 0) {
+                    result.stats = benchmarkStats(samples);
+                    result.gops = benchmarkGops(m, k, n, result.stats.median_us);
+                    cerr << benchmarkLine(result) << endl;
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+
+    // The master writes the report
+    bool ok = true;
+    if (rank == 0) {
+        addEfficiency(results, "serial");
+        char name[MPI_MAX_PROCESSOR_NAME];
+        int name_len;
+        MPI_Get_processor_name(name, &name_len);
+        vector<pair<string, string>> context = {{"benchmark", "matrix_mpi"}, {"host", name}, {"seed", to_string(seed)},
+                                                {"warmup", to_string(warmup)}, {"processes", to_string(numtasks)},
+                                                {"kernel_int32", microKernelName(micro_kernel)},
+                                                {"huge_pages", hugePageModeName(hugePageMode())}, {"huge_page_size", byteSize(hugePageSize())}};
+        context.insert(context.end(), pages.begin(), pages.end());
+        try {
+            writeBenchmarkReport(format, output, context, results);
+        }
+        catch (const exception &e) {
+            cerr << e.what() << endl;
+            ok = false;
+        }
+        // A failed check fails the run, so a regression job can't miss it
+        ok = ok && none_of(results.begin(), results.end(), [](const BenchmarkResult &result) { return result.verified == "failed"; });
+    }
+    MPI_Bcast(&ok, 1, MPI_CXX_BOOL, 0, MPI_COMM_WORLD);
+
+    MPI_Finalize();
+    return ok ? 0 : 1;
+}
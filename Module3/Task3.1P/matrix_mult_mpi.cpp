@@ -3,30 +3,171 @@
 #include <cstdlib>
 #include <time.h>
 #include <chrono>
+#include <vector>
+#include "../../common/gemm.h"
+#include "../../common/cli.h"
+#include "../../common/partition.h"
+#include "../../common/random.h"
+#include "../../common/freivalds_mpi.h"
+#include "../../common/matrix_file_mpi.h"
+#include "../../common/summa.h"
+#include "../../common/mpi_pipeline.h"
+#include "../../common/perf_counters_mpi.h"
 
 using namespace std::chrono;
 using namespace std;
 
-// Size of matrix, size * size
-const int size = 1024; 
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 1024;
 
-// Fill matrix with random values
-void fillMatrix(int* matrix) {
-    for (int i = 0; i < size * size; ++i) {  
-        matrix[i] = rand() % 100;   
-    }
+// Fill rows block_rows and columns block_cols of a matrix with cols columns with random values from 0 to 99
+// block holds just those elements - values depend only on the seed and position, so every decomposition gives the same matrix
+void fillMatrix(int* block, const int cols, const Range &block_rows, const Range &block_cols, const CounterRng &rng) {
+    fillRandomBlock(block, cols, block_rows, block_cols, rng, 0, 99);
 }
 
 // Function to output matrix - used in testing
-void printMatrix(const int* matrix) {
-    for (int i = 0; i < size; ++i) {
-        for (int j = 0; j < size; ++j) {
-            cout << matrix[i * size + j] << "\t";
+void printMatrix(const int* matrix, const int rows, const int cols) {
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            cout << matrix[i * cols + j] << "\t";
         }
         cout << endl;
     }
 }
 
+// Freivalds check of the distributed product, outside the timed section - each process passes the blocks it holds
+// Returns whether it passed, on every process - the master prints the outcome
+bool verifyProduct(const int m, const int k, const int n, const MatrixBlock<int> &a, const MatrixBlock<int> &b,
+                   const MatrixBlock<int> &c, const int rounds, const uint64_t seed, const int rank) {
+    if (rounds <= 0) {
+        return true;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = high_resolution_clock::now();
+    const FreivaldsResult result = mpiFreivaldsVerify(MPI_COMM_WORLD, m, k, n, a, b, c, rounds, seed);
+    auto stop = high_resolution_clock::now();
+    if (rank == 0) {
+        cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+            << duration_cast<microseconds>(stop - start).count() << " microseconds" << endl;
+    }
+    return result.passed();
+}
+
+// SUMMA path - ranks form a 2D grid and each holds only its own blocks of A, B and C
+// Blocks are generated locally or read from the --a/--b files, so no process ever needs a full matrix
+bool runSumma(const int m, const int k, const int n, const int rank, const MatrixFiles &files,
+              const uint64_t seed, const int verify_rounds) {
+    ProcessGrid grid = createProcessGrid(MPI_COMM_WORLD);
+    const BlockRange a_block = localBlock(grid, m, k);
+    const BlockRange b_block = localBlock(grid, k, n);
+
+    // Local blocks of A (rows x k-cols), B (k-rows x cols) and C (rows x cols)
+    vector<int> local_A(a_block.rows.size() * a_block.cols.size());
+    vector<int> local_B(b_block.rows.size() * b_block.cols.size());
+    vector<int> local_C(a_block.rows.size() * b_block.cols.size());
+
+    // Each process reads its own blocks from the files, or generates them where they sit in the full matrices
+    if (!files.a.empty()) {
+        mpiReadMatrixBlock(files.a, MPI_COMM_WORLD, a_block.rows, a_block.cols, local_A.data());
+    } else {
+        fillMatrix(local_A.data(), k, a_block.rows, a_block.cols, CounterRng(seed, matrix_a_stream));
+    }
+    if (!files.b.empty()) {
+        mpiReadMatrixBlock(files.b, MPI_COMM_WORLD, b_block.rows, b_block.cols, local_B.data());
+    } else {
+        fillMatrix(local_B.data(), n, b_block.rows, b_block.cols, CounterRng(seed, matrix_b_stream));
+    }
+
+    // Timer covers the panel broadcasts and the local multiplies
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = high_resolution_clock::now();
+    {
+        PerfRegion region("summa");  // Panel broadcasts and local multiplies together, on the calling thread
+        summaMultiply(grid, m, k, n, local_A.data(), local_B.data(), local_C.data());
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        auto stop = high_resolution_clock::now();
+        auto duration = duration_cast<microseconds>(stop - start);
+        cout << "Time taken by function (SUMMA, " << grid.rows << "x" << grid.cols << " grid): "
+            << duration.count() << " microseconds" << endl;
+        cout << "Micro-kernel: " << microKernelName(micro_kernel) << endl;
+    }
+
+    // Each process writes its own block of C, outside the timed region like the fill
+    if (!files.c.empty()) {
+        mpiWriteMatrixBlock(files.c, MPI_COMM_WORLD, m, n, a_block.rows, b_block.cols, local_C.data());
+    }
+
+    // Each process checks its own blocks
+    const bool verified = verifyProduct(m, k, n, MatrixBlock<int>{local_A.data(), a_block.rows, a_block.cols},
+                                        MatrixBlock<int>{local_B.data(), b_block.rows, b_block.cols},
+                                        MatrixBlock<int>{local_C.data(), a_block.rows, b_block.cols}, verify_rounds, seed, rank);
+
+    freeProcessGrid(grid);
+    return verified;
+}
+
+// Pipelined path - rows of A are scattered and B broadcast chunk by chunk along k with non-blocking
+// collectives, so the multiply of one chunk overlaps the transfer of the next
+bool runPipelined(const int m, const int k, const int n, const int rank, const int chunk_width, const MatrixFiles &files,
+                  const uint64_t seed, const int verify_rounds) {
+    // Only the master process holds full matrices, so it reads any files on its own
+    vector<int> A, B, C;
+    if (rank == 0) {
+        A.resize(m * k);
+        B.resize(k * n);
+        C.resize(m * n);
+        if (!files.a.empty()) {
+            mpiReadMatrixBlock(files.a, MPI_COMM_SELF, Range{0, m}, Range{0, k}, A.data());
+        } else {
+            fillMatrix(A.data(), k, Range{0, m}, Range{0, k}, CounterRng(seed, matrix_a_stream));
+        }
+        if (!files.b.empty()) {
+            mpiReadMatrixBlock(files.b, MPI_COMM_SELF, Range{0, k}, Range{0, n}, B.data());
+        } else {
+            fillMatrix(B.data(), n, Range{0, k}, Range{0, n}, CounterRng(seed, matrix_b_stream));
+        }
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = high_resolution_clock::now();
+    PipelineStats stats;
+    {
+        PerfRegion region("pipelined");  // Chunk transfers and multiplies together, on the calling thread
+        stats = pipelinedRowMultiply(m, k, n, A.data(), B.data(), C.data(), 1, chunk_width, MPI_COMM_WORLD);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto stop = high_resolution_clock::now();
+
+    // Sum the timings over every process to report the overlap achieved across the run
+    double local_times[2] = {stats.transfer_time, stats.exposed_time};
+    double total_times[2] = {0, 0};
+    MPI_Reduce(local_times, total_times, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        PipelineStats total;
+        total.transfer_time = total_times[0];
+        total.exposed_time = total_times[1];
+        auto duration = duration_cast<microseconds>(stop - start);
+        cout << "Time taken by function (pipelined, " << stats.chunks << " chunks): "
+            << duration.count() << " microseconds" << endl;
+        cout << "Communication overlap fraction: " << total.overlapFraction() << endl;
+        cout << "Micro-kernel: " << microKernelName(micro_kernel) << endl;
+
+        if (!files.c.empty()) {
+            mpiWriteMatrixBlock(files.c, MPI_COMM_SELF, m, n, Range{0, m}, Range{0, n}, C.data());
+        }
+    }
+
+    // The master holds all of A, B and C, the other processes pass empty blocks
+    const int held = rank == 0 ? 1 : 0;
+    return verifyProduct(m, k, n, MatrixBlock<int>{A.data(), Range{0, m * held}, Range{0, k}},
+                         MatrixBlock<int>{B.data(), Range{0, k * held}, Range{0, n}},
+                         MatrixBlock<int>{C.data(), Range{0, m * held}, Range{0, n}}, verify_rounds, seed, rank);
+}
 
 int main(int argc, char** argv) {
 
@@ -46,54 +187,130 @@ int main(int argc, char** argv) {
     // Find the processor name
     MPI_Get_processor_name(name, &name_len);
 
-    // Each process will recieve a partition of the matrix rows to calculate
-    int partition_rows = size / numtasks;  // Must be divisible - add a check later 
+    // Matrix dimensions from the command line - C (m x n) = A (m x k) * B (k x n)
+    // Matrices can come from int32 binary matrix files instead (--a, --b), which also set the shape, and C can be saved (--c)
+    const MatrixFiles files{stringOption(argc, argv, "--a", ""), stringOption(argc, argv, "--b", ""), stringOption(argc, argv, "--c", "")};
+    MatrixDims dims;
+    // Freivalds rounds for --verify, and the pipelined column chunk width
+    int verify_rounds, chunk;
+    try {
+        dims = dimsFromFiles(dimsOption(argc, argv, default_size), files);
+        checkMatrixFileTypes<int>(files);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+        chunk = intOptionAtLeast(argc, argv, "--chunk", pipeline_chunk_width, 1);
+    }
+    catch (const exception &e) {  // Every process parses the same options and reads the same headers, so every process stops here
+        if (rank == 0) cerr << e.what() << endl;
+        MPI_Finalize();
+        return 1;
+    }
+    const int m = dims.m, k = dims.k, n = dims.n;
+
+    // Random inputs are reproducible from --seed - every process uses the master's seed
+    uint64_t seed = seedOption(argc, argv);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (rank == 0 && (files.a.empty() || files.b.empty())) {
+        cout << "Seed: " << seed << endl;
+    }
+    // --verify checks the product with verify_rounds Freivalds rounds - a wrong product passes with probability 2^-rounds
+    // --perf counts cycles, instructions and cache and TLB misses of each step and prints every process's counts at the end
+    perfEnable(flagOption(argc, argv, "--perf"));
+
+    // --algorithm summa runs the 2D block decomposition, pipelined overlaps chunked transfers with compute
+    // and the default rows scatters A and broadcasts B
+    const string algorithm = stringOption(argc, argv, "--algorithm", "rows");
+    if (algorithm == "pipelined") {
+        const bool verified = runPipelined(m, k, n, rank, chunk, files, seed, verify_rounds);
+        mpiPrintPerfReport(MPI_COMM_WORLD);
+        MPI_Finalize();
+        return verified ? 0 : 1;
+    }
+    if (algorithm == "summa") {
+        const bool verified = runSumma(m, k, n, rank, files, seed, verify_rounds);
+        mpiPrintPerfReport(MPI_COMM_WORLD);
+        MPI_Finalize();
+        return verified ? 0 : 1;
+    }
+
+    // Each process will recieve a balanced partition of the matrix rows to calculate
+    // Remainder rows go one each to the first m % numtasks processes, so no rows are dropped
+    vector<int> counts_A, displs_A, counts_C, displs_C;
+    balancedCounts(m, numtasks, k, counts_A, displs_A);
+    balancedCounts(m, numtasks, n, counts_C, displs_C);
+    int partition_rows = balancedRange(m, numtasks, rank).size();
 
     // Store matrices as contiguous blocks, easier for working with MPI
     int* A = nullptr;
-    int* B = new int[size * size]; // Matrix B used by all processes
+    int* B = new int[k * n]; // Matrix B used by all processes
     int* C = nullptr;
 
     // Master process onlyn rank == 0
     if (rank == 0) {
-        // Seed random number generator
-        srand(time(0));
-
         // Only master process requires full matrices A and C
-        A = new int[size * size];
-        C = new int[size * size];
+        A = files.a.empty() ? new int[m * k] : nullptr;  // Not needed when each process reads its own rows
+        C = files.c.empty() ? new int[m * n] : nullptr;  // Not needed when each process writes its own rows
 
-        // Fill matrices A and B with random values
-        fillMatrix(A);
-        fillMatrix(B);        
+        // Fill matrices A and B with random values, unless they come from files
+        if (files.a.empty()) {
+            fillMatrix(A, k, Range{0, m}, Range{0, k}, CounterRng(seed, matrix_a_stream));
+        }
+        if (files.b.empty()) {
+            fillMatrix(B, n, Range{0, k}, Range{0, n}, CounterRng(seed, matrix_b_stream));
+        }
     }
 
     // Rows A and C that are required for each process
-    int* process_A = new int[partition_rows * size];
-    int* process_C = new int[partition_rows * size];
+    int* process_A = new int[partition_rows * k];
+    int* process_C = new int[partition_rows * n];
 
     // Start timer - happens in all processes, but timer only stopped and calculated by master process
     auto start = high_resolution_clock::now();
 
-    // Scatter partitions of matrix A among processes
-    MPI_Scatter(A, partition_rows * size, MPI_INT, process_A, partition_rows * size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Scatter partitions of matrix A among processes - partitions may differ by one row
+    // With --a each process reads its own rows from the file instead, so A never passes through the master
+    const Range process_rows = balancedRange(m, numtasks, rank);
+    {
+        PerfRegion region("scatter");
+        if (!files.a.empty()) {
+            mpiReadMatrixBlock(files.a, MPI_COMM_WORLD, process_rows, Range{0, k}, process_A);
+        } else {
+            MPI_Scatterv(A, counts_A.data(), displs_A.data(), MPI_INT, process_A, partition_rows * k, MPI_INT, 0, MPI_COMM_WORLD);
+        }
+    }
 
     // Broadcast matrix B to all processes - https://docs.open-mpi.org/en/v5.0.x/man-openmpi/man3/MPI_Bcast.3.html
-    MPI_Bcast(B, size * size, MPI_INT, 0, MPI_COMM_WORLD);
+    // With --b every process reads the whole of B from the file instead
+    {
+        PerfRegion region("bcast");
+        if (!files.b.empty()) {
+            mpiReadMatrixBlock(files.b, MPI_COMM_WORLD, Range{0, k}, Range{0, n}, B);
+        } else {
+            MPI_Bcast(B, k * n, MPI_INT, 0, MPI_COMM_WORLD);
+        }
+    }
+
+    // Pack B into micro-panels once - reused across the whole partition
+    PackedB packed_B;
+    {
+        PerfRegion region("pack");
+        packed_B = packB(B, n, k, n, 1);  // One thread per process
+    }
 
     // Matrix multiplication on partition
-    for (int i = 0; i < partition_rows; ++i) {
-        for (int j = 0; j < size; j++) {
-            int result = 0;
-            for (int k = 0; k < size; ++k) {
-                result += process_A[i * size + k] * B[k * size + j];
-            }
-            process_C[i * size + j] = result;
-        }
+    {
+        PerfRegion region("multiply");
+        gemmPacked(partition_rows, process_A, k, packed_B, process_C, n);
     }
 
-    // Gather results into matrix C
-    MPI_Gather(process_C, partition_rows * size, MPI_INT, C, partition_rows * size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Gather results into matrix C - or with --c each process writes its own rows of C to the file
+    {
+        PerfRegion region("gather");
+        if (!files.c.empty()) {
+            mpiWriteMatrixBlock(files.c, MPI_COMM_WORLD, m, n, process_rows, Range{0, n}, process_C);
+        } else {
+            MPI_Gatherv(process_C, partition_rows * n, MPI_INT, C, counts_C.data(), displs_C.data(), MPI_INT, 0, MPI_COMM_WORLD);
+        }
+    }
 
     // Barrier to ensure all processes have finished
     MPI_Barrier(MPI_COMM_WORLD);
@@ -107,32 +324,40 @@ int main(int argc, char** argv) {
         auto duration = duration_cast<microseconds>(stop - start);
         cout << "Time taken by function: "
             << duration.count() << " microseconds" << endl;
+        cout << "Micro-kernel: " << microKernelName(micro_kernel) << endl;
 
         // Test print matrices
         // cout << "Matrix A:" << endl;
-        // printMatrix(A);
+        // printMatrix(A, m, k);
         // cout << endl;
 
         // cout << "Matrix B:" << endl;
-        // printMatrix(B);
+        // printMatrix(B, k, n);
         // cout << endl;
 
         // cout << "Matrix C (Result):" << endl;
-        // printMatrix(C);
+        // printMatrix(C, m, n);
         // cout << endl;
     }
 
+    // Every process holds B, so each checks a share of its rows
+    const Range b_share = balancedRange(k, numtasks, rank);
+    const bool verified = verifyProduct(m, k, n, MatrixBlock<int>{process_A, process_rows, Range{0, k}},
+                                        MatrixBlock<int>{B + static_cast<size_t>(b_share.start) * n, b_share, Range{0, n}},
+                                        MatrixBlock<int>{process_C, process_rows, Range{0, n}}, verify_rounds, seed, rank);
+
     // Clean up section
     delete[] process_A;
     delete[] process_C;
     delete[] B;
 
-    // Clean up master
+    // Clean up master - A and C stay null when their rows go through files
     if (rank == 0) {
         delete[] A;
         delete[] C;
     }
 
+    mpiPrintPerfReport(MPI_COMM_WORLD);
     MPI_Finalize();
-    return 0;
+    return verified ? 0 : 1;
 }
\ No newline at end of file
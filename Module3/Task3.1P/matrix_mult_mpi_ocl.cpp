@@ -3,44 +3,115 @@
 #include <cstdlib>
 #include <time.h>
 #include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
 #include <CL/cl.h>
+#include "../../common/cli.h"
+#include "../../common/gemm.h"
+#include "../../common/partition.h"
+#include "../../common/random.h"
+#include "../../common/freivalds_mpi.h"
+#include "../../common/matrix_file_mpi.h"
+#include "../../common/ocl_runtime.h"
 
 using namespace std::chrono;
 using namespace std;
 
-// Size of matrix, size * size
-const int size = 1024; 
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 1024;
+
+// Default number of OMP threads per process for --hybrid when --threads is not given
+constexpr int default_threads = 2;
 
 // Variables for OpenCL
+OclRuntime *ocl = nullptr; // Device, context, queue and compiled kernels - kept for the whole run
 cl_mem bufA, bufB, bufC; // Shared memory buffers
-cl_device_id device_id; // ID of the device to use for computation
-cl_context context; // Context where kernel executes
-cl_program program; // Executable code for kernels - the .cl file
-cl_kernel kernel; // OpenCL kernel
-cl_command_queue queue; // Queue that holds device commands
+cl_kernel kernel; // OpenCL kernel - owned by the runtime
 cl_event event = NULL;
 int err;
 
+// Zero-copy mode - buffers wrap the MPI receive buffers with CL_MEM_USE_HOST_PTR and results are mapped, not read
+bool zero_copy = false;
+long long bytes_copied = 0; // Bytes moved by explicit host <-> device copies on this process
+
+// Kernel configuration - tile 0 selects the naive matrix_mult kernel, otherwise matrix_mult_tiled built with -DTS=tile -DWPT=wpt
+struct KernelConfig {
+    int tile;
+    int wpt;
+};
+
+// Tuning results are cached per device, driver and kernel source so the search only runs once
+const char *tuning_cache_file = "ocl_tuning_cache.txt";
+
+// Rows of A used while tuning - enough to fill the device without timing the whole partition
+constexpr int tuning_rows = 256;
+
+// Weight of the newest throughput measurement when updating the hybrid split
+constexpr double hybrid_smoothing = 0.5;
+
+// Split of a process's rows between the OpenCL device and the OMP threads for --hybrid
+// Both sides' throughput (rows per second) is measured on every multiply and smoothed, and the
+// device share follows the ratio of the two so both sides finish at about the same time
+struct HybridSplit {
+    double device_share = 0.5; // Even split for the first multiply, which calibrates both rates
+    double device_rate = 0;
+    double host_rate = 0;
+
+    // With two rows or more each side keeps at least one, so neither rate goes stale and the split can swing back
+    int deviceRows(int partition_rows) const {
+        const int rows = (int)lround(device_share * partition_rows);
+        if (partition_rows < 2) return min(partition_rows, rows);
+        return clamp(rows, 1, partition_rows - 1);
+    }
+
+    // A side that got no rows (a partition of one row) keeps its previous rate
+    void update(int device_rows, double device_seconds, int host_rows, double host_seconds) {
+        if (device_rows > 0 && device_seconds > 0) device_rate = smooth(device_rate, device_rows / device_seconds);
+        if (host_rows > 0 && host_seconds > 0) host_rate = smooth(host_rate, host_rows / host_seconds);
+        if (device_rate > 0 && host_rate > 0) device_share = device_rate / (device_rate + host_rate);
+    }
+
+    static double smooth(double rate, double measured) {
+        return rate == 0 ? measured : (1 - hybrid_smoothing) * rate + hybrid_smoothing * measured;
+    }
+};
+
 // OpenCL function prototypes
-cl_device_id create_device();
-void setup_openCL_device_context_queue_kernel(char *filename, char *kernelname);
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename);
-void setup_kernel_memory(int *process_A, int *B, int partition_rows);
-void copy_kernel_args(int partition_rows);
+void create_kernel(const char *filename, const KernelConfig &config);
+void setup_kernel_memory(int *process_A, int *B, int *process_C, int partition_rows, int k, int n);
+void read_results(int *process_C, int partition_rows, int n);
+void copy_kernel_args(int partition_rows, int k, int n);
+void enqueue_kernel(const KernelConfig &config, int partition_rows, int n);
+void run_kernel(const KernelConfig &config, int partition_rows, int n);
+KernelConfig select_kernel(const string &kernel_choice, bool retune, int *process_A, int *B, int *process_C, int partition_rows, int k, int n);
+void run_hybrid(const KernelConfig &config, HybridSplit &split, PackedB &packed_B, int *process_A, int *B, int *process_C, int partition_rows, int k, int n, int num_threads);
+KernelConfig tune_kernel(const char *filename, int partition_rows, int k, int n);
+bool load_tuning(const string &key, KernelConfig &config);
+void save_tuning(const string &key, const KernelConfig &config);
 void free_memory();
 
-// Fill matrix with random values
-void fillMatrix(int* matrix) {
-    for (int i = 0; i < size * size; ++i) {  
-        matrix[i] = rand() % 100;   
-    }
+// Name of the kernel for a configuration, used in output
+string kernelName(const KernelConfig &config) {
+    if (config.tile == 0) return "matrix_mult";
+    return "matrix_mult_tiled (TS=" + to_string(config.tile) + ", WPT=" + to_string(config.wpt) + ")";
+}
+
+// Fill rows block_rows and columns block_cols of a matrix with cols columns with random values from 0 to 99
+// block holds just those elements - values depend only on the seed and position, so every decomposition gives the same matrix
+void fillMatrix(int* block, const int cols, const Range &block_rows, const Range &block_cols, const CounterRng &rng) {
+    fillRandomBlock(block, cols, block_rows, block_cols, rng, 0, 99);
 }
 
 // Function to output matrix - used in testing
-void printMatrix(const int* matrix) {
-    for (int i = 0; i < size; ++i) {
-        for (int j = 0; j < size; ++j) {
-            cout << matrix[i * size + j] << "\t";
+void printMatrix(const int* matrix, const int rows, const int cols) {
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            cout << matrix[i * cols + j] << "\t";
         }
         cout << endl;
     }
@@ -56,66 +127,150 @@ int main(int argc, char** argv) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank); // Get the rank
     MPI_Get_processor_name(name, &name_len); // Find the processor name
 
-    // Each process will recieve a partition of the matrix rows to calculate
-    int partition_rows = size / numtasks;  // Must be divisible
+    // Matrix dimensions from the command line - C (m x n) = A (m x k) * B (k x n)
+    // Matrices can come from int32 binary matrix files instead (--a, --b), which also set the shape, and C can be saved (--c)
+    const MatrixFiles files{stringOption(argc, argv, "--a", ""), stringOption(argc, argv, "--b", ""), stringOption(argc, argv, "--c", "")};
+    MatrixDims dims;
+    // Freivalds rounds for --verify, OMP threads for --hybrid, and multiplies to average over
+    int verify_rounds, num_threads, repeat;
+    try {
+        dims = dimsFromFiles(dimsOption(argc, argv, default_size), files);
+        checkMatrixFileTypes<int>(files);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+        num_threads = threadsOption(argc, argv, default_threads);
+        repeat = intOptionAtLeast(argc, argv, "--repeat", 1, 1);
+    }
+    catch (const exception &e) {  // Every process parses the same options and reads the same headers, so every process stops here
+        if (rank == 0) cerr << e.what() << endl;
+        MPI_Finalize();
+        return 1;
+    }
+    const int m = dims.m, k = dims.k, n = dims.n;
+
+    // Random inputs are reproducible from --seed - every process uses the master's seed
+    uint64_t seed = seedOption(argc, argv);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (rank == 0 && (files.a.empty() || files.b.empty())) {
+        cout << "Seed: " << seed << endl;
+    }
+    // --verify checks the product with verify_rounds Freivalds rounds - a wrong product passes with probability 2^-rounds
+
+    // Kernel selection - the tiled kernel is tuned per device on first use, --retune forces a new search
+    const string kernel_choice = stringOption(argc, argv, "--kernel", "tiled");
+    const bool retune = flagOption(argc, argv, "--retune");
+    zero_copy = flagOption(argc, argv, "--zero-copy");
+
+    // Hybrid mode - OMP threads take a share of each process's rows while the device runs
+    const bool hybrid = flagOption(argc, argv, "--hybrid");
+
+    // Repeated multiplies - the time printed is the average per multiply, and the hybrid split adapts between them
+    if (kernel_choice != "naive" && kernel_choice != "tiled") {
+        if (rank == 0) cerr << "Unknown kernel: " << kernel_choice << " (expected naive or tiled)" << endl;
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Each process will recieve a balanced partition of the matrix rows to calculate
+    // Remainder rows go one each to the first m % numtasks processes, so no rows are dropped
+    vector<int> counts_A, displs_A, counts_C, displs_C;
+    balancedCounts(m, numtasks, k, counts_A, displs_A);
+    balancedCounts(m, numtasks, n, counts_C, displs_C);
+    int partition_rows = balancedRange(m, numtasks, rank).size();
 
     // Store matrices as contiguous blocks, easier for working with MPI
     int* A = nullptr;
-    int* B = new int[size * size]; // Matrix B used by all processes
+    int* B = allocHostBuffer(k * n); // Matrix B used by all processes - page aligned so OpenCL can use it in place
     int* C = nullptr;
 
     // Master process onlyn rank == 0
     if (rank == 0) {
-        // Seed random number generator
-        srand(time(0));
-
         // Only master process requires full matrices A and C
-        A = new int[size * size];
-        C = new int[size * size];
+        A = files.a.empty() ? new int[m * k] : nullptr;  // Not needed when each process reads its own rows
+        C = files.c.empty() ? new int[m * n] : nullptr;  // Not needed when each process writes its own rows
 
-        // Fill matrices A and B with random values
-        fillMatrix(A);
-        fillMatrix(B);        
+        // Fill matrices A and B with random values, unless they come from files
+        if (files.a.empty()) {
+            fillMatrix(A, k, Range{0, m}, Range{0, k}, CounterRng(seed, matrix_a_stream));
+        }
+        if (files.b.empty()) {
+            fillMatrix(B, n, Range{0, k}, Range{0, n}, CounterRng(seed, matrix_b_stream));
+        }
     }
 
-    // Rows A and C that are required for each process
-    int* process_A = new int[partition_rows * size];
-    int* process_C = new int[partition_rows * size];
+    // Rows A and C that are required for each process - page aligned, and at least one row to match the device buffers
+    const int buffer_rows = partition_rows > 0 ? partition_rows : 1;
+    int* process_A = allocHostBuffer(buffer_rows * k);
+    int* process_C = allocHostBuffer(buffer_rows * n);
 
     // Start timer - happens in all processes, but timer only stopped and calculated by master process
     auto start = high_resolution_clock::now();
 
-    // Scatter partitions of matrix A among processes
-    MPI_Scatter(A, partition_rows * size, MPI_INT, process_A, partition_rows * size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Init OpenCL - programs come from the on-disk binary cache when this device has built them before
+    // Kernel timestamps are only needed to calibrate the hybrid split
+    ocl = new OclRuntime(hybrid);
+
+    KernelConfig config = {0, 1};
+    HybridSplit split;
+    PackedB packed_B; // B packed for the OMP kernel in hybrid mode
+
+    const Range process_rows = balancedRange(m, numtasks, rank);
+    for (int iteration = 0; iteration < repeat; ++iteration) {
+        // Scatter partitions of matrix A among processes - partitions may differ by one row
+        // With --a each process reads its own rows from the file instead, so A never passes through the master
+        if (!files.a.empty()) {
+            mpiReadMatrixBlock(files.a, MPI_COMM_WORLD, process_rows, Range{0, k}, process_A);
+        } else {
+            MPI_Scatterv(A, counts_A.data(), displs_A.data(), MPI_INT, process_A, partition_rows * k, MPI_INT, 0, MPI_COMM_WORLD);
+        }
 
-    // Broadcast matrix B to all processes - https://docs.open-mpi.org/en/v5.0.x/man-openmpi/man3/MPI_Bcast.3.html
-    MPI_Bcast(B, size * size, MPI_INT, 0, MPI_COMM_WORLD);
+        // Broadcast matrix B to all processes - https://docs.open-mpi.org/en/v5.0.x/man-openmpi/man3/MPI_Bcast.3.html
+        // With --b every process reads the whole of B from the file instead
+        if (!files.b.empty()) {
+            mpiReadMatrixBlock(files.b, MPI_COMM_WORLD, Range{0, k}, Range{0, n}, B);
+        } else {
+            MPI_Bcast(B, k * n, MPI_INT, 0, MPI_COMM_WORLD);
+        }
 
-    // OpenCL section - happens on all nodes and head
+        // OpenCL section - happens on all nodes and head
 
-    // Init OpenCL
-    setup_openCL_device_context_queue_kernel((char *)"./matrix_ops.cl", (char *)"matrix_mult");
+        // Pick the kernel configuration on the first multiply - the cached result for this device, or tune it now
+        if (iteration == 0) {
+            config = select_kernel(kernel_choice, retune, process_A, B, process_C, partition_rows, k, n);
+        }
 
-    // Kernel memory
-    setup_kernel_memory(process_A, B, partition_rows);
+        if (hybrid) {
+            // Device and OMP threads share the rows
+            run_hybrid(config, split, packed_B, process_A, B, process_C, partition_rows, k, n, num_threads);
+        }
+        else {
+            // Kernel memory
+            setup_kernel_memory(process_A, B, process_C, partition_rows, k, n);
 
-    // Kernel arguments
-    copy_kernel_args(partition_rows);
+            // Kernel arguments
+            copy_kernel_args(partition_rows, k, n);
 
-    // Enqueue kernel execution and read back results
-    size_t global[2] = {(size_t)partition_rows, (size_t)size};
+            // Enqueue a command for the kernel of a device - skipped when this process has no rows (more processes than rows)
+            if (partition_rows > 0) {
+                run_kernel(config, partition_rows, n);
 
-    // Enqueue a command for the kernel of a device
-    clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, NULL, 0, NULL, &event);
-    clWaitForEvents(1, &event);
+                // Bring process_C up to date on the host
+                read_results(process_C, partition_rows, n);
+            }
 
-    // Enqueue to read process_C to host
-    clEnqueueReadBuffer(queue, bufC, CL_TRUE, 0, partition_rows * size * sizeof(int), process_C, 0, NULL, NULL);
+            free_memory();
+        }
 
-    free_memory();
+        // Gather results into matrix C - or with --c each process writes its own rows of C to the file
+        if (!files.c.empty()) {
+            mpiWriteMatrixBlock(files.c, MPI_COMM_WORLD, m, n, process_rows, Range{0, n}, process_C);
+        } else {
+            MPI_Gatherv(process_C, partition_rows * n, MPI_INT, C, counts_C.data(), displs_C.data(), MPI_INT, 0, MPI_COMM_WORLD);
+        }
+    }
 
-    // Gather results into matrix C
-    MPI_Gather(process_C, partition_rows * size, MPI_INT, C, partition_rows * size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Total bytes copied between host and device over all processes
+    long long total_bytes_copied = 0;
+    MPI_Reduce(&bytes_copied, &total_bytes_copied, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
     // Barrier to ensure all processes have finished
     MPI_Barrier(MPI_COMM_WORLD);
@@ -125,38 +280,66 @@ int main(int argc, char** argv) {
         // Stop timer
         auto stop = high_resolution_clock::now();
 
-        // Output duration
+        // Output duration - average per multiply when repeated
         auto duration = duration_cast<microseconds>(stop - start);
         cout << "Time taken by function: "
-            << duration.count() << " microseconds" << endl;
+            << duration.count() / repeat << " microseconds" << endl;
+        cout << "Kernel (rank 0): " << kernelName(config) << endl;
+        if (hybrid) {
+            cout << "Hybrid split (rank 0): " << lround(split.device_share * 100) << "% of rows on the device, "
+                << lround(split.device_rate) << " rows/s device, " << lround(split.host_rate) << " rows/s host ("
+                << num_threads << " threads)" << endl;
+        }
+        cout << "OpenCL program setup (rank 0): " << ocl->buildMicroseconds() << " microseconds, "
+            << ocl->cacheHits() << " cached, " << ocl->cacheMisses() << " compiled" << endl;
+        cout << "Bytes copied host <-> device (" << (zero_copy ? "zero-copy" : "copy") << " mode, all processes): "
+            << total_bytes_copied << endl;
 
         // Test print matrices
         // cout << "Matrix A:" << endl;
-        // printMatrix(A);
+        // printMatrix(A, m, k);
         // cout << endl;
 
         // cout << "Matrix B:" << endl;
-        // printMatrix(B);
+        // printMatrix(B, k, n);
         // cout << endl;
 
         // cout << "Matrix C (Result):" << endl;
-        // printMatrix(C);
+        // printMatrix(C, m, n);
         // cout << endl;
     }
 
+    // Freivalds check of the last product, outside the timed section - each process passes its rows of A and C
+    // and a share of the rows of B, which every process holds
+    bool verified = true;
+    if (verify_rounds > 0) {
+        const Range b_share = balancedRange(k, numtasks, rank);
+        auto verify_start = high_resolution_clock::now();
+        const FreivaldsResult result = mpiFreivaldsVerify(MPI_COMM_WORLD, m, k, n, MatrixBlock<int>{process_A, process_rows, Range{0, k}},
+                                                          MatrixBlock<int>{B + static_cast<size_t>(b_share.start) * n, b_share, Range{0, n}},
+                                                          MatrixBlock<int>{process_C, process_rows, Range{0, n}}, verify_rounds, seed, num_threads);
+        auto verify_stop = high_resolution_clock::now();
+        verified = result.passed();
+        if (rank == 0) {
+            cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+                << duration_cast<microseconds>(verify_stop - verify_start).count() << " microseconds" << endl;
+        }
+    }
+
     // Clean up section
-    delete[] process_A;
-    delete[] process_C;
-    delete[] B;
+    free(process_A);
+    free(process_C);
+    free(B);
+    delete ocl;
 
-    // Clean up master
+    // Clean up master - A and C stay null when their rows go through files
     if (rank == 0) {
         delete[] A;
         delete[] C;
     }
 
     MPI_Finalize();
-    return 0;
+    return verified ? 0 : 1;
 }
 
 // Functions for OpenCL
@@ -167,21 +350,18 @@ void free_memory()
     clReleaseMemObject(bufB);
     clReleaseMemObject(bufC);
 
-    //free opencl objects
-    clReleaseKernel(kernel);
-    clReleaseCommandQueue(queue);
-    clReleaseProgram(program);
-    clReleaseContext(context);
+    // The context, queue and kernels belong to the runtime and are kept for reuse
 }
 
-void copy_kernel_args(int partition_rows)
+void copy_kernel_args(int partition_rows, int k, int n)
 {
     // Set argument values for the kernel - arguments: kernel, arg index, arg size, arg value
-    clSetKernelArg(kernel, 0, sizeof(int), (void *)&size);
-    clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&bufA);
-    clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&bufB);
-    clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&bufC);
-    clSetKernelArg(kernel, 4, sizeof(int), (void *)&partition_rows); // Added partition_rows argument
+    clSetKernelArg(kernel, 0, sizeof(int), (void *)&k);
+    clSetKernelArg(kernel, 1, sizeof(int), (void *)&n);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&bufA);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&bufB);
+    clSetKernelArg(kernel, 4, sizeof(cl_mem), (void *)&bufC);
+    clSetKernelArg(kernel, 5, sizeof(int), (void *)&partition_rows); // Added partition_rows argument
 
     if (err < 0)
     {
@@ -191,154 +371,322 @@ void copy_kernel_args(int partition_rows)
     }
 }
 
-void setup_kernel_memory(int *process_A, int *B, int partition_rows)
+void setup_kernel_memory(int *process_A, int *B, int *process_C, int partition_rows, int k, int n)
 {
     // Create buffer - arguments: context, flags, size, host pointer, error
     // cl_mem_flags: specify allocation and usage information about object being created, see flags here - https://registry.khronos.org/OpenCL/sdk/3.0/docs/man/html/cl_mem_flags.html
-    bufA = clCreateBuffer(context, CL_MEM_READ_ONLY, partition_rows * size * sizeof(int), NULL, NULL); // Output buffer
-    bufB = clCreateBuffer(context, CL_MEM_READ_ONLY, size * size * sizeof(int), NULL, NULL); // Output buffer
-    bufC = clCreateBuffer(context, CL_MEM_WRITE_ONLY, partition_rows * size * sizeof(int), NULL, NULL); // Input buffer
+    // Buffers are created with at least one row so a process with no rows still gets valid objects
+    const int buffer_rows = partition_rows > 0 ? partition_rows : 1;
+
+    if (zero_copy) {
+        // The kernel works on the MPI receive buffers in place - CPU and integrated devices skip the copies entirely
+        bufA = clCreateBuffer(ocl->context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, buffer_rows * k * sizeof(int), process_A, NULL);
+        bufB = clCreateBuffer(ocl->context(), CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, k * n * sizeof(int), B, NULL);
+        bufC = clCreateBuffer(ocl->context(), CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, buffer_rows * n * sizeof(int), process_C, NULL);
+        return;
+    }
+
+    bufA = clCreateBuffer(ocl->context(), CL_MEM_READ_ONLY, buffer_rows * k * sizeof(int), NULL, NULL); // Output buffer
+    bufB = clCreateBuffer(ocl->context(), CL_MEM_READ_ONLY, k * n * sizeof(int), NULL, NULL); // Output buffer
+    bufC = clCreateBuffer(ocl->context(), CL_MEM_WRITE_ONLY, buffer_rows * n * sizeof(int), NULL, NULL); // Input buffer
 
     // Copy matrices to the GPU
-    clEnqueueWriteBuffer(queue, bufA, CL_TRUE, 0, partition_rows * size * sizeof(int), process_A, 0, NULL, NULL);
-    clEnqueueWriteBuffer(queue, bufB, CL_TRUE, 0, size * size * sizeof(int), B, 0, NULL, NULL);
+    clEnqueueWriteBuffer(ocl->queue(), bufA, CL_TRUE, 0, partition_rows * k * sizeof(int), process_A, 0, NULL, NULL);
+    clEnqueueWriteBuffer(ocl->queue(), bufB, CL_TRUE, 0, k * n * sizeof(int), B, 0, NULL, NULL);
+    bytes_copied += (long long)(partition_rows + n) * k * sizeof(int);
 }
 
-void setup_openCL_device_context_queue_kernel(char *filename, char *kernelname)
+void read_results(int *process_C, int partition_rows, int n)
 {
-    device_id = create_device();
-    cl_int err;
-
-    // Create the OpenCL context - the virtual container to execute kernal program
-    context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create a context");
-        exit(1);
+    const size_t bytes = (size_t)partition_rows * n * sizeof(int);
+
+    if (zero_copy) {
+        // Mapping a CL_MEM_USE_HOST_PTR buffer makes process_C current - the mapped pointer is process_C itself
+        void *mapped = clEnqueueMapBuffer(ocl->queue(), bufC, CL_TRUE, CL_MAP_READ, 0, bytes, 0, NULL, NULL, &err);
+        clEnqueueUnmapMemObject(ocl->queue(), bufC, mapped, 0, NULL, NULL);
+        clFinish(ocl->queue());
+        return;
     }
 
-    program = build_program(context, device_id, filename);
+    // Enqueue to read process_C to host
+    clEnqueueReadBuffer(ocl->queue(), bufC, CL_TRUE, 0, bytes, process_C, 0, NULL, NULL);
+    bytes_copied += bytes;
+}
 
-    // Create the command-queue on the device
-    queue = clCreateCommandQueueWithProperties(context, device_id, 0, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create a command queue");
-        exit(1);
-    };
+void create_kernel(const char *filename, const KernelConfig &config)
+{
+    // The tile sizes are compile time constants in the kernel, passed as build options
+    const string options = config.tile == 0 ? "" : "-DTS=" + to_string(config.tile) + " -DWPT=" + to_string(config.wpt);
+    kernel = ocl->kernel(filename, config.tile == 0 ? "matrix_mult" : "matrix_mult_tiled", options);
+}
 
+void enqueue_kernel(const KernelConfig &config, int partition_rows, int n)
+{
+    if (config.tile == 0) {
+        // One work-item per element of C, work-group size left to the runtime
+        size_t global[2] = {(size_t)partition_rows, (size_t)n};
+        clEnqueueNDRangeKernel(ocl->queue(), kernel, 2, NULL, global, NULL, 0, NULL, &event);
+    }
+    else {
+        // Work-groups of TS x (TS / WPT) - the global size is rounded up to whole tiles, the kernel masks the edges
+        const size_t tile = config.tile;
+        size_t local[2] = {tile, tile / config.wpt};
+        size_t global[2] = {(partition_rows + tile - 1) / tile * tile, (n + tile - 1) / tile * local[1]};
+        clEnqueueNDRangeKernel(ocl->queue(), kernel, 2, NULL, global, local, 0, NULL, &event);
+    }
+}
 
-    kernel = clCreateKernel(program, kernelname, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create a kernel");
-        printf("error =%d", err);
-        exit(1);
-    };
+void run_kernel(const KernelConfig &config, int partition_rows, int n)
+{
+    enqueue_kernel(config, partition_rows, n);
+    clWaitForEvents(1, &event);
+    clReleaseEvent(event);
 }
 
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename)
+KernelConfig select_kernel(const string &kernel_choice, bool retune, int *process_A, int *B, int *process_C, int partition_rows, int k, int n)
 {
-    cl_program program;
-    FILE *program_handle;
-    char *program_buffer, *program_log;
-    size_t program_size, log_size;
-
-    /* Read program file and place content into buffer */
-    program_handle = fopen(filename, "r");
-    if (program_handle == NULL)
-    {
-        perror("Couldn't find the program file");
-        exit(1);
+    KernelConfig config = {0, 1};
+    if (kernel_choice == "tiled") {
+        // Ranks on a node share its device, so one rank per node picks the configuration and the rest take it -
+        // tuning on every rank at once would time the candidates against each other and could pick different ones
+        MPI_Comm node_comm;
+        int node_rank;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        if (node_rank == 0) {
+            // Keyed by device, driver and kernel source, so an edited matrix_ops.cl is tuned again
+            const string key = ocl->deviceKey() + " | " + ocl->sourceHash("./matrix_ops.cl");
+            // Tuning runs on this process's own rows - a node leader with no rows keeps the naive kernel
+            if ((retune || !load_tuning(key, config)) && partition_rows > 0) {
+                setup_kernel_memory(process_A, B, process_C, partition_rows, k, n);
+                config = tune_kernel("./matrix_ops.cl", partition_rows, k, n);
+                save_tuning(key, config);
+                free_memory();
+            }
+        }
+        MPI_Bcast(&config, 2, MPI_INT, 0, node_comm);
+        MPI_Comm_free(&node_comm);
     }
-    fseek(program_handle, 0, SEEK_END);
-    program_size = ftell(program_handle);
-    rewind(program_handle);
-    program_buffer = (char *)malloc(program_size + 1);
-    program_buffer[program_size] = '\0';
-    fread(program_buffer, sizeof(char), program_size, program_handle);
-    fclose(program_handle);
-
-    // Create program object for the context - arguments: context, count, strings, lengths, error code
-    program = clCreateProgramWithSource(ctx, 1,
-                                        (const char **)&program_buffer, &program_size, &err);
-    if (err < 0)
-    {
-        perror("Couldn't create the program");
-        exit(1);
+    create_kernel("./matrix_ops.cl", config);
+    return config;
+}
+
+void run_hybrid(const KernelConfig &config, HybridSplit &split, PackedB &packed_B, int *process_A, int *B, int *process_C, int partition_rows, int k, int n, int num_threads)
+{
+    // The device takes the first device_rows rows, the OMP threads the rest
+    const int device_rows = split.deviceRows(partition_rows);
+    const int host_rows = partition_rows - device_rows;
+
+    // Upload the device rows and start the kernel without waiting for it
+    auto device_start = high_resolution_clock::now();
+    setup_kernel_memory(process_A, B, process_C, device_rows, k, n);
+    if (device_rows > 0) {
+        copy_kernel_args(device_rows, k, n);
+        enqueue_kernel(config, device_rows, n);
+        clFlush(ocl->queue());
     }
-    free(program_buffer);
+    double device_seconds = duration<double>(high_resolution_clock::now() - device_start).count();
 
-    /* Build program 
+    // OMP threads multiply the remaining rows while the kernel runs
+    auto host_start = high_resolution_clock::now();
+    if (host_rows > 0) {
+        repackB(packed_B, B, n, k, n, num_threads);
+        gemmPackedThreads(host_rows, process_A + (size_t)device_rows * k, k, packed_B, process_C + (size_t)device_rows * n, n, num_threads);
+    }
+    const double host_seconds = duration<double>(high_resolution_clock::now() - host_start).count();
+
+    // Wait for the device - its kernel time comes from the event, as the host may have finished long after it
+    if (device_rows > 0) {
+        clWaitForEvents(1, &event);
+        cl_ulong kernel_start, kernel_end;
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(kernel_start), &kernel_start, NULL);
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(kernel_end), &kernel_end, NULL);
+        clReleaseEvent(event);
+        device_seconds += (kernel_end - kernel_start) * 1e-9;
+
+        // Bring the device rows of process_C up to date on the host
+        auto read_start = high_resolution_clock::now();
+        read_results(process_C, device_rows, n);
+        device_seconds += duration<double>(high_resolution_clock::now() - read_start).count();
+    }
+    free_memory();
 
-    The fourth parameter accepts options that configure the compilation. 
-    These are similar to the flags used by gcc. For example, you can 
-    define a macro with the option -DMACRO=VALUE and turn off optimization 
-    with -cl-opt-disable.
-    */
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (err < 0)
-    {
-        /* Find size of log and print to std output */
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG,
-                              0, NULL, &log_size);
-        program_log = (char *)malloc(log_size + 1);
-        program_log[log_size] = '\0';
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG,
-                              log_size + 1, program_log, NULL);
-        printf("%s\n", program_log);
-        free(program_log);
-        exit(1);
+    split.update(device_rows, device_seconds, host_rows, host_seconds);
+}
+
+KernelConfig tune_kernel(const char *filename, int partition_rows, int k, int n)
+{
+    // Device limits decide which work-group shapes are legal
+    size_t max_group_size;
+    cl_ulong local_mem_size;
+    clGetDeviceInfo(ocl->device(), CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group_size), &max_group_size, NULL);
+    clGetDeviceInfo(ocl->device(), CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem_size), &local_mem_size, NULL);
+
+    // Candidates - the naive kernel plus each tile size and work per thread
+    vector<KernelConfig> candidates = {{0, 1}};
+    for (int tile : {8, 16, 32}) {
+        for (int wpt : {1, 2, 4, 8}) {
+            if ((size_t)tile * (tile / wpt) > max_group_size) continue;
+            if (2 * tile * tile * sizeof(int) > local_mem_size) continue;
+            candidates.push_back({tile, wpt});
+        }
+    }
+
+    // Time each candidate on the first rows of this partition - one warm up run then the best of three
+    const int rows = min(partition_rows, tuning_rows);
+    KernelConfig best = candidates[0];
+    long best_time = -1;
+    for (const KernelConfig &candidate : candidates) {
+        create_kernel(filename, candidate);
+
+        // Skip shapes the compiled kernel can't run with (register or local memory pressure)
+        size_t kernel_group_size;
+        clGetKernelWorkGroupInfo(kernel, ocl->device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_group_size), &kernel_group_size, NULL);
+        if (candidate.tile == 0 || (size_t)candidate.tile * (candidate.tile / candidate.wpt) <= kernel_group_size) {
+            copy_kernel_args(rows, k, n);
+            run_kernel(candidate, rows, n);
+            long candidate_time = -1;
+            for (int run = 0; run < 3; ++run) {
+                auto start = high_resolution_clock::now();
+                run_kernel(candidate, rows, n);
+                long time = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+                if (candidate_time < 0 || time < candidate_time) candidate_time = time;
+            }
+            if (best_time < 0 || candidate_time < best_time) {
+                best = candidate;
+                best_time = candidate_time;
+            }
+        }
     }
 
-    return program;
+    return best;
 }
 
-cl_device_id create_device() {
-
-   cl_platform_id platform;
-   cl_device_id dev;
-   int err;
-
-   /* Identify a platform */
-   err = clGetPlatformIDs(1, &platform, NULL);
-   if(err < 0) {
-      perror("Couldn't identify a platform");
-      exit(1);
-   } 
-
-   // Access a device
-   // GPU
-   err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
-   if(err == CL_DEVICE_NOT_FOUND) {
-      // CPU
-      printf("GPU not found\n");
-      err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
-   }
-   if(err < 0) {
-      perror("Couldn't access any devices");
-      exit(1);   
-   }
-
-   return dev;
+bool load_tuning(const string &key, KernelConfig &config)
+{
+    // Cache lines are: device key, tab, tile, wpt
+    ifstream cache(tuning_cache_file);
+    string line;
+    while (getline(cache, line)) {
+        const size_t tab = line.find('\t');
+        if (tab == string::npos || line.substr(0, tab) != key) continue;
+        if (sscanf(line.c_str() + tab + 1, "%d %d", &config.tile, &config.wpt) == 2) return true;
+    }
+    return false;
+}
+
+void save_tuning(const string &key, const KernelConfig &config)
+{
+    // Keep entries for other devices and replace this one
+    vector<string> lines;
+    ifstream cache(tuning_cache_file);
+    string line;
+    while (getline(cache, line)) {
+        if (line.substr(0, line.find('\t')) != key) lines.push_back(line);
+    }
+    cache.close();
+
+    // Written to a temporary file and renamed, so node leaders sharing a directory never see a partial cache
+    const string temp_path = string(tuning_cache_file) + ".tmp" + to_string(getpid());
+    ofstream out(temp_path);
+    if (!out) return;
+    for (const string &kept : lines) out << kept << "\n";
+    out << key << "\t" << config.tile << " " << config.wpt << "\n";
+    out.close();
+    if (!out || rename(temp_path.c_str(), tuning_cache_file) != 0) remove(temp_path.c_str());
 }
 
 // matrix_ops.cl
 // Matrix multiplication kernel
-// __kernel void matrix_mult(const int size,
-//                       __global int* A, // Matrix A 
-//                       __global int* B, // Matrix B
-//                       __global int* C, // Matrix C
+// __kernel void matrix_mult(const int k,
+//                       const int n,
+//                       __global int* A, // Matrix A - partition_rows x k
+//                       __global int* B, // Matrix B - k x n
+//                       __global int* C, // Matrix C - partition_rows x n
 //                       const int partition_rows ) {
     
 //     // Thread identifiers
 //     int row = get_global_id(0);
 //     int col = get_global_id(1);
+//     if (row >= partition_rows || col >= n) return;
 
 //     // Do matrix multiplication
 //     int result = 0;
-//     for (int k = 0; k < size; ++k){
-//         result += A[row * size + k] * B [k * size + col];
+//     for (int p = 0; p < k; ++p){
+//         result += A[row * k + p] * B [p * n + col];
+//     }
+//     C[row * n + col] = result;
+// }
+
+// // Tiled matrix multiplication kernel
+// // Each work-group computes a TS x TS tile of C, staging TS x TS tiles of A and B in local memory
+// // Each work-item computes WPT results spaced TS / WPT columns apart - local size is TS x (TS / WPT)
+// // TS and WPT are set at build time with -DTS=... -DWPT=... (picked per device by the tuner)
+// #ifndef TS
+// #define TS 16
+// #endif
+// #ifndef WPT
+// #define WPT 1
+// #endif
+// #define RTS (TS / WPT)
+//
+// __kernel void matrix_mult_tiled(const int k,
+//                       const int n,
+//                       __global int* A, // Matrix A - partition_rows x k
+//                       __global int* B, // Matrix B - k x n
+//                       __global int* C, // Matrix C - partition_rows x n
+//                       const int partition_rows ) {
+//
+//     // Thread identifiers - position inside the tile and in the global matrix
+//     const int local_row = get_local_id(0);
+//     const int local_col = get_local_id(1);
+//     const int row = get_group_id(0) * TS + local_row;
+//     const int col = get_group_id(1) * TS + local_col;
+//
+//     // Tiles of A and B shared by the work-group
+//     __local int Asub[TS][TS];
+//     __local int Bsub[TS][TS];
+//
+//     // Accumulators for the WPT results of this work-item
+//     int acc[WPT];
+//     for (int w = 0; w < WPT; ++w) {
+//         acc[w] = 0;
+//     }
+//
+//     // Loop over the tiles along k - edge tiles are padded with zeros
+//     const int num_tiles = (k + TS - 1) / TS;
+//     for (int t = 0; t < num_tiles; ++t) {
+//         const int tile_k = t * TS;
+//
+//         // Each work-item loads WPT elements of each tile
+//         for (int w = 0; w < WPT; ++w) {
+//             const int a_col = tile_k + local_col + w * RTS;
+//             const int b_row = tile_k + local_row;
+//             const int b_col = col + w * RTS;
+//             Asub[local_row][local_col + w * RTS] = (row < partition_rows && a_col < k) ? A[row * k + a_col] : 0;
+//             Bsub[local_row][local_col + w * RTS] = (b_row < k && b_col < n) ? B[b_row * n + b_col] : 0;
+//         }
+//
+//         // Wait until the whole tile is loaded
+//         barrier(CLK_LOCAL_MEM_FENCE);
+//
+//         // Multiply the tiles out of local memory
+//         for (int p = 0; p < TS; ++p) {
+//             const int a = Asub[local_row][p];
+//             for (int w = 0; w < WPT; ++w) {
+//                 acc[w] += a * Bsub[p][local_col + w * RTS];
+//             }
+//         }
+//
+//         // Wait before the next tile overwrites local memory
+//         barrier(CLK_LOCAL_MEM_FENCE);
+//     }
+//
+//     // Store the results that fall inside the matrix
+//     if (row >= partition_rows) return;
+//     for (int w = 0; w < WPT; ++w) {
+//         if (col + w * RTS < n) {
+//             C[row * n + col + w * RTS] = acc[w];
+//         }
 //     }
-//     C[row * size + col] = result;
-// }
\ No newline at end of file
+// }
@@ -1,18 +1,93 @@
 // Matrix multiplication kernel
-__kernel void matrix_mult(const int size,
-                      __global int* A, // Matrix A 
-                      __global int* B, // Matrix B
-                      __global int* C, // Matrix C
+__kernel void matrix_mult(const int k,
+                      const int n,
+                      __global int* A, // Matrix A - partition_rows x k
+                      __global int* B, // Matrix B - k x n
+                      __global int* C, // Matrix C - partition_rows x n
                       const int partition_rows ) {
     
     // Thread identifiers
     int row = get_global_id(0);
     int col = get_global_id(1);
+    if (row >= partition_rows || col >= n) return;
 
     // Do matrix multiplication
     int result = 0;
-    for (int k = 0; k < size; ++k){
-        result += A[row * size + k] * B [k * size + col];
+    for (int p = 0; p < k; ++p){
+        result += A[row * k + p] * B [p * n + col];
     }
-    C[row * size + col] = result;
-}
\ No newline at end of file
+    C[row * n + col] = result;
+}
+
+// Tiled matrix multiplication kernel
+// Each work-group computes a TS x TS tile of C, staging TS x TS tiles of A and B in local memory
+// Each work-item computes WPT results spaced TS / WPT columns apart - local size is TS x (TS / WPT)
+// TS and WPT are set at build time with -DTS=... -DWPT=... (picked per device by the tuner)
+#ifndef TS
+#define TS 16
+#endif
+#ifndef WPT
+#define WPT 1
+#endif
+#define RTS (TS / WPT)
+
+__kernel void matrix_mult_tiled(const int k,
+                      const int n,
+                      __global int* A, // Matrix A - partition_rows x k
+                      __global int* B, // Matrix B - k x n
+                      __global int* C, // Matrix C - partition_rows x n
+                      const int partition_rows ) {
+
+    // Thread identifiers - position inside the tile and in the global matrix
+    const int local_row = get_local_id(0);
+    const int local_col = get_local_id(1);
+    const int row = get_group_id(0) * TS + local_row;
+    const int col = get_group_id(1) * TS + local_col;
+
+    // Tiles of A and B shared by the work-group
+    __local int Asub[TS][TS];
+    __local int Bsub[TS][TS];
+
+    // Accumulators for the WPT results of this work-item
+    int acc[WPT];
+    for (int w = 0; w < WPT; ++w) {
+        acc[w] = 0;
+    }
+
+    // Loop over the tiles along k - edge tiles are padded with zeros
+    const int num_tiles = (k + TS - 1) / TS;
+    for (int t = 0; t < num_tiles; ++t) {
+        const int tile_k = t * TS;
+
+        // Each work-item loads WPT elements of each tile
+        for (int w = 0; w < WPT; ++w) {
+            const int a_col = tile_k + local_col + w * RTS;
+            const int b_row = tile_k + local_row;
+            const int b_col = col + w * RTS;
+            Asub[local_row][local_col + w * RTS] = (row < partition_rows && a_col < k) ? A[row * k + a_col] : 0;
+            Bsub[local_row][local_col + w * RTS] = (b_row < k && b_col < n) ? B[b_row * n + b_col] : 0;
+        }
+
+        // Wait until the whole tile is loaded
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        // Multiply the tiles out of local memory
+        for (int p = 0; p < TS; ++p) {
+            const int a = Asub[local_row][p];
+            for (int w = 0; w < WPT; ++w) {
+                acc[w] += a * Bsub[p][local_col + w * RTS];
+            }
+        }
+
+        // Wait before the next tile overwrites local memory
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    // Store the results that fall inside the matrix
+    if (row >= partition_rows) return;
+    for (int w = 0; w < WPT; ++w) {
+        if (col + w * RTS < n) {
+            C[row * n + col + w * RTS] = acc[w];
+        }
+    }
+}
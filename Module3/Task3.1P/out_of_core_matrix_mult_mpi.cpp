@@ -0,0 +1,223 @@
+#include <mpi.h>
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../../common/gemm.h"
+#include "../../common/cli.h"
+#include "../../common/partition.h"
+#include "../../common/random.h"
+#include "../../common/freivalds_mpi.h"
+#include "../../common/tiled_matrix.h"
+#include "../../common/out_of_core.h"
+
+using namespace std::chrono;
+using namespace std;
+
+// Out-of-core multiply per rank - every rank maps the tiles it needs straight from the tiled files, so no rank
+// (the master included) ever holds A, B or C whole, and each keeps at most --memory MiB of tiles mapped
+// C's tile rows are split into balanced ranges, one per rank, and each rank plans and prefetches its range on its own
+// The files must be on a filesystem every rank can map - local for one node, shared across nodes
+// Inputs come from --a/--b tiled files, or are generated by all ranks into out_of_core_a.tiled and out_of_core_b.tiled
+
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 2048;
+// Default tile size when --tile is not given - a 1 MiB tile of int32
+constexpr int default_tile = 512;
+// Default number of OMP threads per process when --threads is not given
+constexpr int default_threads = 1;
+
+// Files the inputs are generated into, and C's default, when --a/--b/--c are not given
+const string default_a_file = "out_of_core_a.tiled";
+const string default_b_file = "out_of_core_b.tiled";
+const string default_c_file = "out_of_core_c.tiled";
+
+// Whether every process succeeded - processes that failed print their own error first
+bool allSucceeded(const string &error, const int rank) {
+    if (!error.empty()) {
+        cerr << "Process " << rank << ": " << error << endl;
+    }
+    int ok = error.empty() ? 1 : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    return ok != 0;
+}
+
+// Create a tiled file on the master and open it for writing everywhere else - collective
+TiledMatrix<int> createShared(const string &path, const int rows, const int cols, const int tile, const int rank, string &error) {
+    TiledMatrix<int> matrix;
+    try {
+        if (rank == 0) {
+            matrix = TiledMatrix<int>::create(path, rows, cols, tile);
+        }
+    }
+    catch (const exception &e) {
+        error = e.what();
+    }
+    if (!allSucceeded(error, rank)) {
+        return matrix;
+    }
+    try {
+        if (rank != 0) {
+            matrix = TiledMatrix<int>::open(path, true);
+        }
+    }
+    catch (const exception &e) {
+        error = e.what();
+    }
+    return matrix;
+}
+
+// Generate a random tiled input with values from 0 to 99, as the other MPI programs do - each process writes a
+// balanced range of tile rows, and values depend only on seed and position, so any process count gives the same file
+bool generateInput(const string &path, const int rows, const int cols, const int tile, const CounterRng &rng, const int rank,
+                   const int numtasks, const int num_threads) {
+    string error;
+    TiledMatrix<int> matrix = createShared(path, rows, cols, tile, rank, error);
+    if (!allSucceeded(error, rank)) {
+        return false;
+    }
+    try {
+        fillRandomTiles(matrix, balancedRange(matrix.tileRows(), numtasks, rank), rng, 0, 99, num_threads);
+        matrix.sync();
+    }
+    catch (const exception &e) {
+        error = e.what();
+    }
+    return allSucceeded(error, rank);
+}
+
+int main(int argc, char** argv) {
+    // MPI setup
+    int numtasks, rank;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Tiled files (--a, --b) set the shape, otherwise inputs are generated at --size/--m/--k/--n - C goes to --c
+    const string a_file = stringOption(argc, argv, "--a", default_a_file);
+    const string b_file = stringOption(argc, argv, "--b", default_b_file);
+    const string c_file = stringOption(argc, argv, "--c", default_c_file);
+    const bool generate_a = findOption(argc, argv, "--a") == nullptr;
+    const bool generate_b = findOption(argc, argv, "--b") == nullptr;
+    MatrixDims dims;
+    // OMP threads per process for the tile multiplies - the prefetcher is one more thread
+    // --memory caps the tiles each process maps at once, in MiB
+    // --verify checks the product with this many Freivalds rounds, streaming each process's share of the tiles
+    int tile, num_threads, memory_mib, verify_rounds;
+    try {
+        dims = dimsOption(argc, argv, default_size);
+        tile = intOptionAtLeast(argc, argv, "--tile", default_tile, 1);
+        num_threads = threadsOption(argc, argv, default_threads);
+        memory_mib = intOptionAtLeast(argc, argv, "--memory", default_out_of_core_memory, 1);
+        verify_rounds = intOption(argc, argv, "--verify", 0);
+    }
+    catch (const exception &e) {  // Every process parses the same options, so every process stops here
+        if (rank == 0) cerr << e.what() << endl;
+        MPI_Finalize();
+        return 1;
+    }
+    const size_t memory_bytes = static_cast<size_t>(memory_mib) << 20;
+    // Random inputs are reproducible from --seed - every process uses the master's seed
+    uint64_t seed = seedOption(argc, argv);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+    if (rank == 0 && (generate_a || generate_b)) {
+        cout << "Seed: " << seed << endl;
+    }
+
+    // Generate whichever inputs were not given
+    if ((generate_a && !generateInput(a_file, dims.m, dims.k, tile, CounterRng(seed, matrix_a_stream), rank, numtasks, num_threads)) ||
+        (generate_b && !generateInput(b_file, dims.k, dims.n, tile, CounterRng(seed, matrix_b_stream), rank, numtasks, num_threads))) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    // Every process opens the inputs itself, and C once the master has created it
+    string error;
+    TiledMatrix<int> a, b;
+    try {
+        a = TiledMatrix<int>::open(a_file);
+        b = TiledMatrix<int>::open(b_file);
+    }
+    catch (const exception &e) {
+        error = e.what();
+    }
+    if (!allSucceeded(error, rank)) {
+        MPI_Finalize();
+        return 1;
+    }
+    TiledMatrix<int> c = createShared(c_file, a.rows(), b.cols(), a.tile(), rank, error);
+    if (!allSucceeded(error, rank)) {
+        MPI_Finalize();
+        return 1;
+    }
+    const Range tile_rows = balancedRange(c.tileRows(), numtasks, rank);
+
+    // Each process multiplies its own tile rows of C - timed section, from the slowest process
+    MPI_Barrier(MPI_COMM_WORLD);
+    const auto start = high_resolution_clock::now();  // Start timer
+    OutOfCoreStats stats;
+    try {
+        stats = outOfCoreMultiply(a, b, c, tile_rows, memory_bytes, num_threads);
+    }
+    catch (const exception &e) {
+        error = e.what();
+    }
+    const auto stop = high_resolution_clock::now();  // Stop timer
+    if (!allSucceeded(error, rank)) {
+        MPI_Finalize();
+        return 1;
+    }
+    double elapsed_us = duration_cast<microseconds>(stop - start).count();
+    long long totals[3] = {stats.steps, stats.tile_loads, stats.distinct_tiles};
+    double stall_us = stats.stall_us;
+    if (rank == 0) {
+        MPI_Reduce(MPI_IN_PLACE, &elapsed_us, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(MPI_IN_PLACE, totals, 3, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(MPI_IN_PLACE, &stall_us, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+    else {
+        MPI_Reduce(&elapsed_us, nullptr, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(totals, nullptr, 3, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&stall_us, nullptr, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    }
+
+    if (rank == 0) {
+        cout << "Plan: " << stats.order << " sweep on the master, " << totals[0] << " tile steps over " << numtasks
+             << " processes, " << stats.capacity << " tiles of " << a.tile() << "x" << a.tile() << " resident per process" << endl;
+        cout << "Tile reads: " << totals[1] << " (" << totals[2] << " distinct, " << 2 * totals[0]
+             << " without reuse), longest stall " << static_cast<long long>(stall_us) << " microseconds waiting on prefetch" << endl;
+        cout << "Micro-kernel: " << microKernelName(micro_kernel) << endl;
+    }
+
+    // Freivalds check - each process streams its tile rows of A and C and a share of B's tile rows
+    bool verified = true;
+    if (verify_rounds > 0) {
+        using V = FreivaldsArithmetic<int>::type;
+        const auto verify_start = high_resolution_clock::now();
+        FreivaldsResult result;
+        try {
+            result = freivaldsTiled(a, b, c, tile_rows, balancedRange(b.tileRows(), numtasks, rank), verify_rounds, seed, num_threads,
+                                    [](vector<V> &values) {
+                                        MPI_Allreduce(MPI_IN_PLACE, values.data(), static_cast<int>(values.size()), freivaldsMpiType<V>(),
+                                                      MPI_SUM, MPI_COMM_WORLD);
+                                    });
+        }
+        catch (const exception &e) {  // A tile that fails to map part way would leave the others in a collective
+            cerr << "Process " << rank << ": " << e.what() << endl;
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        const auto verify_stop = high_resolution_clock::now();
+        verified = result.passed();
+        if (rank == 0) {
+            cout << "Freivalds verification: " << freivaldsSummary(result) << " in "
+                 << duration_cast<microseconds>(verify_stop - verify_start).count() << " microseconds" << endl;
+        }
+    }
+
+    if (rank == 0) {
+        cout << "Time taken for out-of-core MPI matrix multiplication: " << static_cast<long long>(elapsed_us) << " microseconds" << endl;
+    }
+
+    MPI_Finalize();
+    return verified ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+#include <mpi.h>
+#include <iostream>
+#include <cstdlib>
+#include <time.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "../../common/matrix.h"
+#include "../../common/sparse.h"
+#include "../../common/cli.h"
+#include "../../common/partition.h"
+
+using namespace std::chrono;
+using namespace std;
+
+// Default matrix size when --size/--m/--k/--n are not given
+constexpr int default_size = 2048;
+// Default number of OMP threads per process when --threads is not given
+constexpr int default_threads = 1;
+// Default fraction of non-zero entries when --density is not given - 95% zeros
+constexpr double default_density = 0.05;
+
+// Non-zeros of each row - what is sent instead of row pointers, so every rank can rebuild its own from 0
+vector<int> rowLengths(const CsrMatrix<int> &a) {
+    vector<int> lengths(a.rows);
+    for (int i = 0; i < a.rows; i++) {
+        lengths[i] = static_cast<int>(a.row_ptr[i + 1] - a.row_ptr[i]);
+    }
+    return lengths;
+}
+
+// Row pointers rebuilt from row lengths
+void setRowLengths(CsrMatrix<int> &a, const vector<int> &lengths) {
+    a.row_ptr.assign(lengths.size() + 1, 0);
+    for (size_t i = 0; i < lengths.size(); i++) {
+        a.row_ptr[i + 1] = a.row_ptr[i] + lengths[i];
+    }
+}
+
+// Broadcast a whole CSR matrix from the master process
+void broadcastCsr(CsrMatrix<int> &a, const int rank) {
+    vector<int> lengths;
+    int nnz = static_cast<int>(a.nnz());
+    MPI_Bcast(&nnz, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        lengths = rowLengths(a);
+    }
+    else {
+        lengths.resize(a.rows);
+        a.col_idx.resize(nnz);
+        a.values.resize(nnz);
+    }
+    MPI_Bcast(lengths.data(), a.rows, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(a.col_idx.data(), nnz, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(a.values.data(), nnz, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank != 0) {
+        setRowLengths(a, lengths);
+    }
+}
+
+// Scatter the rows of the master's CSR matrix - process i receives rows [bounds[i], bounds[i + 1])
+// Row lengths travel with one count per row, column indices and values with one count per non-zero
+CsrMatrix<int> scatterCsrRows(const CsrMatrix<int> &a, const int cols, const vector<int> &bounds, const int rank, const int numtasks) {
+    vector<int> row_counts(numtasks), row_displs(numtasks), nnz_counts(numtasks), nnz_displs(numtasks);
+    vector<int> lengths;
+    if (rank == 0) {
+        lengths = rowLengths(a);
+        for (int i = 0; i < numtasks; i++) {
+            row_counts[i] = bounds[i + 1] - bounds[i];
+            row_displs[i] = bounds[i];
+            nnz_counts[i] = static_cast<int>(a.row_ptr[bounds[i + 1]] - a.row_ptr[bounds[i]]);
+            nnz_displs[i] = static_cast<int>(a.row_ptr[bounds[i]]);
+        }
+    }
+
+    // Each process needs only its own non-zero count
+    int local_nnz = 0;
+    MPI_Scatter(nnz_counts.data(), 1, MPI_INT, &local_nnz, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    CsrMatrix<int> local;
+    local.rows = bounds[rank + 1] - bounds[rank];
+    local.cols = cols;
+    local.col_idx.resize(local_nnz);
+    local.values.resize(local_nnz);
+    vector<int> local_lengths(local.rows);
+
+    MPI_Scatterv(lengths.data(), row_counts.data(), row_displs.data(), MPI_INT, local_lengths.data(), local.rows, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Scatterv(a.col_idx.data(), nnz_counts.data(), nnz_displs.data(), MPI_INT, local.col_idx.data(), local_nnz, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Scatterv(a.values.data(), nnz_counts.data(), nnz_displs.data(), MPI_INT, local.values.data(), local_nnz, MPI_INT, 0, MPI_COMM_WORLD);
+    setRowLengths(local, local_lengths);
+    return local;
+}
+
+// Gather each process's CSR rows back into one matrix on the master process
+void gatherCsrRows(const CsrMatrix<int> &local, CsrMatrix<int> &c, const vector<int> &bounds, const int rank, const int numtasks) {
+    const int local_nnz = static_cast<int>(local.nnz());
+    vector<int> row_counts(numtasks), row_displs(numtasks), nnz_counts(numtasks), nnz_displs(numtasks);
+    MPI_Gather(&local_nnz, 1, MPI_INT, nnz_counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    vector<int> lengths;
+    if (rank == 0) {
+        int total = 0;
+        for (int i = 0; i < numtasks; i++) {
+            row_counts[i] = bounds[i + 1] - bounds[i];
+            row_displs[i] = bounds[i];
+            nnz_displs[i] = total;
+            total += nnz_counts[i];
+        }
+        lengths.resize(c.rows);
+        c.col_idx.resize(total);
+        c.values.resize(total);
+    }
+
+    const vector<int> local_lengths = rowLengths(local);
+    MPI_Gatherv(local_lengths.data(), local.rows, MPI_INT, lengths.data(), row_counts.data(), row_displs.data(), MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(local.col_idx.data(), local_nnz, MPI_INT, c.col_idx.data(), nnz_counts.data(), nnz_displs.data(), MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(local.values.data(), local_nnz, MPI_INT, c.values.data(), nnz_counts.data(), nnz_displs.data(), MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        setRowLengths(c, lengths);
+    }
+}
+
+int main(int argc, char** argv) {
+
+    // MPI setup
+    int numtasks, rank;
+
+    // Initialize the MPI environment
+    MPI_Init(&argc, &argv);
+
+    // Get the number of tasks/process
+    MPI_Comm_size(MPI_COMM_WORLD, &numtasks);
+
+    // Get the rank
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Matrix dimensions from the command line - C (m x n) = A (m x k) * B (k x n)
+    MatrixDims dims;
+    int num_threads;
+    double density;
+    try {
+        dims = dimsOption(argc, argv, default_size);
+        num_threads = threadsOption(argc, argv, default_threads);
+        density = doubleOption(argc, argv, "--density", default_density);
+    }
+    catch (const exception &e) {  // Every process parses the same options, so every process stops here
+        if (rank == 0) cerr << e.what() << endl;
+        MPI_Finalize();
+        return 1;
+    }
+    const int m = dims.m, k = dims.k, n = dims.n;
+
+    // --mode spmm multiplies sparse A by dense B, spgemm multiplies sparse A by sparse B
+    const string mode = stringOption(argc, argv, "--mode", "spmm");
+    const bool sparse_b = mode == "spgemm";
+    if (!sparse_b && mode != "spmm") {
+        if (rank == 0) cerr << "Unknown --mode " << mode << endl;
+        MPI_Finalize();
+        return 1;
+    }
+    // --partition rows splits rows evenly by count instead of by work, for comparison
+    const bool by_work = stringOption(argc, argv, "--partition", "nnz") != "rows";
+
+    // Only the master process generates A - B is generated there too and broadcast
+    CsrMatrix<int> A, B_sparse;
+    Matrix B;
+    if (!sparse_b) {
+        B = Matrix(k, n);
+    }
+    A.rows = m;
+    A.cols = k;
+    B_sparse.rows = k;
+    B_sparse.cols = n;
+    if (rank == 0) {
+        minstd_rand gen(time(0));
+        uniform_int_distribution distrib(1, 100);
+        A = randomCsr<int>(m, k, density, gen, distrib);
+        if (sparse_b) {
+            B_sparse = randomCsr<int>(k, n, density, gen, distrib);
+        }
+        else {
+            for (size_t i = 0; i < B.size(); i++) {
+                B.data()[i] = distrib(gen);
+            }
+        }
+    }
+
+    // Start timer - happens in all processes, but timer only stopped and calculated by master process
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start = high_resolution_clock::now();
+
+    // B goes to every process
+    if (sparse_b) {
+        broadcastCsr(B_sparse, rank);
+    }
+    else {
+        MPI_Bcast(B.data(), k * n, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+
+    // Row boundaries from the master - split by non-zeros of A (SpMM) or by multiply-adds (SpGEMM)
+    vector<int> bounds(numtasks + 1);
+    if (rank == 0) {
+        const vector<size_t> work = sparse_b ? spgemmWork(A, B_sparse) : A.row_ptr;
+        for (int i = 0; i < numtasks; i++) {
+            bounds[i] = by_work ? weightedRange(work, numtasks, i).start : balancedRange(m, numtasks, i).start;
+        }
+        bounds[numtasks] = m;
+    }
+    MPI_Bcast(bounds.data(), numtasks + 1, MPI_INT, 0, MPI_COMM_WORLD);
+    const CsrMatrix<int> process_A = scatterCsrRows(A, k, bounds, rank, numtasks);
+    const int partition_rows = process_A.rows;
+
+    // Multiply the local rows - OMP threads inside the process split them by work as well
+    long long local_work;
+    CsrMatrix<int> C_sparse;
+    Matrix C;
+    if (sparse_b) {
+        const vector<size_t> work = spgemmWork(process_A, B_sparse);
+        local_work = work.back();
+        const CsrMatrix<int> process_C = spgemm<int, int>(process_A, B_sparse, num_threads);
+        C_sparse.rows = m;
+        C_sparse.cols = n;
+        gatherCsrRows(process_C, C_sparse, bounds, rank, numtasks);
+    }
+    else {
+        local_work = static_cast<long long>(process_A.nnz()) * n;
+        Matrix process_C(partition_rows, n);
+        spmm(process_A, B, process_C, num_threads);
+
+        // Gather results into matrix C
+        vector<int> counts_C(numtasks), displs_C(numtasks);
+        for (int i = 0; i < numtasks; i++) {
+            counts_C[i] = (bounds[i + 1] - bounds[i]) * n;
+            displs_C[i] = bounds[i] * n;
+        }
+        if (rank == 0) {
+            C = Matrix(m, n);
+        }
+        MPI_Gatherv(process_C.data(), partition_rows * n, MPI_INT, C.data(), counts_C.data(), displs_C.data(), MPI_INT, 0, MPI_COMM_WORLD);
+    }
+
+    // Barrier to ensure all processes have finished
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Spread of multiply-adds between processes - 1.0 is a perfect balance
+    long long min_work = 0, max_work = 0;
+    MPI_Reduce(&local_work, &min_work, 1, MPI_LONG_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local_work, &max_work, 1, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Master process only
+    if (rank == 0) {
+        // Stop timer
+        auto stop = high_resolution_clock::now();
+
+        // Output duration
+        auto duration = duration_cast<microseconds>(stop - start);
+        cout << "Time taken by function (" << mode << "): "
+            << duration.count() << " microseconds" << endl;
+        cout << "Non-zeros in A: " << A.nnz() << ", " << A.bytes() / (1024.0 * 1024.0) << " MB stored vs "
+            << static_cast<double>(m) * k * sizeof(int) / (1024.0 * 1024.0) << " MB dense" << endl;
+        if (sparse_b) {
+            cout << "Non-zeros in C: " << C_sparse.nnz() << endl;
+        }
+        cout << "Work per process: min " << min_work << ", max " << max_work
+            << " (max/min " << (min_work > 0 ? static_cast<double>(max_work) / min_work : 0.0) << ")" << endl;
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -4,13 +4,16 @@
 #include <chrono>
 #include <time.h>
 #include <cstdlib>
+#include "../../common/cli.h"
+#include "../../common/perf_counters_mpi.h"
+#include "../../common/huge_pages.h"
 
 // Namespaces added for readability
 using namespace std;
 using namespace chrono;
 
 // Lomuto partitioning adapted from pseudocode at https://en.wikipedia.org/wiki/Quicksort
-auto partition(vector<int> &vec, const int lo, const int hi) -> int {
+auto partition(HugeVector<int> &vec, const int lo, const int hi) -> int {
     // Last element is designated as pivot
     const int pivot = vec[hi];
     // Temp pivot index
@@ -28,7 +31,7 @@ auto partition(vector<int> &vec, const int lo, const int hi) -> int {
 }
 
 // Quicksort algorithm
-void quicksort(vector<int> &vec, int lo, int hi) {
+void quicksort(HugeVector<int> &vec, int lo, int hi) {
     if (lo >= hi) {
         return;
     }
@@ -60,9 +63,22 @@ int main(int argc, char** argv) {
     // Set parameters for testing
     int n = 1000000; // Size of the array
     int max_value = 1000000000; // Maximum number to generate
+    // --perf counts cycles, instructions and cache and TLB misses of each step and prints every process's counts at the end
+    perfEnable(flagOption(argc, argv, "--perf"));
+    // --huge-pages off|thp|hugetlb picks how the sort vectors are backed - transparent huge pages by default
+    try {
+        setHugePageMode(hugePagesOption(argc, argv));
+    }
+    catch (const exception &e) {
+        if (rank == 0) {
+            cerr << e.what() << endl;
+        }
+        MPI_Finalize();
+        return 1;
+    }
 
     // Init variables
-    vector<int> data(n); // For entire vector to be sorted
+    HugeVector<int> data(n); // For entire vector to be sorted
     int process_max, process_min; // Min and max values for each process
     time_point<chrono::high_resolution_clock> start; // For timer
 
@@ -72,12 +88,17 @@ int main(int argc, char** argv) {
         for (int i = 0; i < n; ++i) {
             data[i] = rand() % max_value;
         }   
+        // Pages backing the vector - read after the fill, since transparent huge pages back only touched memory
+        cout << "Pages: " << pageSizeSummary(data.data(), data.size() * sizeof(int)) << endl;
         start = high_resolution_clock::now();  
     }
 
     // Each process determines their min and max values based on rank
     // Broadcast the entire vector to each process
-    MPI_Bcast(&data[0], n, MPI_INT, 0, MPI_COMM_WORLD);
+    {
+        PerfRegion region("bcast");
+        MPI_Bcast(&data[0], n, MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
     // Define the range used for each process
     int range_per_process = max_value / numtasks;
@@ -87,39 +108,48 @@ int main(int argc, char** argv) {
     process_max = (rank == numtasks - 1) ? max_value : (rank + 1) * range_per_process - 1; 
 
     // Each process creates a vector containing the data in its min to max range
-    vector<int> process_data;
-    for (int i = 0; i < n; ++i) {
-        if (data[i] >= process_min && data[i] <= process_max) {
-            process_data.push_back(data[i]);
+    HugeVector<int> process_data;
+    {
+        PerfRegion region("partition");
+        for (int i = 0; i < n; ++i) {
+            if (data[i] >= process_min && data[i] <= process_max) {
+                process_data.push_back(data[i]);
+            }
         }
     }
 
     // Perform quicksort on process_data
-    quicksort(process_data, 0, process_data.size() - 1);
+    {
+        PerfRegion region("sort");
+        quicksort(process_data, 0, process_data.size() - 1);
+    }
 
     // Need to gather vectors of different lengths
     // Adapted from https://stackoverflow.com/questions/31890523/how-to-use-mpi-gatherv-for-collecting-strings-of-diiferent-length-from-different
 
     // Gather the sorted data
-    vector<int> recv_counts(numtasks); // Store number of elements from each process
-    int local_size = process_data.size(); // Size of array for each process
-
-    // Gather the size of each processes data and store in recv_counts
-    MPI_Gather(&local_size, 1, MPI_INT, recv_counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    // Displacements array to determine where to place the incoming data in the gathered array
-    vector<int> displs(numtasks);
-    if (rank == 0) { // Performed in master node
-        displs[0] = 0;
-        for (int i = 1; i < numtasks; ++i) {
-            //Vector placement set to previous value plus count of previous value
-            displs[i] = displs[i - 1] + recv_counts[i - 1]; 
+    HugeVector<int> sorted_data(n);
+    {
+        PerfRegion region("gather");
+        vector<int> recv_counts(numtasks); // Store number of elements from each process
+        int local_size = process_data.size(); // Size of array for each process
+
+        // Gather the size of each processes data and store in recv_counts
+        MPI_Gather(&local_size, 1, MPI_INT, recv_counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        // Displacements array to determine where to place the incoming data in the gathered array
+        vector<int> displs(numtasks);
+        if (rank == 0) { // Performed in master node
+            displs[0] = 0;
+            for (int i = 1; i < numtasks; ++i) {
+                //Vector placement set to previous value plus count of previous value
+                displs[i] = displs[i - 1] + recv_counts[i - 1]; 
+            }
         }
-    }
 
-    // Gather sorted data
-    vector<int> sorted_data(n);
-    MPI_Gatherv(process_data.data(), local_size, MPI_INT, sorted_data.data(), recv_counts.data(), displs.data(), MPI_INT, 0, MPI_COMM_WORLD);
+        // Gather sorted data
+        MPI_Gatherv(process_data.data(), local_size, MPI_INT, sorted_data.data(), recv_counts.data(), displs.data(), MPI_INT, 0, MPI_COMM_WORLD);
+    }
 
     // Stop timer in master process and output result
     if (rank == 0) {
@@ -135,6 +165,9 @@ int main(int argc, char** argv) {
         // cout << endl;
     } 
 
+    // Per-process counter reports, gathered onto the master
+    mpiPrintPerfReport(MPI_COMM_WORLD);
+
     // Finalise MPI
     MPI_Finalize();
     return 0;
@@ -8,35 +8,41 @@
 #include <sstream>
 #include <CL/cl.h>
 #include <algorithm> // Used to test sorting
+#include "../../common/cli.h"
+#include "../../common/ocl_runtime.h"
 
 // Namespaces added for readability
 using namespace std;
 using namespace chrono;
 
 // Variables for OpenCL
+OclRuntime *ocl = nullptr; // Device, context, queue and compiled kernels - kept for the whole run
 cl_mem bufA; // Shared memory buffer
-cl_device_id device_id; // ID of the device to use for computation
-cl_context context; // Context where kernel executes
-cl_program program; // Executable code for kernels - the .cl file
-cl_kernel kernel; // OpenCL kernel
-cl_command_queue queue; // Queue that holds device commands
+cl_kernel kernel; // OpenCL kernel - owned by the runtime
 cl_event event = NULL;
 int err; // For error handling in OpenCL
 
+// Zero-copy mode - the buffer wraps the partition with CL_MEM_USE_HOST_PTR and the result is mapped, not read
+bool zero_copy = false;
+long long bytes_copied = 0; // Bytes moved by explicit host <-> device copies on this process
+
+// Partition storage - page aligned so OpenCL can use it in place
+using HostVector = vector<int, HostAllocator<int>>;
+
 // OpenCL function prototypes
-cl_device_id create_device();
-void setup_openCL_device_context_queue_kernel(const char *filename, const char *kernelname);
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename);
 void setup_kernel_memory(int *process_data, int partition_size);
 void copy_kernel_args(int partition_size);
 void free_memory();
 
 // OpenCL setup split out to separate method so main is a bit tidier
-void iterativeQuicksortOpenCL(vector<int>& arr) {
+void iterativeQuicksortOpenCL(HostVector& arr) {
     size_t global_size = 1; // Only one work-item
 
-    // Initialize OpenCL platform and device
-    setup_openCL_device_context_queue_kernel((char *)"./quicksort_ops.cl", (char *)"iterativeQuicksort");
+    // Nothing to sort - the kernel would read arr[0] of an empty partition
+    if (arr.empty()) return;
+
+    // Kernel from the runtime - compiled once, or loaded from the on-disk binary cache
+    kernel = ocl->kernel("./quicksort_ops.cl", "iterativeQuicksort");
 
     // Setup kernel memory for OpenCL
     setup_kernel_memory(arr.data(), arr.size());
@@ -45,11 +51,20 @@ void iterativeQuicksortOpenCL(vector<int>& arr) {
     copy_kernel_args(arr.size());
 
     // Execute the kernel
-    clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, &event);
+    clEnqueueNDRangeKernel(ocl->queue(), kernel, 1, NULL, &global_size, NULL, 0, NULL, &event);
     clWaitForEvents(1, &event);
+    clReleaseEvent(event);
 
-    // Read back the result
-    clEnqueueReadBuffer(queue, bufA, CL_TRUE, 0, arr.size() * sizeof(int), arr.data(), 0, NULL, NULL);
+    // Read back the result - mapping a CL_MEM_USE_HOST_PTR buffer updates arr in place
+    if (zero_copy) {
+        void *mapped = clEnqueueMapBuffer(ocl->queue(), bufA, CL_TRUE, CL_MAP_READ, 0, arr.size() * sizeof(int), 0, NULL, NULL, &err);
+        clEnqueueUnmapMemObject(ocl->queue(), bufA, mapped, 0, NULL, NULL);
+        clFinish(ocl->queue());
+    }
+    else {
+        clEnqueueReadBuffer(ocl->queue(), bufA, CL_TRUE, 0, arr.size() * sizeof(int), arr.data(), 0, NULL, NULL);
+        bytes_copied += arr.size() * sizeof(int);
+    }
 
     // Free OpenCL resources
     free_memory();
@@ -78,6 +93,9 @@ int main(int argc, char** argv) {
     // Find the processor name
     MPI_Get_processor_name(name, &name_len);
 
+    // Copy or zero-copy OpenCL buffers
+    zero_copy = flagOption(argc, argv, "--zero-copy");
+
     // Set parameters for testing
     int n = 10000000; // Size of the array
     int max_value = 1000000000; // Maximum number to generate
@@ -108,7 +126,7 @@ int main(int argc, char** argv) {
     process_max = (rank == numtasks - 1) ? max_value : (rank + 1) * range_per_process - 1; 
 
     // Each process creates a vector containing the data in its min to max range
-    vector<int> process_data;
+    HostVector process_data;
     for (int i = 0; i < n; ++i) {
         if (data[i] >= process_min && data[i] <= process_max) {
             process_data.push_back(data[i]);
@@ -116,6 +134,7 @@ int main(int argc, char** argv) {
     }
 
     // Perform quicksort on process_data using OpenCL
+    ocl = new OclRuntime();
     iterativeQuicksortOpenCL(process_data);
 
     // Need to gather vectors of different lengths
@@ -142,6 +161,10 @@ int main(int argc, char** argv) {
     vector<int> sorted_data(n);
     MPI_Gatherv(process_data.data(), local_size, MPI_INT, sorted_data.data(), recv_counts.data(), displs.data(), MPI_INT, 0, MPI_COMM_WORLD);
 
+    // Total bytes copied between host and device over all processes
+    long long total_bytes_copied = 0;
+    MPI_Reduce(&bytes_copied, &total_bytes_copied, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
     // Stop timer in master process and output result
     if (rank == 0) {
         // Stop timer
@@ -149,6 +172,10 @@ int main(int argc, char** argv) {
         // Calculate duration and record result
         const auto duration = duration_cast<microseconds>(stop - start);
         cout << "Time taken for MPI & OpenCL quicksort: " << duration.count() << " microseconds" << endl;
+        cout << "OpenCL program setup (rank 0): " << ocl->buildMicroseconds() << " microseconds, "
+            << ocl->cacheHits() << " cached, " << ocl->cacheMisses() << " compiled" << endl;
+        cout << "Bytes copied host <-> device (" << (zero_copy ? "zero-copy" : "copy") << " mode, all processes): "
+            << total_bytes_copied << endl;
 
         // Testing section below
 
@@ -168,6 +195,9 @@ int main(int argc, char** argv) {
         // }
     } 
 
+    // Release OpenCL context, queue and kernels
+    delete ocl;
+
     // Finalise MPI
     MPI_Finalize();
     return 0;
@@ -178,11 +208,7 @@ void free_memory() {
     // Free buffer
     clReleaseMemObject(bufA);
 
-    // Free OpenCL objects
-    clReleaseKernel(kernel);
-    clReleaseCommandQueue(queue);
-    clReleaseProgram(program);
-    clReleaseContext(context);
+    // The context, queue and kernel belong to the runtime and are kept for reuse
 }
 
 void copy_kernel_args(int partition_size) {
@@ -191,152 +217,63 @@ void copy_kernel_args(int partition_size) {
 }
 
 void setup_kernel_memory(int *process_data, int partition_size) {
-    bufA = clCreateBuffer(context, CL_MEM_READ_WRITE, partition_size * sizeof(int), NULL, NULL);
-    clEnqueueWriteBuffer(queue, bufA, CL_TRUE, 0, partition_size * sizeof(int), process_data, 0, NULL, NULL);
-}
-
-void setup_openCL_device_context_queue_kernel(const char *filename, const char *kernelname) {
-    device_id = create_device();
-    cl_int err;
-
-    // Create OpenCL context
-    context = clCreateContext(NULL, 1, &device_id, NULL, NULL, &err);
-    if (err < 0) {
-        perror("Couldn't create a context");
-        exit(1);
-    }
-
-    // Build the OpenCL program
-    program = build_program(context, device_id, filename);
-
-    // Create command queue
-    queue = clCreateCommandQueueWithProperties(context, device_id, 0, &err);
-    if (err < 0) {
-        perror("Couldn't create a command queue");
-        exit(1);
+    // Zero-copy - the kernel sorts the host partition in place
+    if (zero_copy) {
+        bufA = clCreateBuffer(ocl->context(), CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, partition_size * sizeof(int), process_data, NULL);
+        return;
     }
 
-    // Create the kernel
-    kernel = clCreateKernel(program, kernelname, &err);
-    if (err < 0) {
-        perror("Couldn't create a kernel");
-        exit(1);
-    }
-}
-
-cl_program build_program(cl_context ctx, cl_device_id dev, const char *filename) {
-    FILE *program_handle;
-    char *program_buffer;
-    size_t program_size;
-    cl_program program;
-
-    // Read kernel file
-    program_handle = fopen(filename, "r");
-    if (program_handle == NULL) {
-        perror("Couldn't find the program file");
-        exit(1);
-    }
-    fseek(program_handle, 0, SEEK_END);
-    program_size = ftell(program_handle);
-    rewind(program_handle);
-    program_buffer = (char*) malloc(program_size + 1);
-    program_buffer[program_size] = '\0';
-    fread(program_buffer, sizeof(char), program_size, program_handle);
-    fclose(program_handle);
-
-    // Create the OpenCL program
-    program = clCreateProgramWithSource(ctx, 1, (const char**)&program_buffer, &program_size, &err);
-    if (err < 0) {
-        perror("Couldn't create the program");
-        exit(1);
-    }
-    free(program_buffer);
-
-    // Build the program
-    err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (err < 0) {
-        char build_log[16384];
-        clGetProgramBuildInfo(program, dev, CL_PROGRAM_BUILD_LOG, sizeof(build_log), build_log, NULL);
-        cerr << "Build Log: " << build_log << endl;
-        exit(1);
-    }
-
-    return program;
-}
-
-cl_device_id create_device() {
-    cl_platform_id platform;
-    cl_device_id dev;
-    int err;
-
-    // Get platform
-    err = clGetPlatformIDs(1, &platform, NULL);
-    if (err < 0) {
-        perror("Couldn't identify a platform");
-        exit(1);
-    }
-
-    // Access a device
-    err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
-    if (err == CL_DEVICE_NOT_FOUND) {
-        // Fallback to CPU if no GPU found
-        cout << "GPU not found, using CPU" << endl;
-        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
-    }
-    if (err < 0) {
-        perror("Couldn't access any devices");
-        exit(1);
-    }
-
-    return dev;
+    bufA = clCreateBuffer(ocl->context(), CL_MEM_READ_WRITE, partition_size * sizeof(int), NULL, NULL);
+    clEnqueueWriteBuffer(ocl->queue(), bufA, CL_TRUE, 0, partition_size * sizeof(int), process_data, 0, NULL, NULL);
+    bytes_copied += partition_size * sizeof(int);
 }
 
 // quicksort_ops.cl
-// Adapted from iterative quicksort method at https://www.geeksforgeeks.org/iterative-quick-sort/
-__kernel void iterativeQuicksort(__global int* arr, const unsigned int size) {
-    int left = 0;
-    int right = size - 1;
-    
-    // Stack to store the array bounds
-    int stack[256]; // Stack size of 256 should be more than adequate for sorting vectors with 100,000,000 items
-    int top = -1; // Top of stack set to minus 1 to prepare for first index
-    
-    // Push initial array bounds to the stack
-    stack[++top] = left;
-    stack[++top] = right;
-    
-    // Continue until the stack is empty
-    while (top >= 0) {
-        // Pop right and left
-        right = stack[top--];
-        left = stack[top--];
-        
-        int i = left; 
-        int j = right;
-        int pivot = arr[(left + right) / 2];
-        
-        // Partitioning
-        while (i <= j) {
-            while (arr[i] < pivot) i++;
-            while (arr[j] > pivot) j--;
-            if (i <= j) {
-                int temp = arr[i];
-                arr[i] = arr[j];
-                arr[j] = temp;
-                i++;
-                j--;
-            }
-        }
-        
-        // Push subarray bounds to stack for further sorting
-        if (left < j) {
-            stack[++top] = left;
-            stack[++top] = j;
-        }
-        
-        if (i < right) {
-            stack[++top] = i;
-            stack[++top] = right;
-        }
-    }
-}
\ No newline at end of file
+// // Adapted from iterative quicksort method at https://www.geeksforgeeks.org/iterative-quick-sort/
+// __kernel void iterativeQuicksort(__global int* arr, const unsigned int size) {
+//     int left = 0;
+//     int right = size - 1;
+//
+//     // Stack to store the array bounds
+//     int stack[256]; // Stack size of 256 should be more than adequate for sorting vectors with 100,000,000 items
+//     int top = -1; // Top of stack set to minus 1 to prepare for first index
+//
+//     // Push initial array bounds to the stack
+//     stack[++top] = left;
+//     stack[++top] = right;
+//
+//     // Continue until the stack is empty
+//     while (top >= 0) {
+//         // Pop right and left
+//         right = stack[top--];
+//         left = stack[top--];
+//
+//         int i = left; 
+//         int j = right;
+//         int pivot = arr[(left + right) / 2];
+//
+//         // Partitioning
+//         while (i <= j) {
+//             while (arr[i] < pivot) i++;
+//             while (arr[j] > pivot) j--;
+//             if (i <= j) {
+//                 int temp = arr[i];
+//                 arr[i] = arr[j];
+//                 arr[j] = temp;
+//                 i++;
+//                 j--;
+//             }
+//         }
+//
+//         // Push subarray bounds to stack for further sorting
+//         if (left < j) {
+//             stack[++top] = left;
+//             stack[++top] = j;
+//         }
+//
+//         if (i < right) {
+//             stack[++top] = i;
+//             stack[++top] = right;
+//         }
+//     }
+// }
\ No newline at end of file
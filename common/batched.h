@@ -0,0 +1,168 @@
+#ifndef COMMON_BATCHED_H
+#define COMMON_BATCHED_H
+
+// Batched multiplication of many small matrices - C[i] = A[i] * B[i] for i in [0, count)
+// Matrix i of A starts at a + i * stride_a (likewise B and C), each row-major and densely packed
+// Square sizes from 4 to 64 in steps of 4 use kernels with the size as a template parameter, so every loop bound
+// is a compile-time constant the compiler unrolls and vectorises, compiled per instruction set like the micro-kernels
+// The batch is split between OMP threads inside one parallel region - no per-matrix packing, allocation or fork/join
+
+#include <cstddef>
+#include <utility>
+#include "gemm.h"
+#include "microkernels.h"
+#include "partition.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Square sizes with compile-time kernels - batched_size_step, 2 * batched_size_step, ..., batched_max_size
+constexpr int batched_size_step = 4;
+constexpr int batched_max_size = 64;
+
+// Below this many multiply-adds in the whole batch, starting threads costs more than it saves
+constexpr long long batched_parallel_threshold = 1 << 16;
+
+// Kernel for a run of count products of one fixed size
+template <typename T, typename Acc>
+using BatchKernel = void (*)(int count, const T *a, std::size_t stride_a, const T *b, std::size_t stride_b,
+                             Acc *c, std::size_t stride_c);
+
+// One M x K by K x N product with every size known at compile time
+// Each row of C is accumulated in a local array that lives in registers - N / lanes vectors wide
+template <int M, int K, int N, typename T, typename Acc>
+__attribute__((always_inline))
+inline void smallGemm(const T *a, const T *b, Acc *c) {
+    for (int i = 0; i < M; i++) {
+        Acc row[N] = {};
+        #pragma GCC unroll 16
+        for (int p = 0; p < K; p++) {
+            const Acc a_ip = static_cast<Acc>(a[i * K + p]);
+            for (int j = 0; j < N; j++) {
+                row[j] += a_ip * static_cast<Acc>(b[p * N + j]);
+            }
+        }
+        for (int j = 0; j < N; j++) {
+            c[i * N + j] = row[j];
+        }
+    }
+}
+
+// Run of N x N products - the per-matrix kernel is inlined, so the whole loop is specialised for N
+template <int N, typename T, typename Acc>
+__attribute__((always_inline))
+inline void batchBody(const int count, const T *a, const std::size_t stride_a, const T *b, const std::size_t stride_b,
+                      Acc *c, const std::size_t stride_c) {
+    for (int i = 0; i < count; i++) {
+        smallGemm<N, N, N>(a + i * stride_a, b + i * stride_b, c + i * stride_c);
+    }
+}
+
+template <int N, typename T, typename Acc>
+inline void batchScalar(const int count, const T *a, const std::size_t stride_a, const T *b, const std::size_t stride_b,
+                        Acc *c, const std::size_t stride_c) {
+    batchBody<N>(count, a, stride_a, b, stride_b, c, stride_c);
+}
+
+#ifdef GEMM_HAVE_X86_KERNELS
+
+template <int N, typename T, typename Acc>
+__attribute__((target("avx2,fma")))
+inline void batchAvx2(const int count, const T *a, const std::size_t stride_a, const T *b, const std::size_t stride_b,
+                      Acc *c, const std::size_t stride_c) {
+    batchBody<N>(count, a, stride_a, b, stride_b, c, stride_c);
+}
+
+template <int N, typename T, typename Acc>
+__attribute__((target("avx512f")))
+inline void batchAvx512(const int count, const T *a, const std::size_t stride_a, const T *b, const std::size_t stride_b,
+                        Acc *c, const std::size_t stride_c) {
+    batchBody<N>(count, a, stride_a, b, stride_b, c, stride_c);
+}
+
+#endif // GEMM_HAVE_X86_KERNELS
+
+// Kernel for size N on the given instruction set
+template <int N, typename T, typename Acc>
+inline BatchKernel<T, Acc> batchKernelAt(const SimdLevel level) {
+#ifdef GEMM_HAVE_X86_KERNELS
+    if (level == SimdLevel::avx512) return batchAvx512<N, T, Acc>;
+    if (level == SimdLevel::avx2) return batchAvx2<N, T, Acc>;
+#endif
+    return batchScalar<N, T, Acc>;
+}
+
+// Look size up among the compiled sizes - one comparison per size, expanded from the index sequence
+template <typename T, typename Acc, int... Steps>
+inline BatchKernel<T, Acc> batchKernelForSize(const int size, const SimdLevel level, std::integer_sequence<int, Steps...>) {
+    BatchKernel<T, Acc> kernel = nullptr;
+    ((size == (Steps + 1) * batched_size_step ? (kernel = batchKernelAt<(Steps + 1) * batched_size_step, T, Acc>(level)) : nullptr), ...);
+    return kernel;
+}
+
+// Compile-time kernel for size x size products, or nullptr when the size has none
+template <typename T, typename Acc>
+inline BatchKernel<T, Acc> batchKernelFor(const int size) {
+    static const SimdLevel level = simdLevel();
+    return batchKernelForSize<T, Acc>(size, level, std::make_integer_sequence<int, batched_max_size / batched_size_step>{});
+}
+
+// Any other small shape - the same loop order with run-time bounds
+template <typename T, typename Acc>
+inline void smallGemmGeneric(const int m, const int k, const int n, const T *a, const T *b, Acc *c) {
+    for (int i = 0; i < m; i++) {
+        Acc *c_row = c + static_cast<std::size_t>(i) * n;
+        for (int j = 0; j < n; j++) {
+            c_row[j] = 0;
+        }
+        for (int p = 0; p < k; p++) {
+            const Acc a_ip = static_cast<Acc>(a[static_cast<std::size_t>(i) * k + p]);
+            const T *b_row = b + static_cast<std::size_t>(p) * n;
+            for (int j = 0; j < n; j++) {
+                c_row[j] += a_ip * static_cast<Acc>(b_row[j]);
+            }
+        }
+    }
+}
+
+// C[i] = A[i] * B[i] for count products of m x k by k x n matrices, the batch split between num_threads OMP threads
+// Strides are in elements - m * k, k * n and m * n for matrices stored back to back
+// Shapes larger than batched_max_size fall back to the packed GEMM one matrix at a time
+template <typename T, typename Acc>
+void batchedMultiply(const int count, const int m, const int k, const int n,
+                     const T *a, const std::size_t stride_a, const T *b, const std::size_t stride_b,
+                     Acc *c, const std::size_t stride_c, const int num_threads) {
+    const BatchKernel<T, Acc> kernel = m == k && k == n ? batchKernelFor<T, Acc>(n) : nullptr;
+    const bool large = m > batched_max_size || k > batched_max_size || n > batched_max_size;
+    [[maybe_unused]] const bool parallel = num_threads > 1 && static_cast<long long>(count) * m * k * n >= batched_parallel_threshold;
+
+    #pragma omp parallel num_threads(num_threads) if (parallel)
+    {
+#ifdef _OPENMP
+        const Range batch = balancedRange(count, omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range batch{0, count};
+#endif
+        const T *a_first = a + batch.start * stride_a;
+        const T *b_first = b + batch.start * stride_b;
+        Acc *c_first = c + batch.start * stride_c;
+
+        if (kernel != nullptr) {
+            kernel(batch.size(), a_first, stride_a, b_first, stride_b, c_first, stride_c);
+        }
+        else {
+            for (int i = 0; i < batch.size(); i++) {
+                if (large) {
+                    const BasicPackedB<T> packed_b = packB(b_first + i * stride_b, n, k, n, 1);  // Already on one thread of the batch
+                    gemmPacked(m, a_first + i * stride_a, k, packed_b, c_first + i * stride_c, n);
+                }
+                else {
+                    smallGemmGeneric(m, k, n, a_first + i * stride_a, b_first + i * stride_b, c_first + i * stride_c);
+                }
+            }
+        }
+    }
+}
+
+#endif // COMMON_BATCHED_H
@@ -0,0 +1,288 @@
+#ifndef COMMON_BENCHMARK_H
+#define COMMON_BENCHMARK_H
+
+// Timing statistics and reports for the benchmark drivers - matrix_benchmark and matrix_benchmark_mpi
+// Each configuration is run a few untimed warm-up times, then timed repeat times; the report keeps the median, the 95th
+// percentile and the minimum of those samples, the rate in GOPS (2 * m * k * n operations) and the parallel efficiency
+// against the serial baseline of the same shape
+// Reports come out as an aligned table for reading, or CSV and JSON with one record per configuration for tracking
+// regressions between runs
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "cli.h"
+
+// Comma separated values of --name, e.g. --sizes 256,512,1024 - fallback when the option is absent
+inline std::vector<std::string> listOption(const int argc, char **argv, const char *name, const std::string &fallback) {
+    std::vector<std::string> values;
+    std::stringstream list(stringOption(argc, argv, name, fallback));
+    std::string value;
+    while (std::getline(list, value, ',')) {
+        if (!value.empty()) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// Comma separated integers, e.g. --threads 1,2,4,8 - anything that is not a positive integer is an error
+inline std::vector<int> intListOption(const int argc, char **argv, const char *name, const std::string &fallback) {
+    std::vector<int> values;
+    for (const std::string &value : listOption(argc, argv, name, fallback)) {
+        std::size_t used = 0;
+        int parsed = 0;
+        try {
+            parsed = std::stoi(value, &used);
+        }
+        catch (const std::exception &) {
+            used = 0;
+        }
+        if (used != value.size() || parsed <= 0) {
+            throw std::runtime_error(std::string(name) + ": expected positive integers, got " + value);
+        }
+        values.push_back(parsed);
+    }
+    return values;
+}
+
+// Summary of the timed samples of one configuration, in microseconds
+struct BenchmarkStats {
+    double median_us = 0;
+    double p95_us = 0;
+    double min_us = 0;
+};
+
+// Nearest-rank percentiles - with few repetitions the 95th percentile is the slowest sample, as it should be
+inline BenchmarkStats benchmarkStats(std::vector<double> samples) {
+    BenchmarkStats stats;
+    if (samples.empty()) {
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    const std::size_t count = samples.size();
+    stats.median_us = count % 2 == 1 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stats.p95_us = samples[static_cast<std::size_t>(std::ceil(0.95 * count)) - 1];
+    stats.min_us = samples.front();
+    return stats;
+}
+
+// Run fn warmup times untimed, then repeat times timed - sync runs before every timed call, outside the timing,
+// so distributed drivers can line their processes up with a barrier
+template <typename Fn, typename Sync>
+std::vector<double> timeRepetitions(const int warmup, const int repeat, Fn &&fn, Sync &&sync) {
+    using clock = std::chrono::steady_clock;
+    for (int i = 0; i < warmup; i++) {
+        fn();
+    }
+    std::vector<double> samples;
+    samples.reserve(repeat);
+    for (int i = 0; i < repeat; i++) {
+        sync();
+        const clock::time_point start = clock::now();
+        fn();
+        const clock::time_point stop = clock::now();
+        samples.push_back(std::chrono::duration<double, std::micro>(stop - start).count());
+    }
+    return samples;
+}
+
+template <typename Fn>
+std::vector<double> timeRepetitions(const int warmup, const int repeat, Fn &&fn) {
+    return timeRepetitions(warmup, repeat, fn, [] {});
+}
+
+// Billions of multiply-add operations per second for C (m x n) = A (m x k) * B (k x n) in us microseconds
+inline double benchmarkGops(const int m, const int k, const int n, const double us) {
+    return us > 0 ? 2.0 * m * k * n / (us * 1e3) : 0;
+}
+
+// One configuration of a sweep
+struct BenchmarkResult {
+    std::string variant;
+    std::string type;
+    int m = 0;
+    int k = 0;
+    int n = 0;
+    int processes = 1;
+    int threads = 1;
+    int repeat = 0;
+    BenchmarkStats stats;
+    double gops = 0;
+    double efficiency = -1;  // Serial median / (processes * threads * median) - negative when there is no baseline
+    std::string verified;  // "passed" or "failed" after a Freivalds check, empty when none ran
+};
+
+// Fill in efficiency from the serial baseline of each type and shape - the results whose variant is baseline
+inline void addEfficiency(std::vector<BenchmarkResult> &results, const std::string &baseline) {
+    for (BenchmarkResult &result : results) {
+        for (const BenchmarkResult &serial : results) {
+            if (serial.variant == baseline && serial.type == result.type && serial.m == result.m && serial.k == result.k &&
+                serial.n == result.n && result.stats.median_us > 0) {
+                const int workers = result.processes * result.threads;
+                result.efficiency = serial.stats.median_us / (workers * result.stats.median_us);
+            }
+        }
+    }
+}
+
+// One result for progress output while a sweep runs
+inline std::string benchmarkLine(const BenchmarkResult &result) {
+    std::ostringstream line;
+    line << result.variant << " " << result.type << " " << result.m << "x" << result.k << "x" << result.n << " "
+         << result.processes << "p x " << result.threads << "t: median " << std::fixed << std::setprecision(0)
+         << result.stats.median_us << " us, " << std::setprecision(2) << result.gops << " GOPS";
+    if (!result.verified.empty()) {
+        line << ", " << result.verified;
+    }
+    return line.str();
+}
+
+// Values of a result in report column order - efficiency is left empty without a baseline
+inline std::vector<std::string> benchmarkFields(const BenchmarkResult &result) {
+    const auto number = [](const double value, const int precision) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(precision) << value;
+        return text.str();
+    };
+    return {result.variant, result.type, std::to_string(result.m), std::to_string(result.k), std::to_string(result.n),
+            std::to_string(result.processes), std::to_string(result.threads), std::to_string(result.repeat),
+            number(result.stats.median_us, 1), number(result.stats.p95_us, 1), number(result.stats.min_us, 1),
+            number(result.gops, 3), result.efficiency >= 0 ? number(result.efficiency, 3) : "", result.verified};
+}
+
+inline const std::vector<std::string> &benchmarkColumns() {
+    static const std::vector<std::string> columns = {"variant", "type", "m", "k", "n", "processes", "threads", "repeat",
+                                                     "median_us", "p95_us", "min_us", "gops", "efficiency", "verified"};
+    return columns;
+}
+
+// Aligned table with a header row
+inline void writeBenchmarkTable(std::ostream &out, const std::vector<BenchmarkResult> &results) {
+    const std::vector<std::string> &columns = benchmarkColumns();
+    std::vector<std::vector<std::string>> rows;
+    std::vector<std::size_t> widths;
+    for (const std::string &column : columns) {
+        widths.push_back(column.size());
+    }
+    for (const BenchmarkResult &result : results) {
+        rows.push_back(benchmarkFields(result));
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            widths[i] = std::max(widths[i], rows.back()[i].size());
+        }
+    }
+    const auto print = [&](const std::vector<std::string> &row) {
+        for (std::size_t i = 0; i < row.size(); i++) {
+            out << (i > 0 ? "  " : "") << std::setw(static_cast<int>(widths[i])) << (i < 2 ? std::left : std::right)
+                << (row[i].empty() ? "-" : row[i]);
+        }
+        out << std::right << "\n";
+    };
+    print(columns);
+    for (const std::vector<std::string> &row : rows) {
+        print(row);
+    }
+}
+
+// CSV with a header row - no field ever holds a comma or quote, so none are quoted
+inline void writeBenchmarkCsv(std::ostream &out, const std::vector<BenchmarkResult> &results) {
+    const auto print = [&](const std::vector<std::string> &row) {
+        for (std::size_t i = 0; i < row.size(); i++) {
+            out << (i > 0 ? "," : "") << row[i];
+        }
+        out << "\n";
+    };
+    print(benchmarkColumns());
+    for (const BenchmarkResult &result : results) {
+        print(benchmarkFields(result));
+    }
+}
+
+// JSON string literal
+inline std::string jsonString(const std::string &value) {
+    std::string quoted = "\"";
+    for (const char ch : value) {
+        if (ch == '"' || ch == '\\') {
+            quoted += '\\';
+            quoted += ch;
+        }
+        else if (static_cast<unsigned char>(ch) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+            quoted += escaped;
+        }
+        else {
+            quoted += ch;
+        }
+    }
+    return quoted + "\"";
+}
+
+// JSON object of run-wide context (host, micro-kernel, seed, ...) with the results as an array of records
+// Numeric columns are numbers, and an empty efficiency or verified is null
+inline void writeBenchmarkJson(std::ostream &out, const std::vector<std::pair<std::string, std::string>> &context,
+                               const std::vector<BenchmarkResult> &results) {
+    const std::vector<std::string> &columns = benchmarkColumns();
+    out << "{\n";
+    for (const std::pair<std::string, std::string> &entry : context) {
+        out << "  " << jsonString(entry.first) << ": " << jsonString(entry.second) << ",\n";
+    }
+    out << "  \"results\": [";
+    for (std::size_t r = 0; r < results.size(); r++) {
+        const std::vector<std::string> fields = benchmarkFields(results[r]);
+        out << (r > 0 ? "," : "") << "\n    {";
+        for (std::size_t i = 0; i < columns.size(); i++) {
+            const bool text = i < 2 || columns[i] == "verified";
+            const std::string value = fields[i].empty() ? "null" : text ? jsonString(fields[i]) : fields[i];
+            out << (i > 0 ? ", " : "") << jsonString(columns[i]) << ": " << value;
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Write the report in format (table, csv or json) to path, or to standard output when path is empty
+inline void writeBenchmarkReport(const std::string &format, const std::string &path,
+                                 const std::vector<std::pair<std::string, std::string>> &context,
+                                 const std::vector<BenchmarkResult> &results) {
+    std::ofstream file;
+    if (!path.empty()) {
+        file.open(path);
+        if (!file.is_open()) {
+            throw std::runtime_error(path + ": cannot open for writing");
+        }
+    }
+    std::ostream &out = path.empty() ? std::cout : file;
+    if (format == "csv") {
+        writeBenchmarkCsv(out, results);
+    }
+    else if (format == "json") {
+        writeBenchmarkJson(out, context, results);
+    }
+    else {
+        for (const std::pair<std::string, std::string> &entry : context) {
+            out << entry.first << ": " << entry.second << "\n";
+        }
+        writeBenchmarkTable(out, results);
+    }
+    out.flush();
+    if (!out) {
+        throw std::runtime_error((path.empty() ? std::string("standard output") : path) + ": write failed");
+    }
+}
+
+// Report formats writeBenchmarkReport understands
+inline bool knownBenchmarkFormat(const std::string &format) {
+    return format == "table" || format == "csv" || format == "json";
+}
+
+#endif // COMMON_BENCHMARK_H
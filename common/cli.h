@@ -0,0 +1,107 @@
+#ifndef COMMON_CLI_H
+#define COMMON_CLI_H
+
+// Minimal "--name value" command line parsing shared by the matrix programs
+// Values that don't parse, or are out of range, throw std::runtime_error naming the option - front ends catch it,
+// print the message and exit with 1
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Value following --name, or nullptr if the option is absent
+inline const char *findOption(const int argc, char **argv, const char *name) {
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0) {
+            return argv[i + 1];
+        }
+    }
+    return nullptr;
+}
+
+// Integer option, e.g. --verify 3 - the whole value must be an integer
+inline int intOption(const int argc, char **argv, const char *name, const int fallback) {
+    const char *value = findOption(argc, argv, name);
+    if (value == nullptr) {
+        return fallback;
+    }
+    std::size_t used = 0;
+    int parsed = 0;
+    try {
+        parsed = std::stoi(value, &used);
+    }
+    catch (const std::exception &) {
+        used = 0;
+    }
+    if (used == 0 || value[used] != '\0') {
+        throw std::runtime_error(std::string(name) + ": expected an integer, got " + value);
+    }
+    return parsed;
+}
+
+// Integer option of at least minimum, e.g. --repeat 10
+inline int intOptionAtLeast(const int argc, char **argv, const char *name, const int fallback, const int minimum) {
+    const int value = intOption(argc, argv, name, fallback);
+    if (value < minimum) {
+        throw std::runtime_error(std::string(name) + ": expected at least " + std::to_string(minimum) + ", got " + std::to_string(value));
+    }
+    return value;
+}
+
+// Thread count, --threads 8 - at least one
+inline int threadsOption(const int argc, char **argv, const int fallback) {
+    return intOptionAtLeast(argc, argv, "--threads", fallback, 1);
+}
+
+// Floating point option, e.g. --density 0.05 - the whole value must be a number
+inline double doubleOption(const int argc, char **argv, const char *name, const double fallback) {
+    const char *value = findOption(argc, argv, name);
+    if (value == nullptr) {
+        return fallback;
+    }
+    std::size_t used = 0;
+    double parsed = 0;
+    try {
+        parsed = std::stod(value, &used);
+    }
+    catch (const std::exception &) {
+        used = 0;
+    }
+    if (used == 0 || value[used] != '\0') {
+        throw std::runtime_error(std::string(name) + ": expected a number, got " + value);
+    }
+    return parsed;
+}
+
+// String option, e.g. --mode pipelined
+inline std::string stringOption(const int argc, char **argv, const char *name, const std::string &fallback) {
+    const char *value = findOption(argc, argv, name);
+    return value != nullptr ? std::string(value) : fallback;
+}
+
+// Flag with no value, e.g. --verbose
+inline bool flagOption(const int argc, char **argv, const char *name) {
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Matrix shape for C (m x n) = A (m x k) * B (k x n)
+// --size sets all three dimensions, --m/--k/--n override individual ones - none may be negative
+struct MatrixDims {
+    int m;
+    int k;
+    int n;
+};
+
+inline MatrixDims dimsOption(const int argc, char **argv, const int fallback) {
+    const int size = intOptionAtLeast(argc, argv, "--size", fallback, 0);
+    return MatrixDims{intOptionAtLeast(argc, argv, "--m", size, 0), intOptionAtLeast(argc, argv, "--k", size, 0),
+                      intOptionAtLeast(argc, argv, "--n", size, 0)};
+}
+
+#endif // COMMON_CLI_H
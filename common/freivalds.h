@@ -0,0 +1,271 @@
+#ifndef COMMON_FREIVALDS_H
+#define COMMON_FREIVALDS_H
+
+// Freivalds verification of a product C = A * B in O(n^2) instead of the O(n^3) of recomputing it
+// Each round draws a random 0/1 vector r and checks A * (B * r) == C * r - a wrong C passes a round with probability
+// at most 1/2, so it slips through all of R rounds with probability at most 2^-R
+// The rounds share one pass over each matrix - every row is read once and dotted with all R vectors while it is in cache
+// Integer products are checked exactly in unsigned arithmetic, which wraps the same way the multiply's accumulators do
+// Floating point products are checked in double against a tolerance scaled by k, machine epsilon and |A| * (|B| * r)
+// The core works on blocks of the matrices and takes the reduction as a parameter, so freivalds_mpi.h reuses it for
+// distributed layouts - freivaldsVerify below is the single-node check
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "matrix.h"
+#include "microkernels.h"
+#include "partition.h"
+#include "random.h"
+
+// Stream of the random vectors - separate from the matrix_a_stream and matrix_b_stream inputs of the same seed
+constexpr std::uint64_t freivalds_stream = 3;
+
+// Floating point rounds fail when some |A * (B * r) - C * r| exceeds this many k * epsilon * max |A| * (|B| * r)
+// k * epsilon * |A| * |B| bounds the rounding error of any classical summation order, and the maximum over rows makes
+// the test normwise so Strassen's looser per-element error doesn't raise false alarms - both measure far below it
+constexpr double freivalds_tolerance = 1.0;
+
+// Arithmetic of the check - unsigned wrap-around for integer accumulators, double for floating point ones
+template <typename Acc, bool = std::is_floating_point_v<Acc>>
+struct FreivaldsArithmetic {
+    using type = double;
+};
+
+template <typename Acc>
+struct FreivaldsArithmetic<Acc, false> {
+    using type = std::make_unsigned_t<Acc>;
+};
+
+// Outcome of a verification
+struct FreivaldsResult {
+    int rounds = 0;
+    int failed_rounds = 0;  // Rounds in which some row of A * (B * r) differed from C * r
+    long long bad_rows = 0;  // Rows that differed in at least one round
+
+    bool passed() const { return failed_rounds == 0; }
+};
+
+// One-line summary for program output
+inline std::string freivaldsSummary(const FreivaldsResult &result) {
+    if (result.passed()) {
+        return "passed " + std::to_string(result.rounds) + " rounds";
+    }
+    return "FAILED " + std::to_string(result.failed_rounds) + " of " + std::to_string(result.rounds) + " rounds, " +
+           std::to_string(result.bad_rows) + " rows differ";
+}
+
+// Rows rows and columns cols of a matrix, row-major with cols.size() values per row - the part one process holds
+template <typename T>
+struct MatrixBlock {
+    const T *values;
+    Range rows;
+    Range cols;
+};
+
+// Whole rows x cols matrix as a block
+template <typename T>
+inline MatrixBlock<T> wholeBlock(const T *values, const int rows, const int cols) {
+    return MatrixBlock<T>{values, Range{0, rows}, Range{0, cols}};
+}
+
+// Dot products of one row with the vector of every round - and of its magnitudes with x_abs when that is set
+// x and x_abs start at the row's first column, and the vectors of consecutive rounds are x_stride apart
+template <typename V, typename T>
+using FreivaldsRowKernel = void (*)(const T *row, int width, const V *x, const V *x_abs, std::size_t x_stride, int rounds,
+                                    V *sums, V *abs_sums);
+
+template <typename V, typename T>
+__attribute__((always_inline))
+inline void freivaldsRowBody(const T *row, const int width, const V *x, const V *x_abs, const std::size_t x_stride,
+                             const int rounds, V *sums, V *abs_sums) {
+    for (int r = 0; r < rounds; r++) {
+        const V *x_r = x + r * x_stride;
+        V sum = 0;
+        if (x_abs == nullptr) {
+#ifdef _OPENMP
+            #pragma omp simd reduction(+ : sum)
+#endif
+            for (int p = 0; p < width; p++) {
+                sum += static_cast<V>(row[p]) * x_r[p];
+            }
+        }
+        else {
+            // Magnitudes come from the same read of the row
+            const V *x_abs_r = x_abs + r * x_stride;
+            V abs_sum = 0;
+#ifdef _OPENMP
+            #pragma omp simd reduction(+ : sum, abs_sum)
+#endif
+            for (int p = 0; p < width; p++) {
+                sum += static_cast<V>(row[p]) * x_r[p];
+                abs_sum += static_cast<V>(std::abs(row[p])) * x_abs_r[p];
+            }
+            abs_sums[r] = abs_sum;
+        }
+        sums[r] = sum;
+    }
+}
+
+template <typename V, typename T>
+inline void freivaldsRowScalar(const T *row, const int width, const V *x, const V *x_abs, const std::size_t x_stride,
+                               const int rounds, V *sums, V *abs_sums) {
+    freivaldsRowBody(row, width, x, x_abs, x_stride, rounds, sums, abs_sums);
+}
+
+#ifdef GEMM_HAVE_X86_KERNELS
+
+template <typename V, typename T>
+__attribute__((target("avx2,fma")))
+inline void freivaldsRowAvx2(const T *row, const int width, const V *x, const V *x_abs, const std::size_t x_stride,
+                             const int rounds, V *sums, V *abs_sums) {
+    freivaldsRowBody(row, width, x, x_abs, x_stride, rounds, sums, abs_sums);
+}
+
+template <typename V, typename T>
+__attribute__((target("avx512f")))
+inline void freivaldsRowAvx512(const T *row, const int width, const V *x, const V *x_abs, const std::size_t x_stride,
+                               const int rounds, V *sums, V *abs_sums) {
+    freivaldsRowBody(row, width, x, x_abs, x_stride, rounds, sums, abs_sums);
+}
+
+#endif // GEMM_HAVE_X86_KERNELS
+
+// Row kernel for the instruction set simdLevel() picked
+template <typename V, typename T>
+inline FreivaldsRowKernel<V, T> freivaldsRowKernel() {
+    static const SimdLevel level = simdLevel();
+#ifdef GEMM_HAVE_X86_KERNELS
+    if (level == SimdLevel::avx512) return freivaldsRowAvx512<V, T>;
+    if (level == SimdLevel::avx2) return freivaldsRowAvx2<V, T>;
+#endif
+    return freivaldsRowScalar<V, T>;
+}
+
+// out[r][i] += sign * (block row i) . x[r] for every round r and block row i, and out_abs[r][i] += |block row i| . x_abs[r]
+// when x_abs is set - x and out hold rounds vectors of x_len and out_len back to back, indexed by position in the full
+// matrix, and the rows are split between num_threads OMP threads
+template <typename V, typename T>
+void freivaldsProduct(const MatrixBlock<T> &block, const V *x, const V *x_abs, const int x_len, V *out, V *out_abs, const int out_len,
+                      const int rounds, const V sign, [[maybe_unused]] const int num_threads) {
+    const FreivaldsRowKernel<V, T> kernel = freivaldsRowKernel<V, T>();
+    const int width = block.cols.size();
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1 && block.rows.size() > 1)
+#endif
+    {
+        std::vector<V> sums(rounds), abs_sums(rounds);
+#ifdef _OPENMP
+        #pragma omp for schedule(static)
+#endif
+        for (int i = block.rows.start; i < block.rows.end; i++) {
+            const T *row = block.values + static_cast<std::size_t>(i - block.rows.start) * width;
+            kernel(row, width, x + block.cols.start, x_abs != nullptr ? x_abs + block.cols.start : nullptr, x_len, rounds,
+                   sums.data(), abs_sums.data());
+            for (int r = 0; r < rounds; r++) {
+                out[static_cast<std::size_t>(r) * out_len + i] += sign * sums[r];
+                if (x_abs != nullptr) {
+                    out_abs[static_cast<std::size_t>(r) * out_len + i] += abs_sums[r];
+                }
+            }
+        }
+    }
+}
+
+// Random 0/1 vectors of rounds rounds, n values each back to back - the same on every caller since they come from the seed
+template <typename V>
+std::vector<V> freivaldsVectors(const int rounds, const int n, const std::uint64_t seed) {
+    const CounterRng rng(seed, freivalds_stream);
+    std::vector<V> r(static_cast<std::size_t>(rounds) * n);
+    for (std::size_t i = 0; i < r.size(); i++) {
+        r[i] = static_cast<V>(rng(i) >> 63);
+    }
+    return r;
+}
+
+// Result from the reduced diff = A * (B * r) - C * r of every round (m values each), and for floating point
+// accumulators scale = |A| * (|B| * r), which sets each round's tolerance
+template <typename Acc, typename V>
+FreivaldsResult freivaldsCompare(const int m, const int k, const int rounds, const std::vector<V> &diff, const std::vector<V> &scale) {
+    constexpr bool floating = std::is_floating_point_v<Acc>;
+    FreivaldsResult result;
+    result.rounds = rounds;
+    std::vector<char> bad(m, 0);
+    for (int round = 0; round < rounds; round++) {
+        const V *d = diff.data() + static_cast<std::size_t>(round) * m;
+        V limit = 0;
+        if constexpr (floating) {
+            const V *s = scale.data() + static_cast<std::size_t>(round) * m;
+            const V largest = m > 0 ? *std::max_element(s, s + m) : 0;
+            limit = freivalds_tolerance * k * std::numeric_limits<Acc>::epsilon() * largest;
+        }
+        bool failed = false;
+        for (int i = 0; i < m; i++) {
+            bool differs;
+            if constexpr (floating) {
+                differs = !(std::abs(d[i]) <= limit);  // NaN fails too
+            }
+            else {
+                differs = d[i] != 0;
+            }
+            if (differs) {
+                failed = true;
+                bad[i] = 1;
+            }
+        }
+        result.failed_rounds += failed ? 1 : 0;
+    }
+    result.bad_rows = std::count(bad.begin(), bad.end(), 1);
+    return result;
+}
+
+// Verify the blocks of C (m x n) = A (m x k) * B (k x n) that this caller holds
+// reduce(vector) sums a vector over every holder of blocks - each element of A, B and C must be held exactly once
+// Every caller gets the same result, since the comparison runs on the reduced vectors
+template <typename T, typename Acc, typename Reduce>
+FreivaldsResult freivaldsBlocks(const int m, const int k, const int n, const MatrixBlock<T> &a, const MatrixBlock<T> &b,
+                                const MatrixBlock<Acc> &c, const int rounds, const std::uint64_t seed, const int num_threads, Reduce reduce) {
+    using V = typename FreivaldsArithmetic<Acc>::type;
+    constexpr bool floating = std::is_floating_point_v<Acc>;
+    const V plus = 1;
+    const V minus = plus - 2;  // -1, or 2^bits - 1 for unsigned - both negate
+
+    // Random 0/1 vectors, the same on every caller since they come from the seed
+    const std::vector<V> r = freivaldsVectors<V>(rounds, n, seed);
+
+    // y = B * r, then diff = A * y - C * r - floating point checks track |B| * r and |A| * (|B| * r) alongside
+    std::vector<V> y(static_cast<std::size_t>(rounds) * k, 0);
+    std::vector<V> y_abs(floating ? y.size() : 0, 0);
+    freivaldsProduct(b, r.data(), floating ? r.data() : nullptr, n, y.data(), y_abs.data(), k, rounds, plus, num_threads);
+    reduce(y);
+    if (floating) {
+        reduce(y_abs);
+    }
+
+    std::vector<V> diff(static_cast<std::size_t>(rounds) * m, 0);
+    std::vector<V> scale(floating ? diff.size() : 0, 0);
+    freivaldsProduct(a, y.data(), floating ? y_abs.data() : nullptr, k, diff.data(), scale.data(), m, rounds, plus, num_threads);
+    freivaldsProduct(c, r.data(), static_cast<const V *>(nullptr), n, diff.data(), static_cast<V *>(nullptr), m, rounds, minus, num_threads);
+    reduce(diff);
+    if (floating) {
+        reduce(scale);
+    }
+
+    // Compare on the reduced vectors
+    return freivaldsCompare<Acc>(m, k, rounds, diff, scale);
+}
+
+// Verify C = A * B on one node with rounds random vectors, split between num_threads OMP threads
+template <typename T, typename Acc>
+FreivaldsResult freivaldsVerify(const BasicMatrix<T> &a, const BasicMatrix<T> &b, const BasicMatrix<Acc> &c,
+                                const int rounds, const std::uint64_t seed, const int num_threads = 1) {
+    return freivaldsBlocks(a.rows, a.cols, b.cols, wholeBlock(a.data(), a.rows, a.cols), wholeBlock(b.data(), b.rows, b.cols),
+                           wholeBlock(c.data(), c.rows, c.cols), rounds, seed, num_threads, [](std::vector<typename FreivaldsArithmetic<Acc>::type> &) {});
+}
+
+#endif // COMMON_FREIVALDS_H
@@ -0,0 +1,36 @@
+#ifndef COMMON_FREIVALDS_MPI_H
+#define COMMON_FREIVALDS_MPI_H
+
+// Freivalds verification of a distributed product - each process passes the blocks of A, B and C it holds
+// The partial products are summed with MPI_Allreduce, only rounds vectors of k and of m values, so the check costs
+// O(n^2 / p) per process plus that and every process ends with the same result
+// Every element must be passed by exactly one process - a replicated B is passed as a share of its rows per process,
+// or whole by one process
+
+#include <mpi.h>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "freivalds.h"
+
+// MPI datatype of the check's arithmetic
+template <typename V>
+inline MPI_Datatype freivaldsMpiType() {
+    if constexpr (std::is_same_v<V, double>) return MPI_DOUBLE;
+    else if constexpr (sizeof(V) == 8) return MPI_UINT64_T;
+    else if constexpr (sizeof(V) == 4) return MPI_UINT32_T;
+    else static_assert(sizeof(V) == 0, "no MPI datatype for this accumulator");
+}
+
+// Verify C (m x n) = A (m x k) * B (k x n) over comm with rounds random vectors - collective, every process gets the result
+template <typename T, typename Acc>
+FreivaldsResult mpiFreivaldsVerify(MPI_Comm comm, const int m, const int k, const int n, const MatrixBlock<T> &a,
+                                   const MatrixBlock<T> &b, const MatrixBlock<Acc> &c, const int rounds,
+                                   const std::uint64_t seed, const int num_threads = 1) {
+    using V = typename FreivaldsArithmetic<Acc>::type;
+    return freivaldsBlocks(m, k, n, a, b, c, rounds, seed, num_threads, [comm](std::vector<V> &values) {
+        MPI_Allreduce(MPI_IN_PLACE, values.data(), static_cast<int>(values.size()), freivaldsMpiType<V>(), MPI_SUM, comm);
+    });
+}
+
+#endif // COMMON_FREIVALDS_MPI_H
@@ -0,0 +1,228 @@
+#ifndef COMMON_GEMM_H
+#define COMMON_GEMM_H
+
+// Cache-blocked, packed matrix multiplication kernel shared by all the CPU matrix programs
+// B is packed once per multiply into micro-panels, then each front end splits the rows of C
+// however it likes (row slice, OMP loop, MPI partition) and calls gemmPacked on its slice
+// Everything is templated on the element type T of A and B and the accumulator type Acc of C,
+// both deduced from the pointers passed in - int/int keeps the original behaviour
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "matrix.h"
+#include "microkernels.h"
+#include "partition.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Cache block sizes in elements, sized for int32 - narrower elements leave the blocks proportionally smaller
+// block_k x gemm_nr panel of packed B (256 x 16 ints = 16KB) streams through L1 for each micro-kernel call
+// block_m x block_k block of packed A (96 x 256 ints = 96KB) stays in L2 while it is reused across a column panel
+// block_k x block_n block of packed B (256 x 2048 ints = 2MB) stays in L3 while it is reused by every row block
+constexpr int block_m = 16 * gemm_mr;
+constexpr int block_k = 256;
+constexpr int block_n = 128 * gemm_nr;
+
+// B (k x n) reordered into micro-panels
+// For each block_k slice of rows, every group of gemm_nr columns is stored as a kc x gemm_nr panel,
+// so the micro-kernel reads B contiguously instead of striding down a column
+// Columns are zero padded up to a multiple of gemm_nr
+template <typename T>
+struct BasicPackedB {
+    int rows = 0;  // k
+    int cols = 0;  // n
+    int padded_cols = 0;  // n rounded up to a multiple of gemm_nr
+    BasicMatrix<T> storage;  // Owns the panels - rows x padded_cols elements
+    const T *values = nullptr;
+
+    // Start of the panel holding columns [panel * gemm_nr, panel * gemm_nr + gemm_nr) for the slice starting at row kk
+    const T *panel(const int kk, const int panel) const {
+        const int kc = std::min(block_k, rows - kk);
+        return values + static_cast<std::size_t>(kk) * padded_cols + static_cast<std::size_t>(panel) * kc * gemm_nr;
+    }
+};
+
+using PackedB = BasicPackedB<int>;
+
+// Columns of b padded up to a whole number of panels
+inline int packedCols(const int n) {
+    return (n + gemm_nr - 1) / gemm_nr * gemm_nr;
+}
+
+// Pack a k x n row-major buffer with leading dimension ldb into dest (k * packedCols(n) elements)
+// The panels are split between num_threads OMP threads - 1 packs on the calling thread alone
+template <typename T>
+inline void packBInto(const T *b, const int ldb, const int k, const int n, T *dest, [[maybe_unused]] const int num_threads) {
+    const int panels = packedCols(n) / gemm_nr;
+    for (int kk = 0; kk < k; kk += block_k) {
+        const int kc = std::min(block_k, k - kk);
+        T *slice = dest + static_cast<std::size_t>(kk) * panels * gemm_nr;
+        // Panels are independent, so packing parallelises cleanly when built with OpenMP
+        #pragma omp parallel for schedule(static) num_threads(num_threads) if (num_threads > 1)
+        for (int q = 0; q < panels; q++) {
+            T *out = slice + static_cast<std::size_t>(q) * kc * gemm_nr;
+            const int j0 = q * gemm_nr;
+            const int nr = std::min(gemm_nr, n - j0);
+            for (int p = 0; p < kc; p++) {
+                const T *b_row = b + static_cast<std::size_t>(kk + p) * ldb + j0;
+                for (int j = 0; j < nr; j++) {
+                    out[p * gemm_nr + j] = b_row[j];
+                }
+                for (int j = nr; j < gemm_nr; j++) {
+                    out[p * gemm_nr + j] = 0;
+                }
+            }
+        }
+    }
+}
+
+// Pack a k x n row-major buffer into newly allocated panels
+template <typename T>
+inline BasicPackedB<T> packB(const T *b, const int ldb, const int k, const int n, const int num_threads) {
+    BasicPackedB<T> packed;
+    packed.rows = k;
+    packed.cols = n;
+    packed.padded_cols = packedCols(n);
+    packed.storage = BasicMatrix<T>(k, packed.padded_cols, uninitialized);  // Every element is packed, padding included
+    packed.values = packed.storage.data();
+    packBInto(b, ldb, k, n, packed.storage.data(), num_threads);
+    return packed;
+}
+
+template <typename T>
+inline BasicPackedB<T> packB(const BasicMatrix<T> &b, const int num_threads) {
+    return packB(b.data(), b.cols, b.rows, b.cols, num_threads);
+}
+
+// Repack a different k x n buffer into an existing PackedB, only reallocating when it needs more room
+// Used by loops that multiply a sequence of panels, so each step does not allocate
+template <typename T>
+inline void repackB(BasicPackedB<T> &packed, const T *b, const int ldb, const int k, const int n, const int num_threads) {
+    const int padded = packedCols(n);
+    if (packed.storage.size() < static_cast<std::size_t>(k) * padded) {
+        packed.storage = BasicMatrix<T>(k, padded, uninitialized);
+    }
+    packed.rows = k;
+    packed.cols = n;
+    packed.padded_cols = padded;
+    packed.values = packed.storage.data();
+    packBInto(b, ldb, k, n, packed.storage.data(), num_threads);
+}
+
+// Pack an mc x kc block of A into gemm_mr row panels - each panel is kc x gemm_mr, rows zero padded
+template <typename T>
+inline void packA(const T *a, const int lda, const int mc, const int kc, T *dest) {
+    for (int ir = 0; ir < mc; ir += gemm_mr) {
+        const int mr = std::min(gemm_mr, mc - ir);
+        T *out = dest + static_cast<std::size_t>(ir) * kc;
+        for (int p = 0; p < kc; p++) {
+            for (int i = 0; i < mr; i++) {
+                out[p * gemm_mr + i] = a[static_cast<std::size_t>(ir + i) * lda + p];
+            }
+            for (int i = mr; i < gemm_mr; i++) {
+                out[p * gemm_mr + i] = 0;
+            }
+        }
+    }
+}
+
+// C[0:m, col_start:col_end] = A[0:m, 0:k] * B[:, col_start:col_end] on row-major A and C with leading dimensions lda and ldc
+// col_start must be a multiple of gemm_nr so the tile lines up with the packed panels of B
+// B must already be packed - the same PackedB is shared by every caller working on the same product
+// With accumulate = true the product is added to C instead of overwriting it (C += A * B)
+template <typename T, typename Acc>
+inline void gemmPackedTile(const int m, const T *a, const int lda, const BasicPackedB<T> &b, Acc *c, const int ldc,
+                           const int col_start, const int col_end, const bool accumulate = false) {
+    const int k = b.rows;
+    const MicroKernel<T, Acc> kernel = microKernelFor<T, Acc>();
+
+    // Packed A block is private to the calling thread and reused across calls
+    thread_local BasicMatrix<T> packed_a(block_m, block_k);
+
+    for (int jj = col_start; jj < col_end; jj += block_n) {  // Column block of B kept in L3
+        const int j_end = std::min(jj + block_n, col_end);
+        for (int kk = 0; kk < k; kk += block_k) {  // Slice of the shared dimension
+            const int kc = std::min(block_k, k - kk);
+            for (int ii = 0; ii < m; ii += block_m) {  // Row block of A kept in L2
+                const int mc = std::min(block_m, m - ii);
+                packA(a + static_cast<std::size_t>(ii) * lda + kk, lda, mc, kc, packed_a.data());
+
+                for (int jr = jj; jr < j_end; jr += gemm_nr) {  // Panel of B kept in L1
+                    const T *b_panel = b.panel(kk, jr / gemm_nr);
+                    const int nr = std::min(gemm_nr, j_end - jr);
+                    for (int ir = 0; ir < mc; ir += gemm_mr) {  // Register tile via the dispatched micro-kernel
+                        kernel(kc, packed_a.data() + static_cast<std::size_t>(ir) * kc, b_panel,
+                               c + static_cast<std::size_t>(ii + ir) * ldc + jr, ldc,
+                               std::min(gemm_mr, mc - ir), nr, accumulate || kk > 0);
+                    }
+                }
+            }
+        }
+    }
+
+    // An empty shared dimension still defines C as zero
+    if (k == 0 && !accumulate) {
+        for (int i = 0; i < m; i++) {
+            std::fill(c + static_cast<std::size_t>(i) * ldc + col_start, c + static_cast<std::size_t>(i) * ldc + col_end, Acc(0));
+        }
+    }
+}
+
+// C[0:m, 0:n] = A[0:m, 0:k] * B over every column of the packed B (or C += A * B with accumulate = true)
+template <typename T, typename Acc>
+inline void gemmPacked(const int m, const T *a, const int lda, const BasicPackedB<T> &b, Acc *c, const int ldc,
+                       const bool accumulate = false) {
+    gemmPackedTile(m, a, lda, b, c, ldc, 0, b.cols, accumulate);
+}
+
+// gemmPacked with the rows split into balanced slices between num_threads OMP threads
+// Runs on the calling thread alone when num_threads is 1 or the program is built without OpenMP
+template <typename T, typename Acc>
+inline void gemmPackedThreads(const int m, const T *a, const int lda, const BasicPackedB<T> &b, Acc *c, const int ldc,
+                              [[maybe_unused]] const int num_threads, const bool accumulate = false) {
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const Range rows = balancedRange(m, omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range rows{0, m};
+#endif
+        gemmPacked(rows.size(), a + static_cast<std::size_t>(rows.start) * lda, lda, b,
+                   c + static_cast<std::size_t>(rows.start) * ldc, ldc, accumulate);
+    }
+}
+
+// Multiply rows [row_start, row_end) of a by the packed b into the same rows of c
+template <typename T, typename Acc>
+inline void multiplyPacked(const BasicMatrix<T> &a, const BasicPackedB<T> &b, BasicMatrix<Acc> &c, const int row_start, const int row_end) {
+    gemmPacked(row_end - row_start, a.row(row_start), a.cols, b, c.row(row_start), c.cols);
+}
+
+// Stand-in value for a type, so a generic lambda can be called once per element/accumulator pair
+template <typename T>
+struct TypeTag {
+    using type = T;
+};
+
+// Call f(TypeTag<T>{}, TypeTag<Acc>{}) for the pair named by a --type option
+// int8 and int16 accumulate in int32, int32:int64 and float:double widen the accumulator, the rest match the elements
+// Returns false for an unknown name
+template <typename F>
+inline bool withGemmTypes(const std::string &name, F &&f) {
+    if (name == "int8") f(TypeTag<std::int8_t>{}, TypeTag<std::int32_t>{});
+    else if (name == "int16") f(TypeTag<std::int16_t>{}, TypeTag<std::int32_t>{});
+    else if (name == "int32") f(TypeTag<std::int32_t>{}, TypeTag<std::int32_t>{});
+    else if (name == "int32:int64") f(TypeTag<std::int32_t>{}, TypeTag<std::int64_t>{});
+    else if (name == "int64") f(TypeTag<std::int64_t>{}, TypeTag<std::int64_t>{});
+    else if (name == "float") f(TypeTag<float>{}, TypeTag<float>{});
+    else if (name == "float:double") f(TypeTag<float>{}, TypeTag<double>{});
+    else if (name == "double") f(TypeTag<double>{}, TypeTag<double>{});
+    else return false;
+    return true;
+}
+
+#endif // COMMON_GEMM_H
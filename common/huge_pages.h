@@ -0,0 +1,283 @@
+#ifndef COMMON_HUGE_PAGES_H
+#define COMMON_HUGE_PAGES_H
+
+// Huge-page backed allocation for the large dense buffers - matrices, packed panels, workspaces and sort vectors
+// A 1024 x 1024 int matrix spans 1024 4 KiB pages but only two 2 MiB pages, so walking it misses the dTLB far less
+// Buffers of at least one huge page are mapped 2 MiB aligned and either advised to transparent huge pages
+// (madvise(MADV_HUGEPAGE)) or taken from the hugetlbfs pool (MAP_HUGETLB), falling back to THP and then to ordinary
+// aligned_alloc when the kernel says no; smaller buffers always use aligned_alloc
+// The mode is process-wide - set it from --huge-pages off|thp|hugetlb before allocating (thp by default)
+// Huge pages are first-touched whole, so a parallel first-touch fill places memory on nodes in 2 MiB units
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cli.h"
+
+enum class HugePageMode { off, thp, hugetlb };
+
+inline const char *hugePageModeName(const HugePageMode mode) {
+    static const char *names[] = {"off", "thp", "hugetlb"};
+    return names[static_cast<int>(mode)];
+}
+
+// --huge-pages off|thp|hugetlb, thp when absent
+inline HugePageMode hugePagesOption(const int argc, char **argv) {
+    const std::string value = stringOption(argc, argv, "--huge-pages", "thp");
+    for (const HugePageMode mode : {HugePageMode::off, HugePageMode::thp, HugePageMode::hugetlb}) {
+        if (value == hugePageModeName(mode)) {
+            return mode;
+        }
+    }
+    throw std::runtime_error("Unknown --huge-pages " + value + " - expected off, thp or hugetlb");
+}
+
+// Default huge page size from /proc/meminfo - 2 MiB when it can't be read
+inline std::size_t hugePageSize() {
+    static const std::size_t size = [] {
+        std::size_t kib = 2048;
+        if (std::FILE *file = std::fopen("/proc/meminfo", "r")) {
+            char line[256];
+            while (std::fgets(line, sizeof(line), file) != nullptr) {
+                if (std::sscanf(line, "Hugepagesize: %zu kB", &kib) == 1) {
+                    break;
+                }
+            }
+            std::fclose(file);
+        }
+        return kib * 1024;
+    }();
+    return size;
+}
+
+// Ordinary page size
+inline std::size_t basePageSize() {
+    return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Process-wide allocation state - the mode, and every live mapping so freeing knows how a pointer was allocated
+struct HugePageState {
+    std::atomic<HugePageMode> mode{HugePageMode::thp};
+    std::mutex lock;
+    std::map<void *, std::size_t> mappings;  // Start -> length of each mmap'd buffer
+
+    static HugePageState &instance() {
+        static HugePageState state;
+        return state;
+    }
+};
+
+inline void setHugePageMode(const HugePageMode mode) {
+    HugePageState::instance().mode = mode;
+}
+
+inline HugePageMode hugePageMode() {
+    return HugePageState::instance().mode;
+}
+
+// Map bytes from the hugetlbfs pool - nullptr when the pool is empty or missing
+inline void *mapHugetlb(const std::size_t bytes, std::size_t &length) {
+    const std::size_t huge = hugePageSize();
+    length = (bytes + huge - 1) / huge * huge;
+    void *ptr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+// Map bytes on a huge page boundary and advise transparent huge pages - over-maps by one huge page and trims
+// the unaligned ends, so every whole 2 MiB of the buffer can be backed by one huge page
+inline void *mapThp(const std::size_t bytes, std::size_t &length) {
+    const std::size_t huge = hugePageSize();
+    length = (bytes + huge - 1) / huge * huge;
+    void *raw = mmap(nullptr, length + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return nullptr;
+    }
+    char *start = static_cast<char *>(raw);
+    char *aligned = reinterpret_cast<char *>((reinterpret_cast<std::uintptr_t>(start) + huge - 1) / huge * huge);
+    if (aligned > start) {
+        munmap(start, aligned - start);
+    }
+    if (start + length + huge > aligned + length) {
+        munmap(aligned + length, start + length + huge - (aligned + length));
+    }
+    madvise(aligned, length, MADV_HUGEPAGE);  // Only advice - a kernel with THP disabled leaves ordinary pages
+    return aligned;
+}
+
+// Allocate bytes aligned to alignment (at most a page) - from huge pages when the mode and size allow
+// The memory is untouched, so the first write to each page decides its NUMA node; release with freeBytes
+inline void *allocBytes(const std::size_t bytes, const std::size_t alignment) {
+    HugePageState &state = HugePageState::instance();
+    const HugePageMode mode = state.mode;
+    if (mode != HugePageMode::off && bytes >= hugePageSize()) {
+        std::size_t length = 0;
+        void *ptr = mode == HugePageMode::hugetlb ? mapHugetlb(bytes, length) : nullptr;
+        if (ptr == nullptr) {  // THP as well when the hugetlbfs pool has nothing to give
+            ptr = mapThp(bytes, length);
+        }
+        if (ptr != nullptr) {
+            std::lock_guard<std::mutex> guard(state.lock);
+            state.mappings[ptr] = length;
+            return ptr;
+        }
+    }
+    // aligned_alloc needs the byte size to be a multiple of the alignment
+    const std::size_t padded = (bytes + alignment - 1) / alignment * alignment;
+    void *ptr = std::aligned_alloc(alignment, padded > 0 ? padded : alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+// Release memory from allocBytes, however it was allocated
+inline void freeBytes(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    HugePageState &state = HugePageState::instance();
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        const auto mapping = state.mappings.find(ptr);
+        if (mapping != state.mappings.end()) {
+            munmap(mapping->first, mapping->second);
+            state.mappings.erase(mapping);
+            return;
+        }
+    }
+    std::free(ptr);
+}
+
+// Allocator for the sort vectors, e.g. std::vector<int, HugePageAllocator<int>>
+// Elements are default-initialised, so HugeVector<int>(n) leaves its pages untouched for the threads that fill it
+template <typename T>
+struct HugePageAllocator {
+    using value_type = T;
+
+    HugePageAllocator() = default;
+    template <typename U>
+    HugePageAllocator(const HugePageAllocator<U> &) {}
+
+    T *allocate(const std::size_t count) { return static_cast<T *>(allocBytes(count * sizeof(T), 64)); }  // Cache line aligned below the huge page size
+    void deallocate(T *ptr, std::size_t) { freeBytes(ptr); }
+
+    // No value-initialisation for vector(n) and resize(n) - every other construction is forwarded as usual
+    template <typename U>
+    void construct(U *ptr) { ::new (static_cast<void *>(ptr)) U; }
+    template <typename U, typename... Args>
+    void construct(U *ptr, Args &&...args) { ::new (static_cast<void *>(ptr)) U(std::forward<Args>(args)...); }
+
+    template <typename U>
+    bool operator==(const HugePageAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const HugePageAllocator<U> &) const { return false; }
+};
+
+template <typename T>
+using HugeVector = std::vector<T, HugePageAllocator<T>>;
+
+// Pages backing a buffer as the kernel sees them, from the /proc/self/smaps entries it overlaps
+struct PageBacking {
+    std::size_t page_size = 0;  // KernelPageSize - the hugetlbfs page size for MAP_HUGETLB mappings
+    std::size_t bytes = 0;  // Size of the mappings overlapped
+    std::size_t huge_bytes = 0;  // Of which backed by transparent huge pages (AnonHugePages) or hugetlbfs
+};
+
+inline PageBacking pageBacking(const void *buffer, const std::size_t bytes) {
+    PageBacking backing;
+    std::FILE *file = std::fopen("/proc/self/smaps", "r");
+    if (file == nullptr || bytes == 0) {
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+        return backing;
+    }
+    const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(buffer);
+    const std::uintptr_t last = first + bytes;
+    bool inside = false;
+    char line[512];
+    while (std::fgets(line, sizeof(line), file) != nullptr) {
+        unsigned long start, end;
+        std::size_t kib;
+        // Mapping headers start "start-end perms ...", the fields under them "Name: value kB"
+        if (std::sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            inside = start < last && end > first;
+            if (inside) {
+                backing.bytes += end - start;
+            }
+        }
+        else if (inside && std::sscanf(line, "KernelPageSize: %zu kB", &kib) == 1) {
+            backing.page_size = std::max(backing.page_size, kib * 1024);
+        }
+        else if (inside && (std::sscanf(line, "AnonHugePages: %zu kB", &kib) == 1 ||
+                            std::sscanf(line, "Private_Hugetlb: %zu kB", &kib) == 1)) {
+            backing.huge_bytes += kib * 1024;
+        }
+    }
+    std::fclose(file);
+    return backing;
+}
+
+// Size in B, KiB, MiB or GiB
+inline std::string byteSize(const std::size_t bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024 && unit < 3) {
+        value /= 1024;
+        unit++;
+    }
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(value == static_cast<long long>(value) ? 0 : 1);
+    out << value << " " << units[unit];
+    return out.str();
+}
+
+// One-line description of the pages behind a buffer, e.g. "2 MiB pages (THP), 4 MiB of 4 MiB huge"
+// Read after the buffer is written - THP only backs pages once they are touched
+inline std::string pageSizeSummary(const void *buffer, const std::size_t bytes) {
+    std::ostringstream out;
+    if (bytes < hugePageSize()) {  // Never mapped for huge pages
+        out << byteSize(basePageSize()) << " pages (below huge page size)";
+        return out.str();
+    }
+    const PageBacking backing = pageBacking(buffer, bytes);
+    if (backing.bytes == 0) {  // No smaps to read
+        out << "unknown pages";
+        return out.str();
+    }
+    // hugetlbfs mappings report their page size directly, THP shows up as AnonHugePages under 4 KiB mappings
+    const bool hugetlb = backing.page_size > basePageSize();
+    const bool thp = !hugetlb && backing.huge_bytes > 0;
+    out << byteSize(hugetlb ? backing.page_size : thp ? hugePageSize() : basePageSize()) << " pages ("
+        << (hugetlb ? "hugetlbfs" : thp ? "THP" : "no huge pages") << "), "
+        << byteSize(backing.huge_bytes) << " of " << byteSize(backing.bytes) << " huge";
+    return out.str();
+}
+
+// Pages a buffer of bytes gets under the current mode - allocated, touched, summarised and freed again
+// For reports on buffers that live inside a callee, e.g. the per-variant matrices of the MPI benchmark
+inline std::string pageSizeProbe(const std::size_t bytes) {
+    void *buffer = allocBytes(bytes, 64);
+    std::memset(buffer, 0, bytes);
+    const std::string summary = pageSizeSummary(buffer, bytes);
+    freeBytes(buffer);
+    return summary;
+}
+
+#endif // COMMON_HUGE_PAGES_H
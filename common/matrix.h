@@ -0,0 +1,102 @@
+#ifndef COMMON_MATRIX_H
+#define COMMON_MATRIX_H
+
+// Shared dense matrix type used by the matrix multiplication programs
+// Header only - include with a relative path, e.g. #include "../../common/matrix.h"
+
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include "huge_pages.h"
+
+// Alignment for matrix buffers in bytes - one cache line, also suits 512-bit vector loads
+constexpr std::size_t matrix_alignment = 64;
+
+// Allocate an aligned block of count elements - blocks of a huge page or more come from huge pages, 2 MiB aligned
+// Release with freeBytes
+template <typename T = int>
+inline T *allocAligned(const std::size_t count) {
+    return static_cast<T *>(allocBytes(count * sizeof(T), matrix_alignment));
+}
+
+// Tag for a matrix whose elements are left unset - see BasicMatrix(rows, cols, uninitialized)
+struct Uninitialized {};
+constexpr Uninitialized uninitialized{};
+
+// Row-major matrix stored in one contiguous, aligned buffer
+// Replaces vector<vector<int> >, where every row was a separate heap allocation
+// The element type is a template parameter (int8_t up to double) - Matrix is the int matrix used by most programs
+// A matrix can also borrow memory it does not own (e.g. a memory-mapped file), which it never frees
+template <typename T>
+struct BasicMatrix {
+    using value_type = T;
+
+    int rows = 0;
+    int cols = 0;
+    T *values = nullptr;
+    bool owned = true;  // False for borrowed memory
+
+    BasicMatrix() = default;
+
+    // Allocate a rows x cols matrix filled with zeros
+    BasicMatrix(const int rows, const int cols) : rows(rows), cols(cols), values(allocAligned<T>(static_cast<std::size_t>(rows) * cols)) {
+        std::memset(values, 0, size() * sizeof(T));
+    }
+
+    // Allocate a rows x cols matrix without touching it - the OS places each page on the NUMA node of the thread
+    // that first writes it, so the caller fills it in parallel with the threads that will later use each row
+    BasicMatrix(const int rows, const int cols, Uninitialized)
+        : rows(rows), cols(cols), values(allocAligned<T>(static_cast<std::size_t>(rows) * cols)) {}
+
+    // rows x cols matrix over existing row-major memory - the caller keeps it alive and frees it
+    static BasicMatrix borrow(const int rows, const int cols, T *values) {
+        BasicMatrix matrix;
+        matrix.rows = rows;
+        matrix.cols = cols;
+        matrix.values = values;
+        matrix.owned = false;
+        return matrix;
+    }
+
+    ~BasicMatrix() {
+        if (owned) {
+            freeBytes(values);
+        }
+    }
+
+    // Buffers are large - allow moves but not copies
+    BasicMatrix(const BasicMatrix &) = delete;
+    BasicMatrix &operator=(const BasicMatrix &) = delete;
+
+    BasicMatrix(BasicMatrix &&other) noexcept
+        : rows(other.rows), cols(other.cols), values(std::exchange(other.values, nullptr)), owned(other.owned) {}
+
+    BasicMatrix &operator=(BasicMatrix &&other) noexcept {
+        std::swap(rows, other.rows);
+        std::swap(cols, other.cols);
+        std::swap(values, other.values);
+        std::swap(owned, other.owned);
+        return *this;
+    }
+
+    // Number of elements
+    std::size_t size() const {
+        return static_cast<std::size_t>(rows) * cols;
+    }
+
+    // Raw buffer - row i starts at data() + i * cols
+    T *data() { return values; }
+    const T *data() const { return values; }
+
+    // Pointer to the start of row i
+    T *row(const int i) { return values + static_cast<std::size_t>(i) * cols; }
+    const T *row(const int i) const { return values + static_cast<std::size_t>(i) * cols; }
+
+    // Element access
+    T &operator()(const int i, const int j) { return values[static_cast<std::size_t>(i) * cols + j]; }
+    const T &operator()(const int i, const int j) const { return values[static_cast<std::size_t>(i) * cols + j]; }
+};
+
+using Matrix = BasicMatrix<int>;
+
+#endif // COMMON_MATRIX_H
@@ -0,0 +1,272 @@
+#ifndef COMMON_MATRIX_FILE_H
+#define COMMON_MATRIX_FILE_H
+
+// Binary matrix files - a 64 byte header followed by the elements in row-major order
+// Header: magic "MATB", format version, element type code, then rows and cols as 64-bit integers, zero padded
+// The payload starts on a cache line, so a memory-mapped file can be used in place as a BasicMatrix
+// Single-node programs map files with MappedMatrix, MPI programs read and write their own ranges with matrix_file_mpi.h
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cli.h"
+#include "matrix.h"
+
+constexpr char matrix_file_magic[4] = {'M', 'A', 'T', 'B'};
+constexpr std::uint32_t matrix_file_version = 1;
+
+struct MatrixFileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t type;  // matrixTypeCode of the elements
+    std::uint32_t reserved;
+    std::int64_t rows;
+    std::int64_t cols;
+    char padding[32];
+};
+
+static_assert(sizeof(MatrixFileHeader) == 64, "matrix file payload must start on a cache line");
+
+// Element type codes stored in the header
+template <typename T>
+constexpr std::uint32_t matrixTypeCode() {
+    if constexpr (std::is_same_v<T, std::int8_t>) return 1;
+    else if constexpr (std::is_same_v<T, std::int16_t>) return 2;
+    else if constexpr (std::is_same_v<T, std::int32_t>) return 3;
+    else if constexpr (std::is_same_v<T, std::int64_t>) return 4;
+    else if constexpr (std::is_same_v<T, float>) return 5;
+    else if constexpr (std::is_same_v<T, double>) return 6;
+    else static_assert(sizeof(T) == 0, "no matrix file type code for this element type");
+}
+
+// Name of a type code - matches the --type names of the programs
+inline const char *matrixTypeName(const std::uint32_t code) {
+    static const char *names[] = {"unknown", "int8", "int16", "int32", "int64", "float", "double"};
+    return code < sizeof(names) / sizeof(names[0]) ? names[code] : names[0];
+}
+
+// Input and output files named on the command line (--a, --b, --c) - empty when not given
+struct MatrixFiles {
+    std::string a;
+    std::string b;
+    std::string c;
+};
+
+inline MatrixFileHeader makeMatrixHeader(const std::uint32_t type, const std::int64_t rows, const std::int64_t cols) {
+    MatrixFileHeader header{};
+    std::memcpy(header.magic, matrix_file_magic, sizeof(header.magic));
+    header.version = matrix_file_version;
+    header.type = type;
+    header.rows = rows;
+    header.cols = cols;
+    return header;
+}
+
+// Reject anything that is not a matrix file this version understands
+inline void checkMatrixHeader(const MatrixFileHeader &header, const std::string &path) {
+    if (std::memcmp(header.magic, matrix_file_magic, sizeof(header.magic)) != 0 || header.version != matrix_file_version) {
+        throw std::runtime_error(path + ": not a matrix file");
+    }
+    if (header.rows < 0 || header.cols < 0 || header.rows > INT32_MAX || header.cols > INT32_MAX) {
+        throw std::runtime_error(path + ": bad matrix dimensions");
+    }
+}
+
+// Elements of the wrong type would be silently reinterpreted, so they are an error
+template <typename T>
+inline void checkMatrixType(const MatrixFileHeader &header, const std::string &path) {
+    if (header.type != matrixTypeCode<T>()) {
+        throw std::runtime_error(path + ": holds " + matrixTypeName(header.type) + " elements, expected " +
+                                 matrixTypeName(matrixTypeCode<T>()));
+    }
+}
+
+// Header of a matrix file, checked
+inline MatrixFileHeader readMatrixHeader(const std::string &path) {
+    MatrixFileHeader header;
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    const bool complete = std::fread(&header, sizeof(header), 1, file) == 1;
+    std::fclose(file);
+    if (!complete) {
+        throw std::runtime_error(path + ": not a matrix file");
+    }
+    checkMatrixHeader(header, path);
+    return header;
+}
+
+// Shape of C (m x n) = A (m x k) * B (k x n) taken from the --a and --b files when they are given
+inline MatrixDims dimsFromFiles(const MatrixDims &dims, const MatrixFiles &files) {
+    MatrixDims result = dims;
+    if (!files.a.empty()) {
+        const MatrixFileHeader a = readMatrixHeader(files.a);
+        result.m = static_cast<int>(a.rows);
+        result.k = static_cast<int>(a.cols);
+    }
+    if (!files.b.empty()) {
+        const MatrixFileHeader b = readMatrixHeader(files.b);
+        if (!files.a.empty() && b.rows != result.k) {
+            throw std::runtime_error(files.b + ": has " + std::to_string(b.rows) + " rows, A has " + std::to_string(result.k) + " columns");
+        }
+        result.k = static_cast<int>(b.rows);
+        result.n = static_cast<int>(b.cols);
+    }
+    return result;
+}
+
+// Check the --a and --b files hold elements of type T, for programs that multiply only one type
+template <typename T>
+inline void checkMatrixFileTypes(const MatrixFiles &files) {
+    for (const std::string &path : {files.a, files.b}) {
+        if (!path.empty()) {
+            checkMatrixType<T>(readMatrixHeader(path), path);
+        }
+    }
+}
+
+// Matrix file mapped into memory - read-only for inputs, read-write for a newly created output
+// matrix() is a BasicMatrix borrowing the mapping, so it works with every multiply in common/ without a copy
+// Pages are read on first touch and written back by the kernel, so no explicit read or write pass is needed
+template <typename T>
+class MappedMatrix {
+public:
+    MappedMatrix() = default;
+
+    // Map an existing file
+    static MappedMatrix open(const std::string &path) {
+        const MatrixFileHeader header = readMatrixHeader(path);
+        checkMatrixType<T>(header, path);
+        return MappedMatrix(path, header, false);
+    }
+
+    // Create (or truncate) a file for a rows x cols matrix and map it for writing
+    static MappedMatrix create(const std::string &path, const int rows, const int cols) {
+        return MappedMatrix(path, makeMatrixHeader(matrixTypeCode<T>(), rows, cols), true);
+    }
+
+    ~MappedMatrix() {
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+        }
+    }
+
+    MappedMatrix(const MappedMatrix &) = delete;
+    MappedMatrix &operator=(const MappedMatrix &) = delete;
+
+    MappedMatrix(MappedMatrix &&other) noexcept
+        : mapping(std::exchange(other.mapping, nullptr)), length(other.length), view(std::move(other.view)) {}
+
+    MappedMatrix &operator=(MappedMatrix &&other) noexcept {
+        std::swap(mapping, other.mapping);
+        std::swap(length, other.length);
+        std::swap(view, other.view);
+        return *this;
+    }
+
+    // The payload as a matrix
+    BasicMatrix<T> &matrix() { return view; }
+    const BasicMatrix<T> &matrix() const { return view; }
+
+    // Another matrix borrowing the payload, for callers that hold a BasicMatrix - valid while this mapping lives
+    BasicMatrix<T> borrow() const { return BasicMatrix<T>::borrow(view.rows, view.cols, view.values); }
+
+private:
+    void *mapping = nullptr;
+    std::size_t length = 0;
+    BasicMatrix<T> view;
+
+    MappedMatrix(const std::string &path, const MatrixFileHeader &header, const bool writable) {
+        length = sizeof(MatrixFileHeader) + static_cast<std::size_t>(header.rows) * header.cols * sizeof(T);
+        const int fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+        if (fd < 0) {
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        }
+
+        // Outputs are sized up front, inputs must hold the whole payload the header promises
+        std::string reason;
+        struct stat info;
+        if (writable && ftruncate(fd, length) != 0) {
+            reason = std::strerror(errno);
+        }
+        else if (!writable && fstat(fd, &info) != 0) {
+            reason = std::strerror(errno);
+        }
+        else if (!writable && static_cast<std::size_t>(info.st_size) < length) {
+            reason = "file is shorter than its header says";
+        }
+        if (!reason.empty()) {
+            ::close(fd);
+            throw std::runtime_error(path + ": " + reason);
+        }
+
+        mapping = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);  // The mapping keeps the file open
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        }
+
+        if (writable) {
+            std::memcpy(mapping, &header, sizeof(header));
+        }
+        else {
+            // Inputs are read front to back by the packing routines
+            madvise(mapping, length, MADV_SEQUENTIAL);
+        }
+        // Inputs are mapped read-only - the non-const pointer is only ever read through for them
+        T *payload = reinterpret_cast<T *>(static_cast<char *>(mapping) + sizeof(MatrixFileHeader));
+        view = BasicMatrix<T>::borrow(static_cast<int>(header.rows), static_cast<int>(header.cols), payload);
+    }
+};
+
+// Input matrix for a program - borrowed from the mapped file when path is set, otherwise a new rows x cols matrix
+// A new matrix is left untouched for the caller to fill, so its pages land with the threads that fill them
+template <typename T>
+inline BasicMatrix<T> inputMatrix(MappedMatrix<T> &mapped, const std::string &path, const int rows, const int cols) {
+    if (path.empty()) {
+        return BasicMatrix<T>(rows, cols, uninitialized);
+    }
+    mapped = MappedMatrix<T>::open(path);
+    return mapped.borrow();
+}
+
+// Output matrix for a program - borrowed from a newly created mapped file when path is set, otherwise a new matrix
+// A new matrix is left untouched as well - the caller zeroes it, ideally in the slices that compute it
+template <typename T>
+inline BasicMatrix<T> outputMatrix(MappedMatrix<T> &mapped, const std::string &path, const int rows, const int cols) {
+    if (path.empty()) {
+        return BasicMatrix<T>(rows, cols, uninitialized);
+    }
+    mapped = MappedMatrix<T>::create(path, rows, cols);
+    return mapped.borrow();
+}
+
+// Write a rows x cols row-major buffer to a matrix file
+template <typename T>
+inline void writeMatrixFile(const std::string &path, const T *values, const int rows, const int cols) {
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    const MatrixFileHeader header = makeMatrixHeader(matrixTypeCode<T>(), rows, cols);
+    const std::size_t count = static_cast<std::size_t>(rows) * cols;
+    const bool complete = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                          std::fwrite(values, sizeof(T), count, file) == count;
+    if (std::fclose(file) != 0 || !complete) {
+        throw std::runtime_error(path + ": write failed");
+    }
+}
+
+#endif // COMMON_MATRIX_FILE_H
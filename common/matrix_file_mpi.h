@@ -0,0 +1,127 @@
+#ifndef COMMON_MATRIX_FILE_MPI_H
+#define COMMON_MATRIX_FILE_MPI_H
+
+// MPI-IO access to the binary matrix files of matrix_file.h
+// Every rank reads just its own block of an input and writes its own block of the output with collective
+// MPI_File_read_at_all / MPI_File_write_at_all calls, so no rank ever holds or funnels a whole matrix
+// A block is a row range and a column range - a row partition is a block spanning every column
+// Errors throw std::runtime_error, as in matrix_file.h
+
+#include <mpi.h>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "matrix_file.h"
+#include "partition.h"
+
+// MPI datatype of an element type
+template <typename T>
+inline MPI_Datatype mpiElementType() {
+    if constexpr (std::is_same_v<T, std::int8_t>) return MPI_INT8_T;
+    else if constexpr (std::is_same_v<T, std::int16_t>) return MPI_INT16_T;
+    else if constexpr (std::is_same_v<T, std::int32_t>) return MPI_INT32_T;
+    else if constexpr (std::is_same_v<T, std::int64_t>) return MPI_INT64_T;
+    else if constexpr (std::is_same_v<T, float>) return MPI_FLOAT;
+    else if constexpr (std::is_same_v<T, double>) return MPI_DOUBLE;
+    else static_assert(sizeof(T) == 0, "no MPI datatype for this element type");
+}
+
+// Throw with the MPI error string when an MPI-IO call fails - file errors return codes by default
+inline void checkMpiIo(const int err, const std::string &path) {
+    if (err != MPI_SUCCESS) {
+        char message[MPI_MAX_ERROR_STRING];
+        int length = 0;
+        MPI_Error_string(err, message, &length);
+        throw std::runtime_error(path + ": " + std::string(message, length));
+    }
+}
+
+// Header of a matrix file, read collectively by every rank of comm
+inline MatrixFileHeader mpiReadMatrixHeader(const std::string &path, MPI_Comm comm) {
+    MPI_File file;
+    checkMpiIo(MPI_File_open(comm, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file), path);
+    MatrixFileHeader header;
+    MPI_Status status;
+    const int err = MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, &status);
+    MPI_File_close(&file);
+    checkMpiIo(err, path);
+    checkMatrixHeader(header, path);
+    return header;
+}
+
+// File view selecting block of a rows x cols matrix, past the header
+// An empty block gets the plain element type (and a count of 0), since subarrays must have a non-zero size
+template <typename T>
+inline MPI_Datatype matrixBlockType(const int rows, const int cols, const Range &block_rows, const Range &block_cols) {
+    if (block_rows.size() == 0 || block_cols.size() == 0) {
+        return mpiElementType<T>();
+    }
+    const int sizes[2] = {rows, cols};
+    const int subsizes[2] = {block_rows.size(), block_cols.size()};
+    const int starts[2] = {block_rows.start, block_cols.start};
+    MPI_Datatype block;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, mpiElementType<T>(), &block);
+    MPI_Type_commit(&block);
+    return block;
+}
+
+inline void freeMatrixBlockType(MPI_Datatype &block, const MPI_Datatype element) {
+    if (block != element) {
+        MPI_Type_free(&block);
+    }
+}
+
+// Read rows block_rows and columns block_cols of a matrix file into dest (row-major, block_cols.size() per row)
+// Collective over comm - every rank calls it with its own block, ranks with an empty block read nothing
+template <typename T>
+void mpiReadMatrixBlock(const std::string &path, MPI_Comm comm, const Range &block_rows, const Range &block_cols, T *dest) {
+    const MatrixFileHeader header = mpiReadMatrixHeader(path, comm);
+    checkMatrixType<T>(header, path);
+    if (block_rows.end > header.rows || block_cols.end > header.cols) {
+        throw std::runtime_error(path + ": block lies outside the matrix");
+    }
+
+    MPI_File file;
+    checkMpiIo(MPI_File_open(comm, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file), path);
+    MPI_Datatype block = matrixBlockType<T>(static_cast<int>(header.rows), static_cast<int>(header.cols), block_rows, block_cols);
+    MPI_File_set_view(file, sizeof(MatrixFileHeader), mpiElementType<T>(), block, "native", MPI_INFO_NULL);
+    MPI_Status status;
+    const int err = MPI_File_read_at_all(file, 0, dest, block_rows.size() * block_cols.size(), mpiElementType<T>(), &status);
+    freeMatrixBlockType(block, mpiElementType<T>());
+    MPI_File_close(&file);
+    checkMpiIo(err, path);
+}
+
+// Create a rows x cols matrix file and write this rank's block from src (row-major, block_cols.size() per row)
+// Collective over comm - the blocks of all ranks together should cover the matrix
+template <typename T>
+void mpiWriteMatrixBlock(const std::string &path, MPI_Comm comm, const int rows, const int cols,
+                         const Range &block_rows, const Range &block_cols, const T *src) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_File file;
+    checkMpiIo(MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file), path);
+    // Drop any longer file left from an earlier run, then size it for this matrix
+    MPI_File_set_size(file, sizeof(MatrixFileHeader) + static_cast<MPI_Offset>(rows) * cols * sizeof(T));
+
+    // Header from one rank, payload from all - the header is written before the view moves past it
+    int err = MPI_SUCCESS;
+    if (rank == 0) {
+        const MatrixFileHeader header = makeMatrixHeader(matrixTypeCode<T>(), rows, cols);
+        MPI_Status status;
+        err = MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, &status);
+    }
+
+    MPI_Datatype block = matrixBlockType<T>(rows, cols, block_rows, block_cols);
+    MPI_File_set_view(file, sizeof(MatrixFileHeader), mpiElementType<T>(), block, "native", MPI_INFO_NULL);
+    MPI_Status status;
+    const int write_err = MPI_File_write_at_all(file, 0, src, block_rows.size() * block_cols.size(), mpiElementType<T>(), &status);
+    freeMatrixBlockType(block, mpiElementType<T>());
+    MPI_File_close(&file);
+    checkMpiIo(err, path);
+    checkMpiIo(write_err, path);
+}
+
+#endif // COMMON_MATRIX_FILE_MPI_H
@@ -0,0 +1,305 @@
+#ifndef COMMON_MICROKERNELS_H
+#define COMMON_MICROKERNELS_H
+
+// Register micro-kernels for the packed GEMM in gemm.h, templated on element type T and accumulator type Acc
+// Hand-vectorised AVX2 and AVX-512 kernels cover int8/int16/int32 elements with int32 accumulators - narrow
+// elements are widened as they are loaded, so packed panels stay 1/4 (int8) or 1/2 (int16) the size of int32
+// Every other pair (int32 -> int64, float, double, ...) uses a kernel written with GCC vector extensions,
+// instantiated at 32 and 64 bytes under AVX2 / AVX-512 target attributes, plus a portable scalar fallback
+// One kernel per pair is picked at first use from CPUID, so no -march flag is needed to build them
+// Set GEMM_KERNEL=scalar|avx2|avx512 in the environment to force a kernel (falls back if the CPU lacks it)
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_HAVE_X86_KERNELS 1
+#endif
+
+// Register tile computed by the micro-kernel - gemm_mr rows of C by gemm_nr columns
+// gemm_nr = 16 ints (or floats) is one AVX-512 register or two AVX2 registers per row - 64-bit accumulators take twice that
+constexpr int gemm_mr = 6;
+constexpr int gemm_nr = 16;
+
+// Common signature: gemm_mr x gemm_nr tile of C from a kc x gemm_mr panel of A and a kc x gemm_nr panel of B
+// Only the top-left mr x nr corner is written back, which handles the ragged edges of C
+// The first k slice overwrites C (accumulate = false), later slices accumulate into it
+template <typename T, typename Acc>
+using MicroKernel = void (*)(int kc, const T *a_panel, const T *b_panel,
+                             Acc *c, int ldc, int mr, int nr, bool accumulate);
+
+using MicroKernelFn = MicroKernel<int, int>;
+
+// Pairs with hand-written SIMD kernels - narrow integers accumulated in int32
+template <typename T, typename Acc>
+constexpr bool has_simd_kernels = std::is_same_v<Acc, std::int32_t> &&
+    (std::is_same_v<T, std::int8_t> || std::is_same_v<T, std::int16_t> || std::is_same_v<T, std::int32_t>);
+
+// Write a finished tile held in acc back to C
+template <typename Acc>
+inline void storeTile(const Acc acc[gemm_mr][gemm_nr], Acc *c, const int ldc,
+                      const int mr, const int nr, const bool accumulate) {
+    for (int i = 0; i < mr; i++) {
+        Acc *c_row = c + static_cast<std::size_t>(i) * ldc;
+        for (int j = 0; j < nr; j++) {
+            c_row[j] = accumulate ? c_row[j] + acc[i][j] : acc[i][j];
+        }
+    }
+}
+
+// Portable kernel body - each row of the tile keeps its accumulators in a local array the compiler can vectorise
+// Products are formed in Acc, so narrow elements never overflow before they are accumulated
+template <typename T, typename Acc>
+__attribute__((always_inline))
+inline void microKernelBody(const int kc, const T *a_panel, const T *b_panel,
+                            Acc *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    Acc acc[gemm_mr][gemm_nr];
+    for (int i = 0; i < gemm_mr; i++) {
+        Acc row[gemm_nr] = {};
+        for (int p = 0; p < kc; p++) {
+            const Acc a_ip = static_cast<Acc>(a_panel[p * gemm_mr + i]);
+            const T *b_p = b_panel + p * gemm_nr;
+            for (int j = 0; j < gemm_nr; j++) {
+                row[j] += a_ip * static_cast<Acc>(b_p[j]);
+            }
+        }
+        for (int j = 0; j < gemm_nr; j++) {
+            acc[i][j] = row[j];
+        }
+    }
+    storeTile(acc, c, ldc, mr, nr, accumulate);
+}
+
+template <typename T, typename Acc>
+inline void microKernelScalar(const int kc, const T *a_panel, const T *b_panel,
+                              Acc *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    microKernelBody(kc, a_panel, b_panel, c, ldc, mr, nr, accumulate);
+}
+
+#ifdef GEMM_HAVE_X86_KERNELS
+
+// Kernel body on Bytes-wide vectors of Acc - each row of the tile is gemm_nr / lanes vectors
+// B is converted to Acc as it is loaded and A is broadcast by the scalar * vector product,
+// which the compiler turns into packed multiply-adds (FMA for float and double)
+template <typename T, typename Acc, int Bytes>
+__attribute__((always_inline))
+inline void microKernelVectorBody(const int kc, const T *a_panel, const T *b_panel,
+                                  Acc *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    constexpr int lanes = Bytes / sizeof(Acc);
+    constexpr int vecs = gemm_nr / lanes;
+    typedef Acc AccVec __attribute__((vector_size(Bytes)));
+    typedef T InVec __attribute__((vector_size(lanes * sizeof(T))));
+
+    AccVec acc[gemm_mr][vecs];
+    for (int i = 0; i < gemm_mr; i++) {
+        for (int v = 0; v < vecs; v++) {
+            acc[i][v] = AccVec{};
+        }
+    }
+
+    for (int p = 0; p < kc; p++) {
+        AccVec b[vecs];
+        for (int v = 0; v < vecs; v++) {
+            InVec raw;
+            std::memcpy(&raw, b_panel + p * gemm_nr + v * lanes, sizeof(raw));
+            b[v] = __builtin_convertvector(raw, AccVec);
+        }
+        const T *a_p = a_panel + p * gemm_mr;
+        for (int i = 0; i < gemm_mr; i++) {
+            const Acc a_ip = static_cast<Acc>(a_p[i]);
+            for (int v = 0; v < vecs; v++) {
+                acc[i][v] += a_ip * b[v];
+            }
+        }
+    }
+
+    Acc tile[gemm_mr][gemm_nr];
+    std::memcpy(tile, acc, sizeof(tile));
+    storeTile(tile, c, ldc, mr, nr, accumulate);
+}
+
+template <typename T, typename Acc>
+__attribute__((target("avx2,fma")))
+inline void microKernelVectorAvx2(const int kc, const T *a_panel, const T *b_panel,
+                                  Acc *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    microKernelVectorBody<T, Acc, 32>(kc, a_panel, b_panel, c, ldc, mr, nr, accumulate);
+}
+
+template <typename T, typename Acc>
+__attribute__((target("avx512f")))
+inline void microKernelVectorAvx512(const int kc, const T *a_panel, const T *b_panel,
+                                    Acc *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    microKernelVectorBody<T, Acc, 64>(kc, a_panel, b_panel, c, ldc, mr, nr, accumulate);
+}
+
+// Load 8 (AVX2) or 16 (AVX-512) consecutive elements as int32 lanes, sign extending narrow types
+__attribute__((target("avx2")))
+inline __m256i loadInt32x8(const std::int8_t *p) {
+    return _mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i loadInt32x8(const std::int16_t *p) {
+    return _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+__attribute__((target("avx2")))
+inline __m256i loadInt32x8(const std::int32_t *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+__attribute__((target("avx512f")))
+inline __m512i loadInt32x16(const std::int8_t *p) {
+    // Zero-masked form with a full mask - same instruction, avoids GCC's -Wmaybe-uninitialized on the unmasked intrinsic
+    return _mm512_maskz_cvtepi8_epi32(0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+__attribute__((target("avx512f")))
+inline __m512i loadInt32x16(const std::int16_t *p) {
+    return _mm512_maskz_cvtepi16_epi32(0xFFFF, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)));
+}
+
+__attribute__((target("avx512f")))
+inline __m512i loadInt32x16(const std::int32_t *p) {
+    return _mm512_loadu_si512(p);
+}
+
+// AVX2 kernel - 6 rows x 2 ymm registers = 12 accumulators, leaving room for the two B vectors and the A broadcast
+template <typename T>
+__attribute__((target("avx2")))
+inline void microKernelAvx2(const int kc, const T *a_panel, const T *b_panel,
+                            int *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    __m256i acc[gemm_mr][2];
+    for (int i = 0; i < gemm_mr; i++) {
+        acc[i][0] = _mm256_setzero_si256();
+        acc[i][1] = _mm256_setzero_si256();
+    }
+
+    for (int p = 0; p < kc; p++) {
+        const __m256i b0 = loadInt32x8(b_panel + p * gemm_nr);
+        const __m256i b1 = loadInt32x8(b_panel + p * gemm_nr + 8);
+        const T *a_p = a_panel + p * gemm_mr;
+        for (int i = 0; i < gemm_mr; i++) {
+            const __m256i a_ip = _mm256_set1_epi32(a_p[i]);
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_mullo_epi32(a_ip, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_mullo_epi32(a_ip, b1));
+        }
+    }
+
+    // Full tiles go straight to C, edge tiles go through a temporary
+    if (mr == gemm_mr && nr == gemm_nr) {
+        for (int i = 0; i < gemm_mr; i++) {
+            __m256i *c_row = reinterpret_cast<__m256i *>(c + static_cast<std::size_t>(i) * ldc);
+            if (accumulate) {
+                acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_loadu_si256(c_row));
+                acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_loadu_si256(c_row + 1));
+            }
+            _mm256_storeu_si256(c_row, acc[i][0]);
+            _mm256_storeu_si256(c_row + 1, acc[i][1]);
+        }
+        return;
+    }
+    int tile[gemm_mr][gemm_nr];
+    for (int i = 0; i < gemm_mr; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(tile[i]), acc[i][0]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(tile[i] + 8), acc[i][1]);
+    }
+    storeTile(tile, c, ldc, mr, nr, accumulate);
+}
+
+// AVX-512 kernel - one zmm accumulator per row, edges handled with a column mask instead of a temporary
+template <typename T>
+__attribute__((target("avx512f")))
+inline void microKernelAvx512(const int kc, const T *a_panel, const T *b_panel,
+                              int *c, const int ldc, const int mr, const int nr, const bool accumulate) {
+    __m512i acc[gemm_mr];
+    for (int i = 0; i < gemm_mr; i++) {
+        acc[i] = _mm512_setzero_si512();
+    }
+
+    for (int p = 0; p < kc; p++) {
+        const __m512i b = loadInt32x16(b_panel + p * gemm_nr);
+        const T *a_p = a_panel + p * gemm_mr;
+        for (int i = 0; i < gemm_mr; i++) {
+            acc[i] = _mm512_add_epi32(acc[i], _mm512_mullo_epi32(_mm512_set1_epi32(a_p[i]), b));
+        }
+    }
+
+    const __mmask16 cols = static_cast<__mmask16>((1u << nr) - 1);
+    for (int i = 0; i < mr; i++) {
+        int *c_row = c + static_cast<std::size_t>(i) * ldc;
+        if (accumulate) {
+            acc[i] = _mm512_add_epi32(acc[i], _mm512_maskz_loadu_epi32(cols, c_row));
+        }
+        _mm512_mask_storeu_epi32(c_row, cols, acc[i]);
+    }
+}
+
+#endif // GEMM_HAVE_X86_KERNELS
+
+// Name of a kernel, for reporting
+template <typename T, typename Acc>
+inline const char *microKernelName(const MicroKernel<T, Acc> kernel) {
+#ifdef GEMM_HAVE_X86_KERNELS
+    if constexpr (has_simd_kernels<T, Acc>) {
+        if (kernel == microKernelAvx512<T>) return "avx512";
+        if (kernel == microKernelAvx2<T>) return "avx2";
+    }
+    if (kernel == microKernelVectorAvx512<T, Acc>) return "avx512 (vector extensions)";
+    if (kernel == microKernelVectorAvx2<T, Acc>) return "avx2 (vector extensions)";
+#endif
+    return "scalar";
+}
+
+// Widest instruction set the CPU supports, capped by GEMM_KERNEL when it is set
+// Shared by every family of kernels that is compiled once per instruction set
+enum class SimdLevel { scalar, avx2, avx512 };
+
+inline SimdLevel simdLevel() {
+    const char *requested = std::getenv("GEMM_KERNEL");
+    const bool any = requested == nullptr || requested[0] == '\0';
+#ifdef GEMM_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if ((any || std::strcmp(requested, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        return SimdLevel::avx512;
+    }
+    if ((any || std::strcmp(requested, "avx512") == 0 || std::strcmp(requested, "avx2") == 0) &&
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SimdLevel::avx2;
+    }
+#endif
+    return SimdLevel::scalar;
+}
+
+// Pick the widest kernel the CPU supports for T and Acc, or the one requested through GEMM_KERNEL
+template <typename T, typename Acc>
+inline MicroKernel<T, Acc> selectMicroKernel() {
+#ifdef GEMM_HAVE_X86_KERNELS
+    const SimdLevel level = simdLevel();
+    if (level == SimdLevel::avx512) {
+        if constexpr (has_simd_kernels<T, Acc>) return microKernelAvx512<T>;
+        return microKernelVectorAvx512<T, Acc>;
+    }
+    if (level == SimdLevel::avx2) {
+        if constexpr (has_simd_kernels<T, Acc>) return microKernelAvx2<T>;
+        return microKernelVectorAvx2<T, Acc>;
+    }
+#endif
+    return microKernelScalar<T, Acc>;
+}
+
+// Kernel for each element/accumulator pair, chosen once on first use
+template <typename T, typename Acc>
+inline MicroKernel<T, Acc> microKernelFor() {
+    static const MicroKernel<T, Acc> kernel = selectMicroKernel<T, Acc>();
+    return kernel;
+}
+
+// Kernel chosen once at program startup for the int programs
+inline const MicroKernelFn micro_kernel = microKernelFor<int, int>();
+
+#endif // COMMON_MICROKERNELS_H
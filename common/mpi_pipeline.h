@@ -0,0 +1,158 @@
+#ifndef COMMON_MPI_PIPELINE_H
+#define COMMON_MPI_PIPELINE_H
+
+// Pipelined row-distributed multiply that overlaps MPI transfers with computation
+// The shared dimension k is cut into chunks - chunk i carries columns [k0, k1) of every rank's rows of A
+// (MPI_Iscatterv) and rows [k0, k1) of B (MPI_Ibcast), and each rank accumulates C_rows += A_chunk * B_chunk
+// Two buffers per operand let chunk i+1 be in flight while chunk i is multiplied; the multiply is done in
+// row blocks with MPI_Testall in between so the library keeps progressing the transfer
+// The finished rows of C are collected with MPI_Igatherv
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <mpi.h>
+#include "gemm.h"
+#include "partition.h"
+
+// Default chunk width along k
+constexpr int pipeline_chunk_width = block_k;
+
+// Timings from one pipelined multiply on this rank, in seconds
+struct PipelineStats {
+    double transfer_time = 0;  // Sum over chunks of post-to-arrival time
+    double exposed_time = 0;  // Time spent blocked in MPI_Wait for a chunk
+    double compute_time = 0;  // Time spent multiplying
+    int chunks = 0;
+
+    // Fraction of transfer time hidden behind computation - 0 is fully serialised, 1 is fully overlapped
+    double overlapFraction() const {
+        return transfer_time > 0 ? std::max(0.0, 1.0 - exposed_time / transfer_time) : 0.0;
+    }
+};
+
+// C (m x n) = A (m x k) * B (k x n) over the ranks in comm, rows of A and C split with balancedRange
+// A, B and C are only read or written on root; every other rank passes nullptr
+inline PipelineStats pipelinedRowMultiply(const int m, const int k, const int n,
+                                          const int *A, const int *B, int *C,
+                                          const int num_threads, const int chunk_width, MPI_Comm comm, const int root = 0) {
+    using clock = std::chrono::steady_clock;
+    const auto seconds = [](const clock::time_point from, const clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    };
+
+    int rank, numtasks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &numtasks);
+    const Range my_rows = balancedRange(m, numtasks, rank);
+    const int rows = my_rows.size();
+    const int chunks = (k + chunk_width - 1) / chunk_width;
+
+    // Element counts for a chunk of A are rows * chunk width - one set per buffer slot, since MPI
+    // must not see them change while the scatter using them is still in flight
+    std::vector<int> counts_A[2], displs_A[2], counts_C, displs_C;
+    balancedCounts(m, numtasks, n, counts_C, displs_C);
+
+    // Double buffers - root also needs two send buffers, since a chunk of A is not contiguous in A
+    // Root broadcasts B straight out of B, since its rows of a chunk are already contiguous
+    std::vector<int> a_chunk[2], b_chunk[2], a_send[2];
+    int *b_ptr[2];
+    for (int s = 0; s < 2; s++) {
+        a_chunk[s].resize(static_cast<std::size_t>(std::max(rows, 1)) * chunk_width);
+        if (rank == root) {
+            a_send[s].resize(static_cast<std::size_t>(std::max(m, 1)) * chunk_width);
+        } else {
+            b_chunk[s].resize(static_cast<std::size_t>(chunk_width) * std::max(n, 1));
+        }
+    }
+    std::vector<int> c_rows(static_cast<std::size_t>(std::max(rows, 1)) * n, 0);
+    PackedB packed_chunk;
+
+    MPI_Request requests[2][2];
+    clock::time_point posted[2], arrived[2];
+    bool complete[2] = {false, false};
+
+    // Start the transfer of chunk i into buffer slot i % 2
+    const auto post = [&](const int i) {
+        const int s = i % 2;
+        const int k0 = i * chunk_width;
+        const int kw = std::min(chunk_width, k - k0);
+        balancedCounts(m, numtasks, kw, counts_A[s], displs_A[s]);
+        if (rank == root) {
+            // Gather columns [k0, k0 + kw) of A into a contiguous m x kw send buffer
+            for (int r = 0; r < m; r++) {
+                std::memcpy(a_send[s].data() + static_cast<std::size_t>(r) * kw,
+                            A + static_cast<std::size_t>(r) * k + k0, kw * sizeof(int));
+            }
+            // Root only reads from its send buffer, so B can be broadcast in place
+            b_ptr[s] = const_cast<int *>(B) + static_cast<std::size_t>(k0) * n;
+        } else {
+            b_ptr[s] = b_chunk[s].data();
+        }
+        MPI_Iscatterv(a_send[s].data(), counts_A[s].data(), displs_A[s].data(), MPI_INT,
+                      a_chunk[s].data(), rows * kw, MPI_INT, root, comm, &requests[s][0]);
+        MPI_Ibcast(b_ptr[s], kw * n, MPI_INT, root, comm, &requests[s][1]);
+        posted[s] = clock::now();
+        complete[s] = false;
+    };
+
+    // Check whether the transfer in slot s has arrived, recording when it did
+    const auto poll = [&](const int s) {
+        if (complete[s]) {
+            return;
+        }
+        int done = 0;
+        MPI_Testall(2, requests[s], &done, MPI_STATUSES_IGNORE);
+        if (done) {
+            complete[s] = true;
+            arrived[s] = clock::now();
+        }
+    };
+
+    PipelineStats stats;
+    stats.chunks = chunks;
+    if (chunks > 0) {
+        post(0);
+    }
+    for (int i = 0; i < chunks; i++) {
+        const int s = i % 2;
+        const int kw = std::min(chunk_width, k - i * chunk_width);
+
+        // Put the next chunk in flight before touching this one
+        if (i + 1 < chunks) {
+            post(i + 1);
+        }
+
+        // Block for this chunk if it has not already arrived during the previous multiply
+        if (!complete[s]) {
+            const auto wait_start = clock::now();
+            MPI_Waitall(2, requests[s], MPI_STATUSES_IGNORE);
+            arrived[s] = clock::now();
+            complete[s] = true;
+            stats.exposed_time += seconds(wait_start, arrived[s]);
+        }
+        stats.transfer_time += seconds(posted[s], arrived[s]);
+
+        // C_rows += A_chunk * B_chunk, one row block at a time so the next chunk keeps progressing
+        const auto compute_start = clock::now();
+        repackB(packed_chunk, b_ptr[s], n, kw, n, num_threads);
+        for (int ii = 0; ii < rows; ii += block_m) {
+            const int mc = std::min(block_m, rows - ii);
+            gemmPackedThreads(mc, a_chunk[s].data() + static_cast<std::size_t>(ii) * kw, kw, packed_chunk,
+                              c_rows.data() + static_cast<std::size_t>(ii) * n, n, num_threads, i > 0);
+            if (i + 1 < chunks) {
+                poll((i + 1) % 2);
+            }
+        }
+        stats.compute_time += seconds(compute_start, clock::now());
+    }
+
+    // Collect the finished rows of C on root
+    MPI_Request gather;
+    MPI_Igatherv(c_rows.data(), rows * n, MPI_INT, C, counts_C.data(), displs_C.data(), MPI_INT, root, comm, &gather);
+    MPI_Wait(&gather, MPI_STATUS_IGNORE);
+    return stats;
+}
+
+#endif // COMMON_MPI_PIPELINE_H
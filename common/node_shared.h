@@ -0,0 +1,88 @@
+#ifndef COMMON_NODE_SHARED_H
+#define COMMON_NODE_SHARED_H
+
+// One copy of a buffer per node, shared by every rank on that node through an MPI-3 shared-memory window
+// MPI_COMM_WORLD is split by node with MPI_Comm_split_type; rank 0 of each node communicator (the node
+// leader) allocates the whole window and the other ranks map the leader's segment with MPI_Win_shared_query
+// Only the leaders take part in the broadcast, so traffic and memory drop by the number of ranks per node
+
+#include <mpi.h>
+#include <vector>
+#include "gemm.h"
+
+struct NodeShared {
+    MPI_Comm node_comm = MPI_COMM_NULL;  // Ranks on this node
+    MPI_Comm leader_comm = MPI_COMM_NULL;  // Node leaders only - MPI_COMM_NULL on other ranks
+    MPI_Win win = MPI_WIN_NULL;
+    int *data = nullptr;  // Start of the node's shared buffer, valid on every rank of the node
+    int node_rank = 0;
+    int node_size = 1;
+
+    bool leader() const { return node_rank == 0; }
+};
+
+// Collectively allocate count ints per node - every rank in comm must call this
+inline NodeShared allocateNodeShared(MPI_Comm comm, const MPI_Aint count) {
+    NodeShared shared;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &shared.node_comm);
+    MPI_Comm_rank(shared.node_comm, &shared.node_rank);
+    MPI_Comm_size(shared.node_comm, &shared.node_size);
+
+    // Leaders are keyed by their rank in comm, so comm's rank 0 is also rank 0 of the leader communicator
+    MPI_Comm_split(comm, shared.leader() ? 0 : MPI_UNDEFINED, rank, &shared.leader_comm);
+
+    // Leader owns the whole segment, everyone else contributes zero bytes and looks up the leader's pointer
+    const MPI_Aint bytes = shared.leader() ? count * static_cast<MPI_Aint>(sizeof(int)) : 0;
+    void *base = nullptr;
+    MPI_Win_allocate_shared(bytes, sizeof(int), MPI_INFO_NULL, shared.node_comm, &base, &shared.win);
+    MPI_Aint segment_size;
+    int disp_unit;
+    MPI_Win_shared_query(shared.win, 0, &segment_size, &disp_unit, &base);
+    shared.data = static_cast<int *>(base);
+    return shared;
+}
+
+inline void freeNodeShared(NodeShared &shared) {
+    MPI_Win_free(&shared.win);
+    if (shared.leader_comm != MPI_COMM_NULL) {
+        MPI_Comm_free(&shared.leader_comm);
+    }
+    MPI_Comm_free(&shared.node_comm);
+    shared.data = nullptr;
+}
+
+// Distribute B (k x n, only read on rank 0 of comm) to every node and pack it once per node into a shared window
+// Leaders receive B over the leader communicator and pack it straight into the window; the returned PackedB
+// points into the window on every rank and is valid until freeNodeShared - leaders pack on num_threads OMP threads
+inline PackedB broadcastPackedBShared(const int *B, const int k, const int n, MPI_Comm comm, NodeShared &shared, const int num_threads) {
+    const int padded = packedCols(n);
+    shared = allocateNodeShared(comm, static_cast<MPI_Aint>(k) * padded);
+
+    MPI_Win_fence(0, shared.win);
+    if (shared.leader()) {
+        int leader_rank;
+        MPI_Comm_rank(shared.leader_comm, &leader_rank);
+        // Raw B is only needed on leaders, and only until it has been packed
+        std::vector<int> received;
+        const int *source = B;
+        if (leader_rank != 0) {
+            received.resize(static_cast<std::size_t>(k) * n);
+            source = received.data();
+        }
+        MPI_Bcast(const_cast<int *>(source), k * n, MPI_INT, 0, shared.leader_comm);
+        packBInto(source, n, k, n, shared.data, num_threads);
+    }
+    // Make the leader's writes visible to the rest of the node before anyone reads the panels
+    MPI_Win_fence(0, shared.win);
+
+    PackedB packed;
+    packed.rows = k;
+    packed.cols = n;
+    packed.padded_cols = padded;
+    packed.values = shared.data;
+    return packed;
+}
+
+#endif // COMMON_NODE_SHARED_H
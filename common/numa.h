@@ -0,0 +1,365 @@
+#ifndef COMMON_NUMA_H
+#define COMMON_NUMA_H
+
+// NUMA placement for the threaded programs - thread pinning, first-touch initialisation and a report of where
+// threads and pages ended up
+// Linux puts a page on the NUMA node of the thread that first writes it, so matrices are allocated untouched
+// (BasicMatrix(rows, cols, uninitialized)) and filled by the threads that later compute on each row - that only
+// holds while threads stay put, which is what pinning is for
+// --pin takes the abstract place names of OMP_PLACES - threads, cores, sockets or numa_domains - and binds thread i
+// close to place i, the way OMP_PROC_BIND=close does; OMP programs leave binding to the runtime when OMP_PLACES is set
+// Topology comes from sysfs and is limited to the CPUs the process may run on, so it composes with mpirun's binding
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "cli.h"
+#include "matrix.h"
+#include "partition.h"
+#include "thread_pool.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Unit of a place, as named in OMP_PLACES - none leaves threads wherever the OS puts them
+enum class PinPlaces { none, threads, cores, sockets, numa_domains };
+
+inline const char *pinPlacesName(const PinPlaces places) {
+    static const char *names[] = {"none", "threads", "cores", "sockets", "numa_domains"};
+    return names[static_cast<int>(places)];
+}
+
+// --pin threads|cores|sockets|numa_domains, none when absent
+inline PinPlaces pinOption(const int argc, char **argv) {
+    const std::string value = stringOption(argc, argv, "--pin", "none");
+    for (const PinPlaces places : {PinPlaces::none, PinPlaces::threads, PinPlaces::cores, PinPlaces::sockets, PinPlaces::numa_domains}) {
+        if (value == pinPlacesName(places)) {
+            return places;
+        }
+    }
+    throw std::runtime_error("Unknown --pin " + value + " - expected none, threads, cores, sockets or numa_domains");
+}
+
+// First integer in a sysfs file, or fallback when it can't be read
+inline int sysfsInt(const std::string &path, const int fallback) {
+    std::FILE *file = std::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        return fallback;
+    }
+    int value;
+    const bool read = std::fscanf(file, "%d", &value) == 1;
+    std::fclose(file);
+    return read ? value : fallback;
+}
+
+// NUMA node of a CPU from its nodeN entry in sysfs - 0 on kernels without NUMA
+inline int cpuNode(const int cpu) {
+    DIR *dir = opendir(("/sys/devices/system/cpu/cpu" + std::to_string(cpu)).c_str());
+    int node = 0;
+    if (dir != nullptr) {
+        while (const dirent *entry = readdir(dir)) {
+            if (std::strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                node = std::atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+    }
+    return node;
+}
+
+// Where each CPU the process may use sits - its core, socket and NUMA node
+struct CpuTopology {
+    std::vector<int> cpus;  // Allowed CPUs in ascending order
+    std::map<int, std::pair<int, int>> core;  // cpu -> (socket, core id), unique per physical core
+    std::map<int, int> socket;
+    std::map<int, int> node;
+};
+
+// Topology of the CPUs in the process's affinity mask, read once
+inline const CpuTopology &cpuTopology() {
+    static const CpuTopology topology = [] {
+        CpuTopology t;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) {
+                continue;
+            }
+            const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+            const int socket = sysfsInt(base + "physical_package_id", 0);
+            t.cpus.push_back(cpu);
+            t.socket[cpu] = socket;
+            t.core[cpu] = {socket, sysfsInt(base + "core_id", cpu)};  // Without topology every CPU is its own core
+            t.node[cpu] = cpuNode(cpu);
+        }
+        return t;
+    }();
+    return topology;
+}
+
+// CPUs of each place, in order of their first CPU - empty for PinPlaces::none
+inline std::vector<std::vector<int>> pinPlaces(const PinPlaces places) {
+    const CpuTopology &topology = cpuTopology();
+    std::map<std::pair<int, int>, std::vector<int>> groups;
+    for (const int cpu : topology.cpus) {
+        switch (places) {
+            case PinPlaces::none: return {};
+            case PinPlaces::threads: groups[{cpu, 0}].push_back(cpu); break;
+            case PinPlaces::cores: groups[topology.core.at(cpu)].push_back(cpu); break;
+            case PinPlaces::sockets: groups[{topology.socket.at(cpu), 0}].push_back(cpu); break;
+            case PinPlaces::numa_domains: groups[{topology.node.at(cpu), 0}].push_back(cpu); break;
+        }
+    }
+    std::vector<std::vector<int>> result;
+    for (auto &group : groups) {
+        result.push_back(std::move(group.second));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+// Place of thread i of num_threads with close binding - consecutive threads share or fill consecutive places
+inline int closePlace(const int thread, const int num_threads, const int num_places) {
+    return num_threads >= num_places ? static_cast<int>(static_cast<long long>(thread) * num_places / num_threads)
+                                     : thread % num_places;
+}
+
+// Bind the calling thread to the CPUs of a place - false if the kernel refused
+inline bool pinCurrentThread(const std::vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// CPU list in sysfs notation, e.g. 0-3,8
+inline std::string cpuListString(const cpu_set_t &set) {
+    std::ostringstream out;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set)) {
+            last++;
+        }
+        out << (out.tellp() > 0 ? "," : "") << cpu;
+        if (last > cpu) {
+            out << "-" << last;
+        }
+        cpu = last;
+    }
+    return out.str();
+}
+
+// Where one thread runs - the CPU it was on when asked, that CPU's node, and the CPUs it may move between
+struct ThreadPlacement {
+    int thread = 0;
+    int cpu = -1;
+    int node = -1;
+    std::string allowed;
+};
+
+inline ThreadPlacement currentPlacement(const int thread) {
+    ThreadPlacement placement;
+    placement.thread = thread;
+    placement.cpu = sched_getcpu();
+    placement.node = placement.cpu >= 0 ? cpuNode(placement.cpu) : -1;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+        placement.allowed = cpuListString(set);
+    }
+    return placement;
+}
+
+// Pin the OMP threads of a num_threads team and return where they run
+// Also makes num_threads the default team size, so parallel regions without a num_threads clause (packing B)
+// reuse the same pinned threads - with OMP_PLACES set the runtime has already bound them and is left alone
+inline std::vector<ThreadPlacement> pinOmpThreads(const PinPlaces places, const int num_threads) {
+    std::vector<ThreadPlacement> placements(num_threads);
+#ifdef _OPENMP
+    omp_set_num_threads(num_threads);
+#endif
+    const bool runtime_binds = std::getenv("OMP_PLACES") != nullptr;
+    const std::vector<std::vector<int>> cpus = runtime_binds ? std::vector<std::vector<int>>{} : pinPlaces(places);
+    #pragma omp parallel num_threads(num_threads)
+    {
+#ifdef _OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+        if (!cpus.empty()) {
+            pinCurrentThread(cpus[closePlace(thread, num_threads, static_cast<int>(cpus.size()))]);
+        }
+        placements[thread] = currentPlacement(thread);
+    }
+    return placements;
+}
+
+// pthreads job - pin the worker it runs on to the place in arg, or leave it be when that is empty
+inline void *pinWorker(void *args) {
+    const std::vector<int> *cpus = static_cast<const std::vector<int> *>(args);
+    if (!cpus->empty()) {
+        pinCurrentThread(*cpus);
+    }
+    return nullptr;
+}
+
+// pthreads job - record where the worker it runs on is placed
+inline void *placeWorker(void *args) {
+    ThreadPlacement *placement = static_cast<ThreadPlacement *>(args);
+    *placement = currentPlacement(ThreadPool::workerIndex());
+    return nullptr;
+}
+
+// Pin each worker of a pool with pthread_setaffinity_np and return where they run
+inline std::vector<ThreadPlacement> pinPoolWorkers(ThreadPool &pool, const PinPlaces places) {
+    const int num_threads = pool.size();
+    const std::vector<std::vector<int>> cpus = pinPlaces(places);
+    std::vector<std::vector<int>> assigned(num_threads);
+    std::vector<ThreadPlacement> placements(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        if (!cpus.empty()) {
+            assigned[i] = cpus[closePlace(i, num_threads, static_cast<int>(cpus.size()))];
+        }
+        pool.submitTo(i, pinWorker, &assigned[i]);
+    }
+    pool.wait();
+    // Placement is read after every worker has moved
+    for (int i = 0; i < num_threads; i++) {
+        pool.submitTo(i, placeWorker, &placements[i]);
+    }
+    pool.wait();
+    return placements;
+}
+
+// Zero rows [0, rows) of a matrix in the balanced row slices of num_threads OMP threads - the first touch of C,
+// so each thread's rows of the product sit on its own node
+template <typename T>
+inline void firstTouchZero(BasicMatrix<T> &matrix, [[maybe_unused]] const int num_threads) {
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const Range rows = balancedRange(matrix.rows, omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range rows{0, matrix.rows};
+#endif
+        if (rows.size() > 0) {
+            std::memset(matrix.row(rows.start), 0, static_cast<std::size_t>(rows.size()) * matrix.cols * sizeof(T));
+        }
+    }
+}
+
+// Rows of a matrix for a pool job to zero
+template <typename T>
+struct ZeroRows {
+    BasicMatrix<T> *matrix;
+    Range rows;
+};
+
+// pthreads job - zero one slice of rows
+template <typename T>
+inline void *zeroRows(void *args) {
+    ZeroRows<T> *p = static_cast<ZeroRows<T> *>(args);
+    if (p->rows.size() > 0) {
+        std::memset(p->matrix->row(p->rows.start), 0, static_cast<std::size_t>(p->rows.size()) * p->matrix->cols * sizeof(T));
+    }
+    return nullptr;
+}
+
+// Zero a matrix on a pool - worker i zeroes slice i, the slice it later computes with submitTo(i, ...)
+template <typename T>
+inline void firstTouchZero(BasicMatrix<T> &matrix, ThreadPool &pool) {
+    const int num_threads = pool.size();
+    std::vector<ZeroRows<T>> p(num_threads);
+    for (int i = 0; i < num_threads; i++) {
+        p[i] = ZeroRows<T>{&matrix, balancedRange(matrix.rows, num_threads, i)};
+        pool.submitTo(i, zeroRows<T>, &p[i]);
+    }
+    pool.wait();
+}
+
+// Share of a buffer's pages on each NUMA node, from move_pages with no target nodes, which only reports
+// Samples at most max_samples pages spread over the buffer - empty when the kernel won't say (no NUMA, seccomp)
+inline std::map<int, double> pageNodes(const void *buffer, const std::size_t bytes, const std::size_t max_samples = 4096) {
+    std::map<int, double> shares;
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(buffer) / page * page;
+    const std::size_t pages = (reinterpret_cast<std::uintptr_t>(buffer) + bytes - first + page - 1) / page;
+    if (bytes == 0 || pages == 0) {
+        return shares;
+    }
+    const std::size_t samples = std::min(pages, max_samples);
+    std::vector<void *> addresses(samples);
+    std::vector<int> status(samples, -1);
+    for (std::size_t i = 0; i < samples; i++) {
+        addresses[i] = reinterpret_cast<void *>(first + i * pages / samples * page);
+    }
+    if (syscall(SYS_move_pages, 0, samples, addresses.data(), nullptr, status.data(), 0) != 0) {
+        return shares;
+    }
+    std::size_t resident = 0;
+    for (const int node : status) {
+        if (node >= 0) {  // Negative for pages never touched
+            shares[node]++;
+            resident++;
+        }
+    }
+    for (auto &share : shares) {
+        share.second /= resident;
+    }
+    return shares;
+}
+
+// Placement report - the pinning asked for, each thread's CPU and node, and where each named buffer's pages are
+inline std::string placementReport(const PinPlaces places, const std::vector<ThreadPlacement> &threads,
+                                   const std::vector<std::pair<std::string, std::pair<const void *, std::size_t>>> &buffers) {
+    std::ostringstream out;
+    const CpuTopology &topology = cpuTopology();
+    std::map<int, int> nodes;
+    for (const auto &entry : topology.node) {
+        nodes[entry.second]++;
+    }
+    out << "Placement: --pin " << pinPlacesName(places);
+    if (const char *omp_places = std::getenv("OMP_PLACES")) {
+        out << ", OMP_PLACES=" << omp_places;
+    }
+    out << " - " << topology.cpus.size() << " CPUs on " << nodes.size() << " NUMA node" << (nodes.size() == 1 ? "" : "s") << "\n";
+    for (const ThreadPlacement &thread : threads) {
+        out << "  thread " << thread.thread << ": cpu " << thread.cpu << ", node " << thread.node << ", allowed " << thread.allowed << "\n";
+    }
+    for (const auto &buffer : buffers) {
+        const std::map<int, double> shares = pageNodes(buffer.second.first, buffer.second.second);
+        out << "  " << buffer.first << " pages:";
+        if (shares.empty()) {
+            out << " unknown";
+        }
+        for (const auto &share : shares) {
+            out << " node " << share.first << " " << static_cast<int>(share.second * 100 + 0.5) << "%";
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+#endif // COMMON_NUMA_H
@@ -0,0 +1,301 @@
+#ifndef COMMON_OCL_RUNTIME_H
+#define COMMON_OCL_RUNTIME_H
+
+// Long-lived OpenCL device, context, queue and kernels
+// The runtime is created once per process and hands out kernels by file, name and build options,
+// so repeated calls reuse the same compiled kernels instead of rebuilding the context every time
+// Compiled program binaries are cached on disk, keyed by device, driver, build options and source,
+// and loaded with clCreateProgramWithBinary so later runs skip the source compile entirely
+// The cache directory is ./ocl_cache, or OCL_CACHE_DIR when it is set
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <CL/cl.h>
+
+// Host allocations handed to CL_MEM_USE_HOST_PTR buffers
+// Zero-copy drivers only skip the copy for page aligned memory whose size is a whole number of cache lines,
+// so the size is rounded up to whole pages (which also satisfies aligned_alloc)
+inline void *allocHostBytes(const std::size_t bytes) {
+    const std::size_t page = sysconf(_SC_PAGESIZE);
+    const std::size_t padded = (bytes + page - 1) / page * page;
+    void *ptr = std::aligned_alloc(page, padded > 0 ? padded : page);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+inline int *allocHostBuffer(const std::size_t count) {
+    return static_cast<int *>(allocHostBytes(count * sizeof(int)));
+}
+
+// Allocator for vectors whose data is shared with an OpenCL buffer
+template <typename T>
+struct HostAllocator {
+    using value_type = T;
+
+    HostAllocator() = default;
+    template <typename U>
+    HostAllocator(const HostAllocator<U> &) {}
+
+    T *allocate(const std::size_t count) { return static_cast<T *>(allocHostBytes(count * sizeof(T))); }
+    void deallocate(T *ptr, std::size_t) { std::free(ptr); }
+
+    template <typename U>
+    bool operator==(const HostAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const HostAllocator<U> &) const { return false; }
+};
+
+class OclRuntime {
+public:
+    // Pick a device (GPU first, CPU as a fallback) and create the context and command queue
+    // profiling enables event timestamps (clGetEventProfilingInfo) on the queue
+    explicit OclRuntime(const bool profiling = false) {
+        const char *dir = std::getenv("OCL_CACHE_DIR");
+        cache_dir = dir != nullptr ? dir : "ocl_cache";
+
+        device_id = createDevice();
+        cl_int err;
+
+        // Create the OpenCL context - the virtual container to execute kernel programs
+        ctx = clCreateContext(NULL, 1, &device_id, NULL, NULL, &err);
+        if (err < 0) {
+            perror("Couldn't create a context");
+            exit(1);
+        }
+
+        // Create the command-queue on the device
+        const cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+        cmd_queue = clCreateCommandQueueWithProperties(ctx, device_id, profiling ? properties : NULL, &err);
+        if (err < 0) {
+            perror("Couldn't create a command queue");
+            exit(1);
+        }
+
+        // Device name and driver version - a driver update invalidates cached binaries
+        char name[256] = {0}, driver[256] = {0};
+        clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+        clGetDeviceInfo(device_id, CL_DRIVER_VERSION, sizeof(driver) - 1, driver, NULL);
+        device_key = std::string(name) + " | " + driver;
+    }
+
+    // Release everything created over the lifetime of the runtime
+    ~OclRuntime() {
+        for (auto &entry : kernels) clReleaseKernel(entry.second);
+        for (auto &entry : programs) clReleaseProgram(entry.second);
+        clReleaseCommandQueue(cmd_queue);
+        clReleaseContext(ctx);
+    }
+
+    OclRuntime(const OclRuntime &) = delete;
+    OclRuntime &operator=(const OclRuntime &) = delete;
+
+    cl_device_id device() const { return device_id; }
+    cl_context context() const { return ctx; }
+    cl_command_queue queue() const { return cmd_queue; }
+
+    // Device name and driver version, for keying anything tuned per device
+    const std::string &deviceKey() const { return device_key; }
+
+    // Hash of a kernel source file, for keying anything tuned per kernel - empty when the file can't be read
+    static std::string sourceHash(const std::string &filename) {
+        std::string source;
+        if (!readFile(filename, source)) return "";
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashString(source));
+        return hash;
+    }
+
+    // Kernel from a .cl file built with the given options - built (or loaded from the binary cache) on first use only
+    // The runtime owns the kernel, callers must not release it
+    cl_kernel kernel(const std::string &filename, const std::string &kernel_name, const std::string &options = "") {
+        const std::string key = filename + "\n" + options + "\n" + kernel_name;
+        auto found = kernels.find(key);
+        if (found != kernels.end()) return found->second;
+
+        cl_int err;
+        cl_kernel created = clCreateKernel(program(filename, options), kernel_name.c_str(), &err);
+        if (err < 0) {
+            perror("Couldn't create a kernel");
+            printf("error =%d", err);
+            exit(1);
+        }
+        kernels[key] = created;
+        return created;
+    }
+
+    // Time spent creating and building programs, and how many came from the binary cache
+    long buildMicroseconds() const { return build_us; }
+    int cacheHits() const { return cache_hits; }
+    int cacheMisses() const { return cache_misses; }
+
+private:
+    cl_device_id device_id;
+    cl_context ctx;
+    cl_command_queue cmd_queue;
+    std::string device_key;
+    std::string cache_dir;
+    std::map<std::string, cl_program> programs;
+    std::map<std::string, cl_kernel> kernels;
+    long build_us = 0;
+    int cache_hits = 0;
+    int cache_misses = 0;
+
+    static cl_device_id createDevice() {
+        cl_platform_id platform;
+        cl_device_id dev;
+        int err;
+
+        // Identify a platform
+        err = clGetPlatformIDs(1, &platform, NULL);
+        if (err < 0) {
+            perror("Couldn't identify a platform");
+            exit(1);
+        }
+
+        // Access a device - GPU, then CPU
+        err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU, 1, &dev, NULL);
+        if (err == CL_DEVICE_NOT_FOUND) {
+            printf("GPU not found\n");
+            err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_CPU, 1, &dev, NULL);
+        }
+        if (err < 0) {
+            perror("Couldn't access any devices");
+            exit(1);
+        }
+
+        return dev;
+    }
+
+    // 64-bit FNV-1a, enough to tell sources and options apart in cache file names
+    static std::uint64_t hashString(const std::string &text) {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : text) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static bool readFile(const std::string &path, std::string &contents) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) return false;
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    // Program for a file and set of build options, from memory, the binary cache or the source
+    cl_program program(const std::string &filename, const std::string &options) {
+        const std::string key = filename + "\n" + options;
+        auto found = programs.find(key);
+        if (found != programs.end()) return found->second;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::string source;
+        if (!readFile(filename, source)) {
+            perror("Couldn't find the program file");
+            exit(1);
+        }
+
+        // Cache file name covers everything that changes the compiled binary
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashString(device_key + "\n" + options + "\n" + source));
+        const std::string cache_path = cache_dir + "/" + hash + ".bin";
+
+        cl_program built = loadBinary(cache_path, options);
+        if (built != nullptr) {
+            cache_hits++;
+        }
+        else {
+            cache_misses++;
+            built = buildSource(source, options);
+            saveBinary(built, cache_path);
+        }
+
+        build_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        programs[key] = built;
+        return built;
+    }
+
+    // Program from a cached binary, or nullptr when there is no usable entry
+    cl_program loadBinary(const std::string &path, const std::string &options) {
+        std::string binary;
+        if (!readFile(path, binary) || binary.empty()) return nullptr;
+
+        cl_int err, binary_status;
+        const size_t binary_size = binary.size();
+        const unsigned char *binary_data = (const unsigned char *)binary.data();
+        cl_program loaded = clCreateProgramWithBinary(ctx, 1, &device_id, &binary_size, &binary_data, &binary_status, &err);
+        if (err < 0 || binary_status < 0) {
+            if (loaded != nullptr) clReleaseProgram(loaded);
+            return nullptr;
+        }
+
+        // Binaries still need a build call, which is cheap - a stale or foreign binary falls back to the source
+        if (clBuildProgram(loaded, 0, NULL, options.c_str(), NULL, NULL) < 0) {
+            clReleaseProgram(loaded);
+            return nullptr;
+        }
+        return loaded;
+    }
+
+    cl_program buildSource(const std::string &source, const std::string &options) {
+        cl_int err;
+        const char *source_data = source.c_str();
+        const size_t source_size = source.size();
+
+        // Create program object for the context - arguments: context, count, strings, lengths, error code
+        cl_program built = clCreateProgramWithSource(ctx, 1, &source_data, &source_size, &err);
+        if (err < 0) {
+            perror("Couldn't create the program");
+            exit(1);
+        }
+
+        // Options are passed through to the compiler, e.g. -DMACRO=VALUE
+        err = clBuildProgram(built, 0, NULL, options.c_str(), NULL, NULL);
+        if (err < 0) {
+            // Print the build log
+            size_t log_size;
+            clGetProgramBuildInfo(built, device_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+            std::vector<char> program_log(log_size + 1, '\0');
+            clGetProgramBuildInfo(built, device_id, CL_PROGRAM_BUILD_LOG, log_size + 1, program_log.data(), NULL);
+            printf("%s\n", program_log.data());
+            exit(1);
+        }
+        return built;
+    }
+
+    // Write the device binary to the cache - written to a temporary file and renamed,
+    // so ranks sharing a cache directory never see a partial binary
+    void saveBinary(cl_program built, const std::string &path) {
+        size_t binary_size = 0;
+        clGetProgramInfo(built, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL);
+        if (binary_size == 0) return;
+
+        std::vector<unsigned char> binary(binary_size);
+        unsigned char *binary_data = binary.data();
+        if (clGetProgramInfo(built, CL_PROGRAM_BINARIES, sizeof(binary_data), &binary_data, NULL) < 0) return;
+
+        mkdir(cache_dir.c_str(), 0755);
+        const std::string temp_path = path + ".tmp" + std::to_string(getpid());
+        std::ofstream file(temp_path, std::ios::binary);
+        if (!file) return;
+        file.write((const char *)binary.data(), binary.size());
+        file.close();
+        if (!file || std::rename(temp_path.c_str(), path.c_str()) != 0) std::remove(temp_path.c_str());
+    }
+};
+
+#endif // COMMON_OCL_RUNTIME_H
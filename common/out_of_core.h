@@ -0,0 +1,345 @@
+#ifndef COMMON_OUT_OF_CORE_H
+#define COMMON_OUT_OF_CORE_H
+
+// Out-of-core multiply over tiled matrix files (tiled_matrix.h) - only a memory budget's worth of tiles is ever mapped
+// C tile (i, j) is the sum over p of A tile (i, p) * B tile (p, j); each C tile stays mapped while its p steps run
+// The plan fixes the order of the (i, j, p) steps and, since the whole order is known up front, which tiles to unmap:
+// - Steps sweep C row by row or column by column, whichever re-reads fewer tiles, in a serpentine (boustrophedon)
+//   order - j (or i) reverses on alternate sweeps and p on alternate C tiles, so each turn starts on the tiles it ended on
+// - Eviction is Belady's - the resident tile whose next use is furthest away goes - which is optimal for a fixed order
+// While one step multiplies, a prefetch thread maps the next step's new tiles and faults their pages in, so reads
+// overlap compute; the budget holds room for those two tiles on top of the planned resident set
+// Each call multiplies a range of tile rows of C, so MPI programs give every rank its own rows of tiles
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "freivalds.h"
+#include "gemm.h"
+#include "partition.h"
+#include "thread_pool.h"
+#include "tiled_matrix.h"
+
+// Default memory budget for mapped tiles when --memory is not given, in MiB
+constexpr int default_out_of_core_memory = 256;
+
+// One multiply-accumulate of the plan - C tile (i, j) += A tile (i, p) * B tile (p, j)
+struct TileStep {
+    int i;
+    int j;
+    int p;
+};
+
+// Tiles one step maps, and unmaps to make room for them - a step uses two tiles, so at most two of each
+// Tiles are numbered A tile (i, p) as i * kt + p and B tile (p, j) as mt * kt + p * nt + j
+struct StepTiles {
+    int loads[2];
+    int evictions[2];
+    int load_count = 0;
+    int eviction_count = 0;
+};
+
+// Order of the steps with the tiles each one maps and unmaps
+struct OutOfCorePlan {
+    std::string order;  // "rows" or "cols" - how the steps sweep C
+    std::vector<TileStep> steps;
+    std::vector<StepTiles> tiles;  // Per step
+    int capacity = 0;  // Most tiles of A and B the plan keeps mapped at once
+    long long tile_loads = 0;  // Tile reads of the whole plan
+    long long distinct_tiles = 0;  // Tiles the steps use at all - the fewest reads any order could manage
+};
+
+// Steps over tile rows tile_rows of C (of nt tile columns) and kt tiles of the shared dimension
+// rows = true sweeps C row by row - the row of A tiles is reused across the row of C; false sweeps column by column
+inline std::vector<TileStep> serpentineSteps(const Range &tile_rows, const int kt, const int nt, const bool rows) {
+    std::vector<TileStep> steps;
+    steps.reserve(static_cast<std::size_t>(tile_rows.size()) * nt * kt);
+    const int outer_count = rows ? tile_rows.size() : nt;
+    const int inner_count = rows ? nt : tile_rows.size();
+    bool p_forward = true;
+    for (int outer = 0; outer < outer_count; outer++) {
+        for (int x = 0; x < inner_count; x++) {
+            const int inner = outer % 2 == 0 ? x : inner_count - 1 - x;
+            const int i = tile_rows.start + (rows ? outer : inner);
+            const int j = rows ? inner : outer;
+            for (int y = 0; y < kt; y++) {
+                steps.push_back(TileStep{i, j, p_forward ? y : kt - 1 - y});
+            }
+            p_forward = !p_forward;
+        }
+    }
+    return steps;
+}
+
+// Plan the given steps with at most capacity tiles of A and B mapped, evicting by Belady's rule
+inline OutOfCorePlan planSteps(std::vector<TileStep> steps, const int mt, const int kt, const int nt, const int capacity) {
+    OutOfCorePlan plan;
+    plan.capacity = capacity;
+    const std::size_t count = steps.size();
+    const int a_tiles = mt * kt;
+    auto tileA = [&](const TileStep &s) { return s.i * kt + s.p; };
+    auto tileB = [&](const TileStep &s) { return a_tiles + s.p * nt + s.j; };
+    const int keys = a_tiles + kt * nt;
+
+    // Next step that uses the same A tile, and the same B tile, after each step - never for the last use
+    const long long never = std::numeric_limits<long long>::max();
+    std::vector<long long> next_a(count), next_b(count), seen(keys, never);
+    for (std::size_t s = count; s-- > 0;) {
+        next_a[s] = seen[tileA(steps[s])];
+        next_b[s] = seen[tileB(steps[s])];
+        seen[tileA(steps[s])] = static_cast<long long>(s);
+        seen[tileB(steps[s])] = static_cast<long long>(s);
+    }
+    plan.distinct_tiles = std::count_if(seen.begin(), seen.end(), [never](const long long first) { return first != never; });
+
+    // Resident tiles ordered by next use - the last one is the furthest away
+    std::set<std::pair<long long, int>> resident;
+    std::vector<long long> resident_next(keys, -1);  // -1 when the tile is not mapped
+    plan.tiles.resize(count);
+    for (std::size_t s = 0; s < count; s++) {
+        const int needed[2] = {tileA(steps[s]), tileB(steps[s])};
+        const long long next[2] = {next_a[s], next_b[s]};
+        for (int t = 0; t < 2; t++) {
+            const int key = needed[t];
+            if (resident_next[key] >= 0) {
+                resident.erase({resident_next[key], key});
+            }
+            else {
+                // Make room - the victim must not be the other tile this step uses
+                if (static_cast<int>(resident.size()) >= capacity) {
+                    auto victim = std::prev(resident.end());
+                    while (victim->second == needed[1 - t]) {
+                        victim = std::prev(victim);
+                    }
+                    plan.tiles[s].evictions[plan.tiles[s].eviction_count++] = victim->second;
+                    resident_next[victim->second] = -1;
+                    resident.erase(victim);
+                }
+                plan.tiles[s].loads[plan.tiles[s].load_count++] = key;
+                plan.tile_loads++;
+            }
+            resident_next[key] = next[t];
+            resident.insert({next[t], key});
+        }
+    }
+    plan.steps = std::move(steps);
+    return plan;
+}
+
+// Plan C = A * B over tile rows tile_rows of C - plans both sweeps and keeps the one with fewer tile reads
+inline OutOfCorePlan planOutOfCore(const Range &tile_rows, const int mt, const int kt, const int nt, const int capacity) {
+    if (capacity < 2) {
+        throw std::runtime_error("Out-of-core multiply needs room for at least two tiles of A and B");
+    }
+    OutOfCorePlan by_rows = planSteps(serpentineSteps(tile_rows, kt, nt, true), mt, kt, nt, capacity);
+    OutOfCorePlan by_cols = planSteps(serpentineSteps(tile_rows, kt, nt, false), mt, kt, nt, capacity);
+    by_rows.order = "rows";
+    by_cols.order = "cols";
+    return by_cols.tile_loads < by_rows.tile_loads ? std::move(by_cols) : std::move(by_rows);
+}
+
+// Tiles of A and B a memory budget leaves room for - besides one C tile, the packed B tile and the two tiles
+// a prefetch may map ahead of the plan's evictions
+template <typename T, typename Acc>
+inline int outOfCoreCapacity(const std::size_t memory_bytes, const int tile) {
+    const std::size_t input = static_cast<std::size_t>(tile) * tile * sizeof(T);
+    const std::size_t fixed = static_cast<std::size_t>(tile) * tile * sizeof(Acc) + static_cast<std::size_t>(tile) * packedCols(tile) * sizeof(T);
+    const long long capacity = memory_bytes > fixed ? static_cast<long long>((memory_bytes - fixed) / input) - 2 : 0;
+    return static_cast<int>(std::min<long long>(capacity, std::numeric_limits<int>::max()));
+}
+
+// Prefetch job - map one tile and fault its pages in, so the compute thread finds it resident
+template <typename T>
+struct PrefetchTile {
+    const TiledMatrix<T> *matrix = nullptr;
+    int i = 0;
+    int j = 0;
+    MappedTile<T> *slot = nullptr;
+    std::string error;  // Set when the mapping failed - rethrown on the compute thread
+};
+
+// pthreads function for the prefetcher
+template <typename T>
+void *prefetchTile(void *args) {
+    PrefetchTile<T> *p = static_cast<PrefetchTile<T> *>(args);
+    try {
+        *p->slot = p->matrix->mapTile(p->i, p->j);
+        const std::size_t bytes = p->matrix->tileBytes();
+        const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const char *values = reinterpret_cast<const char *>(p->slot->values());
+        // Start readahead of the whole tile, then read one byte a page - the faults happen here rather than in the multiply
+        char *first_page = reinterpret_cast<char *>(reinterpret_cast<std::uintptr_t>(values) / page * page);
+        madvise(first_page, values + bytes - first_page, MADV_WILLNEED);
+        volatile char sink = 0;
+        for (std::size_t offset = 0; offset < bytes; offset += page) {
+            sink = sink + values[offset];
+        }
+    }
+    catch (const std::exception &e) {
+        p->error = e.what();
+    }
+    return nullptr;
+}
+
+// What a run did - the plan's reads and how long the compute thread waited on the prefetcher
+struct OutOfCoreStats {
+    std::string order;
+    long long steps = 0;
+    long long tile_loads = 0;
+    long long distinct_tiles = 0;
+    int capacity = 0;
+    double stall_us = 0;  // Time spent waiting for tiles that were not prefetched yet
+};
+
+// C = A * B over tile rows tile_rows of C, keeping at most memory_bytes of tiles mapped
+// The tile multiplies run on num_threads OMP threads, the prefetcher on one more thread
+template <typename T, typename Acc>
+OutOfCoreStats outOfCoreMultiply(const TiledMatrix<T> &a, const TiledMatrix<T> &b, const TiledMatrix<Acc> &c, const Range &tile_rows,
+                                 const std::size_t memory_bytes, const int num_threads) {
+    const int tile = a.tile();
+    if (b.tile() != tile || c.tile() != tile) {
+        throw std::runtime_error("A, B and C must use the same tile size");
+    }
+    if (a.cols() != b.rows() || c.rows() != a.rows() || c.cols() != b.cols()) {
+        throw std::runtime_error("Tiled matrices have mismatched shapes");
+    }
+    const int mt = a.tileRows(), kt = a.tileCols(), nt = b.tileCols();
+    const int capacity = outOfCoreCapacity<T, Acc>(memory_bytes, tile);
+    const OutOfCorePlan plan = planOutOfCore(tile_rows, mt, kt, nt, capacity);
+
+    OutOfCoreStats stats;
+    stats.order = plan.order;
+    stats.steps = static_cast<long long>(plan.steps.size());
+    stats.tile_loads = plan.tile_loads;
+    stats.distinct_tiles = plan.distinct_tiles;
+    stats.capacity = plan.capacity;
+
+    // One slot per tile - mapped between the step that loads it and the step that evicts it
+    const int a_tiles = mt * kt;
+    std::vector<MappedTile<T>> mapped(static_cast<std::size_t>(a_tiles) + static_cast<std::size_t>(kt) * nt);
+    std::vector<PrefetchTile<T>> jobs(2);  // A step loads at most two tiles
+    // Declared after the slots and jobs it writes to, so on an exception it finishes its jobs before they are freed
+    ThreadPool prefetcher(1);
+    auto prefetch = [&](const std::size_t s) {
+        for (int t = 0; t < plan.tiles[s].load_count; t++) {
+            const int key = plan.tiles[s].loads[t];
+            const bool is_a = key < a_tiles;
+            jobs[t] = PrefetchTile<T>{is_a ? &a : &b, is_a ? key / kt : (key - a_tiles) / nt, is_a ? key % kt : (key - a_tiles) % nt, &mapped[key], ""};
+            prefetcher.submit(prefetchTile<T>, &jobs[t]);
+        }
+    };
+
+    BasicPackedB<T> packed_b;
+    MappedTile<Acc> c_tile;
+    if (!plan.steps.empty()) {
+        prefetch(0);
+    }
+    for (std::size_t s = 0; s < plan.steps.size(); s++) {
+        const TileStep &step = plan.steps[s];
+
+        // This step's tiles were prefetched during the last one - wait for any still being read
+        const auto wait_start = std::chrono::high_resolution_clock::now();
+        prefetcher.wait();
+        stats.stall_us += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - wait_start).count();
+        for (const PrefetchTile<T> &job : jobs) {
+            if (!job.error.empty()) {
+                throw std::runtime_error(job.error);
+            }
+        }
+        const MappedTile<T> &a_tile = mapped[step.i * kt + step.p];
+        const MappedTile<T> &b_tile = mapped[a_tiles + step.p * nt + step.j];
+
+        const bool first = s == 0 || plan.steps[s - 1].i != step.i || plan.steps[s - 1].j != step.j;
+        const bool last = s + 1 == plan.steps.size() || plan.steps[s + 1].i != step.i || plan.steps[s + 1].j != step.j;
+
+        // Read the next step's new tiles while this one multiplies
+        jobs.assign(2, PrefetchTile<T>{});
+        if (s + 1 < plan.steps.size()) {
+            prefetch(s + 1);
+        }
+
+        // C tile (i, j) is mapped for its run of p steps - the first overwrites it, the rest accumulate
+        if (first) {
+            c_tile = c.mapTile(step.i, step.j);
+        }
+        repackB(packed_b, b_tile.values(), tile, tile, tile, num_threads);
+        gemmPackedThreads(tile, a_tile.values(), tile, packed_b, c_tile.values(), tile, num_threads, !first);
+        if (last) {
+            c_tile.reset();
+        }
+
+        // Unmap what the next step's plan evicts, now that this step no longer needs it
+        if (s + 1 < plan.steps.size()) {
+            for (int t = 0; t < plan.tiles[s + 1].eviction_count; t++) {
+                mapped[plan.tiles[s + 1].evictions[t]].reset();
+            }
+        }
+    }
+    c.sync();
+    return stats;
+}
+
+// Freivalds check of tiled C = A * B, streaming tiles instead of holding any matrix
+// Checks tile rows c_rows of A and C against B * r built from tile rows b_rows of B - reduce(vector) sums the
+// partial vectors over every caller, as in freivaldsBlocks, so MPI ranks can each pass their share of the tiles
+// The vectors run over the padded shape, whose zero padding adds nothing to either side
+template <typename T, typename Acc, typename Reduce>
+FreivaldsResult freivaldsTiled(const TiledMatrix<T> &a, const TiledMatrix<T> &b, const TiledMatrix<Acc> &c, const Range &c_rows,
+                               const Range &b_rows, const int rounds, const std::uint64_t seed, const int num_threads, Reduce reduce) {
+    using V = typename FreivaldsArithmetic<Acc>::type;
+    constexpr bool floating = std::is_floating_point_v<Acc>;
+    const V plus = 1;
+    const V minus = plus - 2;  // -1, or 2^bits - 1 for unsigned - both negate
+    const int tile = a.tile();
+    const int m = a.tileRows() * tile, k = a.tileCols() * tile, n = b.tileCols() * tile;
+    auto block = [tile](const T *values, const int i, const int j) {
+        return MatrixBlock<T>{values, Range{i * tile, (i + 1) * tile}, Range{j * tile, (j + 1) * tile}};
+    };
+
+    const std::vector<V> r = freivaldsVectors<V>(rounds, n, seed);
+    std::vector<V> y(static_cast<std::size_t>(rounds) * k, 0);
+    std::vector<V> y_abs(floating ? y.size() : 0, 0);
+    for (int p = b_rows.start; p < b_rows.end; p++) {
+        for (int j = 0; j < b.tileCols(); j++) {
+            const MappedTile<T> tile_b = b.mapTile(p, j);
+            freivaldsProduct(block(tile_b.values(), p, j), r.data(), floating ? r.data() : nullptr, n, y.data(), y_abs.data(), k,
+                             rounds, plus, num_threads);
+        }
+    }
+    reduce(y);
+    if (floating) {
+        reduce(y_abs);
+    }
+
+    std::vector<V> diff(static_cast<std::size_t>(rounds) * m, 0);
+    std::vector<V> scale(floating ? diff.size() : 0, 0);
+    for (int i = c_rows.start; i < c_rows.end; i++) {
+        for (int p = 0; p < a.tileCols(); p++) {
+            const MappedTile<T> tile_a = a.mapTile(i, p);
+            freivaldsProduct(block(tile_a.values(), i, p), y.data(), floating ? y_abs.data() : nullptr, k, diff.data(), scale.data(), m,
+                             rounds, plus, num_threads);
+        }
+        for (int j = 0; j < c.tileCols(); j++) {
+            const MappedTile<Acc> tile_c = c.mapTile(i, j);
+            const MatrixBlock<Acc> c_block{tile_c.values(), Range{i * tile, (i + 1) * tile}, Range{j * tile, (j + 1) * tile}};
+            freivaldsProduct(c_block, r.data(), static_cast<const V *>(nullptr), n, diff.data(), static_cast<V *>(nullptr), m, rounds,
+                             minus, num_threads);
+        }
+    }
+    reduce(diff);
+    if (floating) {
+        reduce(scale);
+    }
+    return freivaldsCompare<Acc>(m, a.cols(), rounds, diff, scale);
+}
+
+#endif // COMMON_OUT_OF_CORE_H
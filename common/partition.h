@@ -0,0 +1,78 @@
+#ifndef COMMON_PARTITION_H
+#define COMMON_PARTITION_H
+
+// Balanced splitting of rows between threads or ranks
+// The first total % parts workers get one extra row, so no rows are dropped and sizes differ by at most one
+// Weighted splitting gives each worker about the same total cost instead, for rows of uneven cost (sparse rows)
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Half-open range [start, end)
+struct Range {
+    int start;
+    int end;
+
+    int size() const { return end - start; }
+};
+
+// Range of rows owned by worker index out of parts
+inline Range balancedRange(const int total, const int parts, const int index) {
+    const int base = total / parts;
+    const int extra = total % parts;
+    const int start = index * base + (index < extra ? index : extra);
+    return Range{start, start + base + (index < extra ? 1 : 0)};
+}
+
+// Index of the worker whose balanced range contains item
+inline int balancedOwner(const int total, const int parts, const int item) {
+    const int base = total / parts;
+    const int extra = total % parts;
+    // The first extra workers own base + 1 items each, the rest own base
+    if (item < extra * (base + 1)) {
+        return item / (base + 1);
+    }
+    return extra + (item - extra * (base + 1)) / base;
+}
+
+// Element counts and displacements for MPI_Scatterv/MPI_Gatherv when each row holds row_length elements
+inline void balancedCounts(const int total, const int parts, const int row_length,
+                           std::vector<int> &counts, std::vector<int> &displs) {
+    counts.resize(parts);
+    displs.resize(parts);
+    for (int i = 0; i < parts; i++) {
+        const Range rows = balancedRange(total, parts, i);
+        counts[i] = rows.size() * row_length;
+        displs[i] = rows.start * row_length;
+    }
+}
+
+// Range of rows owned by worker index when row i costs prefix[i + 1] - prefix[i]
+// prefix starts at 0 and has one entry more than there are rows - a CSR row pointer works as is
+// Boundaries fall where the running cost first reaches index / parts of the total
+inline Range weightedRange(const std::vector<std::size_t> &prefix, const int parts, const int index) {
+    const int rows = static_cast<int>(prefix.size()) - 1;
+    const double total = static_cast<double>(prefix.back());
+    auto boundary = [&](const int part) {
+        if (part >= parts) return rows;
+        const std::size_t target = static_cast<std::size_t>(total * part / parts);
+        const int row = static_cast<int>(std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin());
+        return std::min(row, rows);
+    };
+    return Range{boundary(index), boundary(index + 1)};
+}
+
+// Element counts and displacements for MPI_Scatterv/MPI_Gatherv over weighted row ranges
+inline void weightedCounts(const std::vector<std::size_t> &prefix, const int parts, const int row_length,
+                           std::vector<int> &counts, std::vector<int> &displs) {
+    counts.resize(parts);
+    displs.resize(parts);
+    for (int i = 0; i < parts; i++) {
+        const Range rows = weightedRange(prefix, parts, i);
+        counts[i] = rows.size() * row_length;
+        displs[i] = rows.start * row_length;
+    }
+}
+
+#endif // COMMON_PARTITION_H
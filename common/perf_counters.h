@@ -0,0 +1,332 @@
+#ifndef COMMON_PERF_COUNTERS_H
+#define COMMON_PERF_COUNTERS_H
+
+// Hardware performance counters around named regions of a program, from Linux perf_event_open
+// A PerfRegion counts cycles, instructions, last level cache misses and data TLB misses of the thread that opens it,
+// from its constructor to its destructor, and adds them to the totals of its name and thread
+// Each thread opens its counters once, as one group, so all four are read together and scaled by the same
+// enabled/running ratio when the kernel multiplexes them
+// Regions do nothing until perfEnable(true), so instrumented programs only pay for counters with --perf
+// Where counters can't be opened (perf_event_paranoid, a VM without a PMU, a seccomp filter) regions still record calls
+// and wall time, and the report says which counters are missing and why
+// IPC and misses per thousand instructions (MPKI) tell the bounds apart - a compute-bound kernel runs at several
+// instructions per cycle with few misses, a memory-bound one stalls at low IPC with high MPKI
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Counters of every region - cycles and instructions give IPC, the misses are normalised per thousand instructions
+constexpr int perf_counter_count = 4;
+
+struct PerfCounterSpec {
+    const char *name;
+    std::uint32_t type;
+    std::uint64_t config;
+};
+
+// Generic events, mapped by the kernel to each CPU's own - cache events encode cache | op << 8 | result << 16
+inline const PerfCounterSpec &perfCounterSpec(const int counter) {
+    static const PerfCounterSpec specs[perf_counter_count] = {
+        {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"LLC misses", PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        {"dTLB misses", PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    };
+    return specs[counter];
+}
+
+// Why perf_event_open failed, in terms of what to change
+inline std::string perfOpenError(const int error) {
+    if (error == EACCES || error == EPERM) {
+        return std::string(std::strerror(error)) + " - lower /proc/sys/kernel/perf_event_paranoid or grant CAP_PERFMON";
+    }
+    if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV) {
+        return "not supported on this host - no hardware PMU, as in many virtual machines";
+    }
+    if (error == ENOSYS) {
+        return "perf_event_open is not available in this kernel";
+    }
+    return std::strerror(error);
+}
+
+// One reading of a thread's counters - valid[i] is false for counters that are not open or were never scheduled
+struct PerfReading {
+    double values[perf_counter_count] = {};
+    bool valid[perf_counter_count] = {};
+};
+
+// Counters of the calling thread, opened as one group on first use and closed when the thread exits
+class PerfThreadCounters {
+public:
+    PerfThreadCounters() {
+        for (int i = 0; i < perf_counter_count; i++) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = perfCounterSpec(i).type;
+            attr.config = perfCounterSpec(i).config;
+            attr.disabled = leader < 0 ? 1 : 0;  // The group starts once every member is in
+            attr.exclude_kernel = 1;  // User-space counts need only perf_event_paranoid <= 2
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0) {
+                errors[i] = perfOpenError(errno);
+                continue;
+            }
+            if (leader < 0) {
+                leader = fd;
+            }
+            fds.push_back(fd);
+            slots[i] = static_cast<int>(fds.size()) - 1;
+        }
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    ~PerfThreadCounters() {
+        for (const int fd : fds) {
+            close(fd);
+        }
+    }
+
+    PerfThreadCounters(const PerfThreadCounters &) = delete;
+    PerfThreadCounters &operator=(const PerfThreadCounters &) = delete;
+
+    // Current counts, scaled up when the group only ran for part of the time it was enabled
+    PerfReading read() const {
+        PerfReading reading;
+        if (leader < 0) {
+            return reading;
+        }
+        std::uint64_t buffer[3 + perf_counter_count];  // nr, time enabled, time running, then one value per member
+        const ssize_t got = ::read(leader, buffer, sizeof(buffer));
+        if (got < static_cast<ssize_t>(3 * sizeof(std::uint64_t)) || buffer[2] == 0) {
+            return reading;  // Never scheduled - nothing to scale
+        }
+        const double scale = static_cast<double>(buffer[1]) / buffer[2];
+        for (int i = 0; i < perf_counter_count; i++) {
+            if (slots[i] >= 0 && static_cast<std::uint64_t>(slots[i]) < buffer[0]) {
+                reading.values[i] = buffer[3 + slots[i]] * scale;
+                reading.valid[i] = true;
+            }
+        }
+        return reading;
+    }
+
+    // Why a counter is not open - empty when it is
+    const std::string &error(const int counter) const { return errors[counter]; }
+
+private:
+    int leader = -1;
+    std::vector<int> fds;
+    int slots[perf_counter_count] = {-1, -1, -1, -1};  // Position of each counter in the group's read, -1 when not open
+    std::string errors[perf_counter_count];
+};
+
+// Calls, wall time and counts of one region on one thread
+struct PerfTotals {
+    long long calls = 0;
+    double seconds = 0;
+    double values[perf_counter_count] = {};
+    bool valid[perf_counter_count] = {true, true, true, true};  // False once any call of the region missed the counter
+};
+
+// Totals of every region on every thread of the process
+class PerfRegistry {
+public:
+    static PerfRegistry &instance() {
+        static PerfRegistry registry;
+        return registry;
+    }
+
+    std::atomic<bool> enabled{false};
+
+    // Small index for a thread, in the order threads first open a region - 0 is usually the main thread
+    int registerThread(const PerfThreadCounters &counters) {
+        std::lock_guard<std::mutex> guard(lock);
+        // Threads open the same counters, so the first thread's outcome stands for all of them
+        if (threads == 0) {
+            for (int i = 0; i < perf_counter_count; i++) {
+                errors[i] = counters.error(i);
+            }
+        }
+        return threads++;
+    }
+
+    void add(const std::string &region, const int thread, const double seconds, const PerfReading &start, const PerfReading &stop) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::map<int, PerfTotals> &per_thread = regions[region];
+        if (per_thread.empty()) {
+            order.push_back(region);
+        }
+        PerfTotals &totals = per_thread[thread];
+        totals.calls++;
+        totals.seconds += seconds;
+        for (int i = 0; i < perf_counter_count; i++) {
+            totals.valid[i] = totals.valid[i] && start.valid[i] && stop.valid[i];
+            totals.values[i] += stop.values[i] - start.values[i];
+        }
+    }
+
+    // Table of every region - one row per thread, and a total row for regions run on several threads
+    std::string report() {
+        std::lock_guard<std::mutex> guard(lock);
+        std::ostringstream out;
+        std::string opened, missing;
+        for (int i = 0; i < perf_counter_count; i++) {
+            if (errors[i].empty()) {
+                opened += std::string(opened.empty() ? "" : ", ") + perfCounterSpec(i).name;
+            }
+            else {
+                missing += std::string("  ") + perfCounterSpec(i).name + ": " + errors[i] + "\n";
+            }
+        }
+        if (opened.empty()) {
+            // Every counter fails the same way when the host has none, so one reason covers them
+            out << "Performance counters unavailable (" << errors[0] << "), regions report wall time only\n";
+        }
+        else {
+            out << "Performance counters: " << opened << "\n" << missing;
+        }
+
+        const auto count = [](const PerfTotals &totals, const int counter) {
+            std::ostringstream text;
+            if (totals.valid[counter]) {
+                text << std::fixed << std::setprecision(0) << totals.values[counter];
+            }
+            else {
+                text << "-";
+            }
+            return text.str();
+        };
+        // value / per, e.g. instructions per cycle or misses per thousand instructions
+        const auto ratio = [](const PerfTotals &totals, const int counter, const int per, const double scale) {
+            std::ostringstream text;
+            if (totals.valid[counter] && totals.valid[per] && totals.values[per] > 0) {
+                text << std::fixed << std::setprecision(2) << scale * totals.values[counter] / totals.values[per];
+            }
+            else {
+                text << "-";
+            }
+            return text.str();
+        };
+        const auto row = [&](const std::string &region, const std::string &thread, const PerfTotals &totals) {
+            out << std::left << std::setw(12) << region << std::right << std::setw(7) << thread << std::setw(8) << totals.calls
+                << std::setw(12) << std::fixed << std::setprecision(3) << totals.seconds * 1e3 << std::setw(16) << count(totals, 0)
+                << std::setw(16) << count(totals, 1) << std::setw(7) << ratio(totals, 1, 0, 1) << std::setw(14) << count(totals, 2)
+                << std::setw(10) << ratio(totals, 2, 1, 1e3) << std::setw(14) << count(totals, 3) << std::setw(10)
+                << ratio(totals, 3, 1, 1e3) << "\n";
+        };
+
+        out << std::left << std::setw(12) << "region" << std::right << std::setw(7) << "thread" << std::setw(8) << "calls"
+            << std::setw(12) << "time_ms" << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(7) << "IPC"
+            << std::setw(14) << "LLC_misses" << std::setw(10) << "LLC_MPKI" << std::setw(14) << "dTLB_misses" << std::setw(10)
+            << "dTLB_MPKI" << "\n";
+        for (const std::string &region : order) {
+            const std::map<int, PerfTotals> &per_thread = regions[region];
+            PerfTotals total;
+            for (const auto &entry : per_thread) {
+                row(region, std::to_string(entry.first), entry.second);
+                total.calls += entry.second.calls;
+                total.seconds += entry.second.seconds;
+                for (int i = 0; i < perf_counter_count; i++) {
+                    total.values[i] += entry.second.values[i];
+                    total.valid[i] = total.valid[i] && entry.second.valid[i];
+                }
+            }
+            if (per_thread.size() > 1) {
+                row(region, "total", total);
+            }
+        }
+        return out.str();
+    }
+
+private:
+    std::mutex lock;
+    std::map<std::string, std::map<int, PerfTotals>> regions;
+    std::vector<std::string> order;  // Regions in the order they first ran
+    std::string errors[perf_counter_count];
+    int threads = 0;
+};
+
+// The calling thread's counters and registry index, set up on the thread's first region
+struct PerfThreadState {
+    PerfThreadCounters counters;
+    int index;
+
+    PerfThreadState() : index(PerfRegistry::instance().registerThread(counters)) {}
+};
+
+inline PerfThreadState &perfThreadState() {
+    static thread_local PerfThreadState state;
+    return state;
+}
+
+// Turn regions on or off for the whole process - off by default
+// Enabling opens the calling thread's counters straight away, so the main thread's first region doesn't pay for it
+inline void perfEnable(const bool enabled) {
+    PerfRegistry::instance().enabled = enabled;
+    if (enabled) {
+        perfThreadState();
+    }
+}
+
+inline bool perfEnabled() {
+    return PerfRegistry::instance().enabled.load(std::memory_order_relaxed);
+}
+
+// Report of every region recorded so far in this process
+inline std::string perfReport() {
+    return PerfRegistry::instance().report();
+}
+
+// Counts of the calling thread between construction and destruction, added to the totals of name
+// Regions must not move between threads, and nested regions each count the whole of their own span
+class PerfRegion {
+public:
+    explicit PerfRegion(const char *name) : name(name), active(perfEnabled()) {
+        if (active) {
+            state = &perfThreadState();
+            start_time = clock::now();
+            start = state->counters.read();
+        }
+    }
+
+    ~PerfRegion() {
+        if (active) {
+            const PerfReading stop = state->counters.read();
+            const double seconds = std::chrono::duration<double>(clock::now() - start_time).count();
+            PerfRegistry::instance().add(name, state->index, seconds, start, stop);
+        }
+    }
+
+    PerfRegion(const PerfRegion &) = delete;
+    PerfRegion &operator=(const PerfRegion &) = delete;
+
+private:
+    using clock = std::chrono::steady_clock;
+    const char *name;
+    bool active;
+    PerfThreadState *state = nullptr;
+    clock::time_point start_time;
+    PerfReading start;
+};
+
+#endif // COMMON_PERF_COUNTERS_H
@@ -0,0 +1,49 @@
+#ifndef COMMON_PERF_COUNTERS_MPI_H
+#define COMMON_PERF_COUNTERS_MPI_H
+
+// Performance counter reports of every process on one rank - each process counts its own threads with
+// perf_counters.h, and the reports are gathered so they print in rank order instead of interleaving
+
+#include <mpi.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "perf_counters.h"
+
+// Every process's perfReport() headed by its rank and host, on root - collective, other ranks get an empty string
+inline std::string mpiPerfReport(MPI_Comm comm, const int root = 0) {
+    int rank, numtasks, name_len;
+    char name[MPI_MAX_PROCESSOR_NAME];
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &numtasks);
+    MPI_Get_processor_name(name, &name_len);
+    const std::string local = "Rank " + std::to_string(rank) + " on " + std::string(name, name_len) + "\n" + perfReport();
+
+    // Lengths first, then the reports back to back
+    int length = static_cast<int>(local.size());
+    std::vector<int> lengths(numtasks), displs(numtasks);
+    MPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, root, comm);
+    int total = 0;
+    for (int i = 0; rank == root && i < numtasks; i++) {
+        displs[i] = total;
+        total += lengths[i];
+    }
+    std::string reports(total, '\0');
+    MPI_Gatherv(local.data(), length, MPI_CHAR, rank == root ? &reports[0] : nullptr, lengths.data(), displs.data(), MPI_CHAR, root, comm);
+    return reports;
+}
+
+// Print the gathered reports on root when regions are enabled - collective, call before MPI_Finalize
+inline void mpiPrintPerfReport(MPI_Comm comm, const int root = 0) {
+    if (!perfEnabled()) {
+        return;
+    }
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    const std::string reports = mpiPerfReport(comm, root);
+    if (rank == root) {
+        std::cout << reports << std::flush;
+    }
+}
+
+#endif // COMMON_PERF_COUNTERS_MPI_H
@@ -0,0 +1,94 @@
+#ifndef COMMON_RANDOM_H
+#define COMMON_RANDOM_H
+
+// Counter-based random numbers for filling input matrices
+// The value at index i of a stream is a pure function of (seed, stream, i) - SplitMix64's mix applied to a Weyl
+// sequence - so there is no generator state to advance and any thread or rank can generate any tile on its own
+// Element (i, j) of a rows x cols matrix always takes index i * cols + j, so a matrix comes out bit-identical
+// whatever the thread count, process count or block decomposition that generated it
+// Fine for test data, not for anything that needs cryptographic or statistical guarantees
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include "cli.h"
+#include "partition.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Streams of the two inputs - A and B share a seed without sharing values
+constexpr std::uint64_t matrix_a_stream = 1;
+constexpr std::uint64_t matrix_b_stream = 2;
+
+// SplitMix64 increment - the golden ratio in 64-bit fixed point
+constexpr std::uint64_t splitmix_gamma = 0x9E3779B97F4A7C15ull;
+
+// SplitMix64 output mix - a bijection in which every input bit affects every output bit
+constexpr std::uint64_t splitmix64(std::uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// One stream of a seed - the value at any index in O(1)
+struct CounterRng {
+    std::uint64_t key;
+
+    CounterRng(const std::uint64_t seed, const std::uint64_t stream) : key(splitmix64(seed + splitmix64(stream))) {}
+
+    // 64 random bits at index
+    std::uint64_t operator()(const std::uint64_t index) const {
+        return splitmix64(key + (index + 1) * splitmix_gamma);
+    }
+
+    // Integer in [low, high] at index - the top 32 bits are scaled onto the range with a multiply rather than a modulo
+    int uniformInt(const std::uint64_t index, const int low, const int high) const {
+        const std::uint64_t range = static_cast<std::uint64_t>(static_cast<std::int64_t>(high) - low) + 1;
+        return static_cast<int>(low + static_cast<std::int64_t>(((*this)(index) >> 32) * range >> 32));
+    }
+};
+
+// Seed from --seed, or a fresh one from the OS when it is not given - programs print it so a run can be repeated
+inline std::uint64_t seedOption(const int argc, char **argv) {
+    const char *value = findOption(argc, argv, "--seed");
+    if (value != nullptr) {
+        return std::strtoull(value, nullptr, 0);
+    }
+    std::random_device device;
+    return static_cast<std::uint64_t>(device()) << 32 | device();
+}
+
+// Fill rows block_rows and columns block_cols of a matrix with cols columns with integers in [low, high]
+// dest holds just the block, row-major with block_cols.size() per row
+// The rows are split between num_threads OMP threads in the balanced slices the multiplies use, so on a fresh
+// allocation each thread first-touches - and places on its own NUMA node - the rows it will later read
+template <typename T>
+void fillRandomBlock(T *dest, const int cols, const Range &block_rows, const Range &block_cols,
+                     const CounterRng &rng, const int low, const int high, [[maybe_unused]] const int num_threads = 1) {
+    const std::size_t width = block_cols.size();
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const Range slice = balancedRange(block_rows.size(), omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range slice{0, block_rows.size()};
+#endif
+        for (int i = block_rows.start + slice.start; i < block_rows.start + slice.end; i++) {
+            T *row = dest + static_cast<std::size_t>(i - block_rows.start) * width;
+            const std::uint64_t first = static_cast<std::uint64_t>(i) * cols + block_cols.start;
+            for (std::size_t j = 0; j < width; j++) {
+                row[j] = static_cast<T>(rng.uniformInt(first + j, low, high));
+            }
+        }
+    }
+}
+
+// Fill a whole rows x cols matrix
+template <typename T>
+void fillRandom(T *dest, const int rows, const int cols, const CounterRng &rng, const int low, const int high, const int num_threads = 1) {
+    fillRandomBlock(dest, cols, Range{0, rows}, Range{0, cols}, rng, low, high, num_threads);
+}
+
+#endif // COMMON_RANDOM_H
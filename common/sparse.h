@@ -0,0 +1,300 @@
+#ifndef COMMON_SPARSE_H
+#define COMMON_SPARSE_H
+
+// Compressed sparse row (CSR) and column (CSC) matrices with parallel multiplies
+// Only the non-zeros are stored - a matrix that is 95% zeros takes about a tenth of the dense memory,
+// and every multiply skips the zeros instead of multiplying through them
+// SpMM is sparse x dense (CSR A) or dense x sparse (CSC B), SpGEMM is sparse x sparse (CSR x CSR)
+// Threads split the rows by non-zeros (SpMM) or by multiply-adds (SpGEMM) rather than by row count,
+// so a few dense rows do not leave the other threads idle
+
+#include <algorithm>
+#include <cstddef>
+#include <random>
+#include <vector>
+#include "matrix.h"
+#include "partition.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Row i holds values[row_ptr[i] .. row_ptr[i + 1]) in columns col_idx[...], sorted by column
+template <typename T>
+struct CsrMatrix {
+    int rows = 0;
+    int cols = 0;
+    std::vector<std::size_t> row_ptr;  // rows + 1 offsets, starting at 0
+    std::vector<int> col_idx;
+    std::vector<T> values;
+
+    std::size_t nnz() const { return values.size(); }
+
+    // Bytes held by the three arrays
+    std::size_t bytes() const {
+        return row_ptr.size() * sizeof(std::size_t) + col_idx.size() * sizeof(int) + values.size() * sizeof(T);
+    }
+};
+
+// Column j holds values[col_ptr[j] .. col_ptr[j + 1]) in rows row_idx[...], sorted by row
+template <typename T>
+struct CscMatrix {
+    int rows = 0;
+    int cols = 0;
+    std::vector<std::size_t> col_ptr;  // cols + 1 offsets, starting at 0
+    std::vector<int> row_idx;
+    std::vector<T> values;
+
+    std::size_t nnz() const { return values.size(); }
+
+    std::size_t bytes() const {
+        return col_ptr.size() * sizeof(std::size_t) + row_idx.size() * sizeof(int) + values.size() * sizeof(T);
+    }
+};
+
+// Random rows x cols CSR matrix where each entry is non-zero with probability density
+// Column gaps are drawn from a geometric distribution, so the cost is proportional to the non-zeros, not rows x cols
+// Values come from distrib, which should not produce zero
+template <typename T, typename Generator, typename Distribution>
+CsrMatrix<T> randomCsr(const int rows, const int cols, const double density, Generator &gen, Distribution &distrib) {
+    CsrMatrix<T> a;
+    a.rows = rows;
+    a.cols = cols;
+    a.row_ptr.assign(rows + 1, 0);
+    a.col_idx.reserve(static_cast<std::size_t>(static_cast<double>(rows) * cols * std::min(density, 1.0) * 1.05) + 16);
+    a.values.reserve(a.col_idx.capacity());
+
+    // A density of 1 or more fills every column - the geometric distribution needs 0 < p < 1
+    const bool dense = density >= 1;
+    std::geometric_distribution<int> gap(dense ? 0.5 : std::max(density, 1e-12));
+    for (int i = 0; i < rows; i++) {
+        if (dense) {
+            for (int j = 0; j < cols; j++) {
+                a.col_idx.push_back(j);
+                a.values.push_back(static_cast<T>(distrib(gen)));
+            }
+        }
+        else if (density > 0) {
+            for (long long j = gap(gen); j < cols; j += 1 + gap(gen)) {
+                a.col_idx.push_back(static_cast<int>(j));
+                a.values.push_back(static_cast<T>(distrib(gen)));
+            }
+        }
+        a.row_ptr[i + 1] = a.values.size();
+    }
+    return a;
+}
+
+// CSR copy of a dense matrix, dropping zeros
+template <typename T>
+CsrMatrix<T> denseToCsr(const BasicMatrix<T> &dense) {
+    CsrMatrix<T> a;
+    a.rows = dense.rows;
+    a.cols = dense.cols;
+    a.row_ptr.assign(dense.rows + 1, 0);
+    for (int i = 0; i < dense.rows; i++) {
+        for (int j = 0; j < dense.cols; j++) {
+            if (dense(i, j) != T(0)) {
+                a.col_idx.push_back(j);
+                a.values.push_back(dense(i, j));
+            }
+        }
+        a.row_ptr[i + 1] = a.values.size();
+    }
+    return a;
+}
+
+// Dense copy of a CSR matrix
+template <typename T>
+BasicMatrix<T> csrToDense(const CsrMatrix<T> &a) {
+    BasicMatrix<T> dense(a.rows, a.cols);
+    for (int i = 0; i < a.rows; i++) {
+        for (std::size_t p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++) {
+            dense(i, a.col_idx[p]) = a.values[p];
+        }
+    }
+    return dense;
+}
+
+// CSC copy of a CSR matrix - a counting sort of the non-zeros by column, which keeps rows sorted within each column
+template <typename T>
+CscMatrix<T> csrToCsc(const CsrMatrix<T> &a) {
+    CscMatrix<T> b;
+    b.rows = a.rows;
+    b.cols = a.cols;
+    b.col_ptr.assign(a.cols + 1, 0);
+    b.row_idx.resize(a.nnz());
+    b.values.resize(a.nnz());
+
+    for (const int j : a.col_idx) {
+        b.col_ptr[j + 1]++;
+    }
+    for (int j = 0; j < a.cols; j++) {
+        b.col_ptr[j + 1] += b.col_ptr[j];
+    }
+
+    std::vector<std::size_t> next(b.col_ptr.begin(), b.col_ptr.end() - 1);
+    for (int i = 0; i < a.rows; i++) {
+        for (std::size_t p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++) {
+            const std::size_t q = next[a.col_idx[p]]++;
+            b.row_idx[q] = i;
+            b.values[q] = a.values[p];
+        }
+    }
+    return b;
+}
+
+// Rows [row_start, row_end) of C = A * B for CSR A (m x k) and dense B (k x n)
+// Each non-zero a_ij adds a_ij times row j of B to row i of C - contiguous rows the compiler vectorises
+// c points at row row_start of C, so a rank can pass just its own slice
+template <typename T, typename Acc>
+inline void spmmRows(const CsrMatrix<T> &a, const T *b, const int ldb, const int n, Acc *c, const int ldc,
+                     const int row_start, const int row_end) {
+    for (int i = row_start; i < row_end; i++) {
+        Acc *c_row = c + static_cast<std::size_t>(i - row_start) * ldc;
+        std::fill(c_row, c_row + n, Acc(0));
+        for (std::size_t p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++) {
+            const Acc a_ij = static_cast<Acc>(a.values[p]);
+            const T *b_row = b + static_cast<std::size_t>(a.col_idx[p]) * ldb;
+            for (int j = 0; j < n; j++) {
+                c_row[j] += a_ij * static_cast<Acc>(b_row[j]);
+            }
+        }
+    }
+}
+
+// C = A * B for CSR A, with the rows split by non-zeros between num_threads OMP threads
+// by_nnz = false splits by row count instead, for comparison
+template <typename T, typename Acc>
+inline void spmm(const CsrMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c, [[maybe_unused]] const int num_threads, const bool by_nnz = true) {
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const int parts = omp_get_num_threads(), index = omp_get_thread_num();
+#else
+        const int parts = 1, index = 0;
+#endif
+        const Range rows = by_nnz ? weightedRange(a.row_ptr, parts, index) : balancedRange(a.rows, parts, index);
+        spmmRows(a, b.data(), b.cols, b.cols, c.row(rows.start), c.cols, rows.start, rows.end);
+    }
+}
+
+// C = A * B for dense A (m x k) and CSC B (k x n), with the columns of C split by non-zeros of B between threads
+// Each C[i][j] is the dot product of row i of A with the non-zeros of column j
+template <typename T, typename Acc>
+inline void spmmCsc(const BasicMatrix<T> &a, const CscMatrix<T> &b, BasicMatrix<Acc> &c, [[maybe_unused]] const int num_threads) {
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const Range cols = weightedRange(b.col_ptr, omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range cols{0, b.cols};
+#endif
+        for (int i = 0; i < a.rows; i++) {
+            const T *a_row = a.row(i);
+            Acc *c_row = c.row(i);
+            for (int j = cols.start; j < cols.end; j++) {
+                Acc sum = 0;
+                for (std::size_t p = b.col_ptr[j]; p < b.col_ptr[j + 1]; p++) {
+                    sum += static_cast<Acc>(a_row[b.row_idx[p]]) * static_cast<Acc>(b.values[p]);
+                }
+                c_row[j] = sum;
+            }
+        }
+    }
+}
+
+// Multiply-adds needed for each row of A * B, as a prefix sum for weightedRange
+template <typename T>
+inline std::vector<std::size_t> spgemmWork(const CsrMatrix<T> &a, const CsrMatrix<T> &b) {
+    std::vector<std::size_t> work(a.rows + 1, 0);
+    for (int i = 0; i < a.rows; i++) {
+        std::size_t row_work = 0;
+        for (std::size_t p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++) {
+            row_work += b.row_ptr[a.col_idx[p] + 1] - b.row_ptr[a.col_idx[p]];
+        }
+        work[i + 1] = work[i] + row_work;
+    }
+    return work;
+}
+
+// C = A * B for CSR A and B (Gustavson's row-by-row algorithm), rows split by multiply-adds between threads
+// A symbolic pass counts the non-zeros of each row of C so the numeric pass writes straight into place,
+// each thread keeping a dense accumulator and a marker of which columns the current row has touched
+// Entries that cancel to zero are kept, so the structure does not depend on the values
+template <typename T, typename Acc>
+CsrMatrix<Acc> spgemm(const CsrMatrix<T> &a, const CsrMatrix<T> &b, [[maybe_unused]] const int num_threads) {
+    const std::vector<std::size_t> work = spgemmWork(a, b);
+
+    CsrMatrix<Acc> c;
+    c.rows = a.rows;
+    c.cols = b.cols;
+    c.row_ptr.assign(a.rows + 1, 0);
+
+    // Symbolic pass - distinct columns of each row of C
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const Range rows = weightedRange(work, omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range rows{0, a.rows};
+#endif
+        std::vector<int> marker(b.cols, -1);
+        for (int i = rows.start; i < rows.end; i++) {
+            std::size_t count = 0;
+            for (std::size_t p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++) {
+                const int k = a.col_idx[p];
+                for (std::size_t q = b.row_ptr[k]; q < b.row_ptr[k + 1]; q++) {
+                    if (marker[b.col_idx[q]] != i) {
+                        marker[b.col_idx[q]] = i;
+                        count++;
+                    }
+                }
+            }
+            c.row_ptr[i + 1] = count;
+        }
+    }
+    for (int i = 0; i < a.rows; i++) {
+        c.row_ptr[i + 1] += c.row_ptr[i];
+    }
+    c.col_idx.resize(c.row_ptr[a.rows]);
+    c.values.resize(c.row_ptr[a.rows]);
+
+    // Numeric pass - accumulate each row densely, then write it out in column order
+    #pragma omp parallel num_threads(num_threads) if (num_threads > 1)
+    {
+#ifdef _OPENMP
+        const Range rows = weightedRange(work, omp_get_num_threads(), omp_get_thread_num());
+#else
+        const Range rows{0, a.rows};
+#endif
+        std::vector<Acc> acc(b.cols, Acc(0));
+        std::vector<int> marker(b.cols, -1);
+        for (int i = rows.start; i < rows.end; i++) {
+            const std::size_t row_start = c.row_ptr[i];
+            std::size_t pos = row_start;
+            for (std::size_t p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++) {
+                const Acc a_ik = static_cast<Acc>(a.values[p]);
+                const int k = a.col_idx[p];
+                for (std::size_t q = b.row_ptr[k]; q < b.row_ptr[k + 1]; q++) {
+                    const int j = b.col_idx[q];
+                    if (marker[j] != i) {
+                        marker[j] = i;
+                        c.col_idx[pos++] = j;
+                        acc[j] = a_ik * static_cast<Acc>(b.values[q]);
+                    }
+                    else {
+                        acc[j] += a_ik * static_cast<Acc>(b.values[q]);
+                    }
+                }
+            }
+            std::sort(c.col_idx.begin() + row_start, c.col_idx.begin() + pos);
+            for (std::size_t q = row_start; q < pos; q++) {
+                c.values[q] = acc[c.col_idx[q]];
+            }
+        }
+    }
+    return c;
+}
+
+#endif // COMMON_SPARSE_H
@@ -0,0 +1,260 @@
+#ifndef COMMON_STRASSEN_H
+#define COMMON_STRASSEN_H
+
+// Strassen-Winograd multiplication for large products, built on the packed GEMM in gemm.h
+// Each level splits A, B and C into quadrants and forms C from 7 half-size products instead of 8 (15 block additions),
+// recursing until the smallest dimension is at most the cutoff and then handing the leaf to gemmPacked
+// Everything is computed in the accumulator type, so integer results match the blocked kernel exactly
+// as long as the intermediate sums (a few times the size of the elements) fit in Acc
+// The 7 products of the top levels run as OMP tasks, and every temporary is carved out of one workspace
+// sized and allocated before the recursion starts - nothing is allocated per level
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <random>
+#include <type_traits>
+#include "gemm.h"
+#include "matrix.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Elements rounded up to whole cache lines, so every buffer carved from the workspace stays aligned
+template <typename Acc>
+inline std::size_t strassenChunk(const std::size_t count) {
+    constexpr std::size_t per_line = matrix_alignment / sizeof(Acc);
+    return (count + per_line - 1) / per_line * per_line;
+}
+
+// Workspace elements for an m x k by k x n product recursing levels deep
+// Each level holds 4 sums of A, 4 sums of B and the 7 products - task levels give every product its own
+// workspace for the level below, sequential levels reuse one
+template <typename Acc>
+inline std::size_t strassenWorkspace(const int m, const int k, const int n, const int levels, const int task_levels) {
+    if (levels == 0) {
+        return strassenChunk<Acc>(static_cast<std::size_t>(k) * packedCols(n));  // Packed B of the leaf product
+    }
+    const std::size_t hm = m / 2, hk = k / 2, hn = n / 2;
+    const std::size_t own = 4 * strassenChunk<Acc>(hm * hk) + 4 * strassenChunk<Acc>(hk * hn) + 7 * strassenChunk<Acc>(hm * hn);
+    const std::size_t child = strassenWorkspace<Acc>(hm, hk, hn, levels - 1, std::max(task_levels - 1, 0));
+    return own + (task_levels > 0 ? 7 : 1) * child;
+}
+
+// out = x + y (or x - y) over a rows x cols block - out may alias x
+template <typename Acc>
+inline void addBlocks(const int rows, const int cols, const Acc *x, const int ldx, const Acc *y, const int ldy,
+                      Acc *out, const int ldo, const bool subtract = false) {
+    for (int i = 0; i < rows; i++) {
+        const Acc *x_row = x + static_cast<std::size_t>(i) * ldx;
+        const Acc *y_row = y + static_cast<std::size_t>(i) * ldy;
+        Acc *out_row = out + static_cast<std::size_t>(i) * ldo;
+        for (int j = 0; j < cols; j++) {
+            out_row[j] = subtract ? x_row[j] - y_row[j] : x_row[j] + y_row[j];
+        }
+    }
+}
+
+// C = A * B for m x k and k x n blocks whose dimensions are divisible by 2^levels
+// The top task_levels levels run their 7 products as OMP tasks - must be called from inside a parallel region for that
+template <typename Acc>
+void strassenRecurse(const int m, const int k, const int n, const Acc *a, const int lda, const Acc *b, const int ldb,
+                     Acc *c, const int ldc, Acc *workspace, const int levels, const int task_levels) {
+    // Leaf - blocked kernel, with B packed into the workspace instead of a fresh allocation
+    if (levels == 0) {
+        BasicPackedB<Acc> packed_b;
+        packed_b.rows = k;
+        packed_b.cols = n;
+        packed_b.padded_cols = packedCols(n);
+        packed_b.values = workspace;
+        packBInto(b, ldb, k, n, workspace, 1);  // Leaves run as tasks, one thread each
+        gemmPacked(m, a, lda, packed_b, c, ldc);
+        return;
+    }
+
+    const int hm = m / 2, hk = k / 2, hn = n / 2;
+
+    // Quadrants of the inputs and output
+    const Acc *a11 = a, *a12 = a + hk, *a21 = a + static_cast<std::size_t>(hm) * lda, *a22 = a21 + hk;
+    const Acc *b11 = b, *b12 = b + hn, *b21 = b + static_cast<std::size_t>(hk) * ldb, *b22 = b21 + hn;
+    Acc *c11 = c, *c12 = c + hn, *c21 = c + static_cast<std::size_t>(hm) * ldc, *c22 = c21 + hn;
+
+    // Carve this level's temporaries from the front of the workspace - sums are hm x hk or hk x hn, products hm x hn
+    Acc *next = workspace;
+    auto take = [&next](const std::size_t count) {
+        Acc *block = next;
+        next += strassenChunk<Acc>(count);
+        return block;
+    };
+    Acc *s[4], *t[4], *p[7];
+    for (auto &block : s) block = take(static_cast<std::size_t>(hm) * hk);
+    for (auto &block : t) block = take(static_cast<std::size_t>(hk) * hn);
+    for (auto &block : p) block = take(static_cast<std::size_t>(hm) * hn);
+
+    // Winograd's sums - S1 = A21 + A22, S2 = S1 - A11, S3 = A11 - A21, S4 = A12 - S2
+    addBlocks(hm, hk, a21, lda, a22, lda, s[0], hk);
+    addBlocks(hm, hk, s[0], hk, a11, lda, s[1], hk, true);
+    addBlocks(hm, hk, a11, lda, a21, lda, s[2], hk, true);
+    addBlocks(hm, hk, a12, lda, s[1], hk, s[3], hk, true);
+    // T1 = B12 - B11, T2 = B22 - T1, T3 = B22 - B12, T4 = T2 - B21
+    addBlocks(hk, hn, b12, ldb, b11, ldb, t[0], hn, true);
+    addBlocks(hk, hn, b22, ldb, t[0], hn, t[1], hn, true);
+    addBlocks(hk, hn, b22, ldb, b12, ldb, t[2], hn, true);
+    addBlocks(hk, hn, t[1], hn, b21, ldb, t[3], hn, true);
+
+    // The 7 products - M1 = A11 B11, M2 = A12 B21, M3 = S4 B22, M4 = A22 T4, M5 = S1 T1, M6 = S2 T2, M7 = S3 T3
+    const Acc *left[7] = {a11, a12, s[3], a22, s[0], s[1], s[2]};
+    const int ld_left[7] = {lda, lda, hk, lda, hk, hk, hk};
+    const Acc *right[7] = {b11, b21, b22, t[3], t[0], t[1], t[2]};
+    const int ld_right[7] = {ldb, ldb, ldb, hn, hn, hn, hn};
+    const std::size_t child = strassenWorkspace<Acc>(hm, hk, hn, levels - 1, std::max(task_levels - 1, 0));
+
+    if (task_levels > 0) {
+        for (int q = 0; q < 7; q++) {
+            #pragma omp task firstprivate(q) shared(left, ld_left, right, ld_right, p)
+            strassenRecurse(hm, hk, hn, left[q], ld_left[q], right[q], ld_right[q], p[q], hn,
+                            next + q * child, levels - 1, task_levels - 1);
+        }
+        #pragma omp taskwait
+    }
+    else {
+        for (int q = 0; q < 7; q++) {
+            strassenRecurse(hm, hk, hn, left[q], ld_left[q], right[q], ld_right[q], p[q], hn, next, levels - 1, 0);
+        }
+    }
+
+    // Combine - U2 = M1 + M6, U3 = U2 + M7, U4 = U2 + M5
+    // C11 = M1 + M2, C12 = U4 + M3, C21 = U3 - M4, C22 = U3 + M5
+    addBlocks(hm, hn, p[5], hn, p[0], hn, p[5], hn);
+    addBlocks(hm, hn, p[6], hn, p[5], hn, p[6], hn);
+    addBlocks(hm, hn, p[5], hn, p[4], hn, p[5], hn);
+    addBlocks(hm, hn, p[0], hn, p[1], hn, c11, ldc);
+    addBlocks(hm, hn, p[5], hn, p[2], hn, c12, ldc);
+    addBlocks(hm, hn, p[6], hn, p[3], hn, c21, ldc, true);
+    addBlocks(hm, hn, p[6], hn, p[4], hn, c22, ldc);
+}
+
+// c = a * b by Strassen-Winograd down to leaves of at most cutoff rows/columns in the smallest dimension
+// Dimensions are zero padded up to a multiple of 2^levels, and inputs are widened to Acc when T is narrower
+// Products too small to recurse go straight to the blocked kernel
+template <typename T, typename Acc>
+void strassenMultiply(const BasicMatrix<T> &a, const BasicMatrix<T> &b, BasicMatrix<Acc> &c, const int cutoff, const int num_threads) {
+    const int m = a.rows, k = a.cols, n = b.cols;
+
+    // Levels of recursion - halve until the smallest dimension fits in a leaf
+    // Leaves below a few register tiles would be all overhead, so tiny cutoffs are raised
+    const int leaf = std::max(cutoff, 4 * gemm_nr);
+    const int smallest = std::min({m, k, n});
+    int levels = 0;
+    while (((smallest + (1 << levels) - 1) >> levels) > leaf) {
+        levels++;
+    }
+
+    if (levels == 0) {
+        const BasicPackedB<T> packed_b = packB(b, num_threads);
+        gemmPackedThreads(m, a.data(), a.cols, packed_b, c.data(), c.cols, num_threads);
+        return;
+    }
+
+    // Enough task levels to give every thread a product (7 per level)
+    int task_levels = 0;
+#ifdef _OPENMP
+    for (int tasks = 1; tasks < num_threads && task_levels < levels; tasks *= 7) {
+        task_levels++;
+    }
+#endif
+
+    // Padded sizes, and copies of A, B and C only when padding or widening needs them
+    const int unit = 1 << levels;
+    const int mp = (m + unit - 1) / unit * unit;
+    const int kp = (k + unit - 1) / unit * unit;
+    const int np = (n + unit - 1) / unit * unit;
+    const bool padded = mp != m || kp != k || np != n;
+    const bool copy_inputs = padded || !std::is_same_v<T, Acc>;
+
+    BasicMatrix<Acc> a_copy, b_copy, c_copy;
+    if (copy_inputs) {
+        a_copy = BasicMatrix<Acc>(mp, kp);
+        b_copy = BasicMatrix<Acc>(kp, np);
+        for (int i = 0; i < m; i++) std::copy(a.row(i), a.row(i) + k, a_copy.row(i));
+        for (int i = 0; i < k; i++) std::copy(b.row(i), b.row(i) + n, b_copy.row(i));
+    }
+    if (padded) {
+        c_copy = BasicMatrix<Acc>(mp, np);
+    }
+
+    const Acc *a_in, *b_in;
+    if constexpr (std::is_same_v<T, Acc>) {
+        a_in = copy_inputs ? a_copy.data() : a.data();
+        b_in = copy_inputs ? b_copy.data() : b.data();
+    }
+    else {
+        a_in = a_copy.data();
+        b_in = b_copy.data();
+    }
+    Acc *c_out = padded ? c_copy.data() : c.data();
+
+    // The whole recursion's temporaries in one allocation
+    const std::size_t workspace_size = strassenWorkspace<Acc>(mp, kp, np, levels, task_levels);
+    Acc *workspace_data = allocAligned<Acc>(workspace_size);
+
+    #pragma omp parallel num_threads(num_threads) if (task_levels > 0)
+    {
+        #pragma omp single
+        strassenRecurse(mp, kp, np, a_in, kp, b_in, np, c_out, np, workspace_data, levels, task_levels);
+    }
+    freeBytes(workspace_data);
+
+    if (padded) {
+        for (int i = 0; i < m; i++) std::copy(c_copy.row(i), c_copy.row(i) + n, c.row(i));
+    }
+}
+
+// Smallest leaf size at which one level of Strassen beats the blocked kernel on this machine
+// Times both on 2 * cutoff square products for each candidate and keeps the first cutoff where Strassen wins
+template <typename Acc>
+inline int tuneStrassenCutoff(const int num_threads) {
+    constexpr int candidates[] = {64, 128, 256, 512};
+    std::minstd_rand gen(1);
+    std::uniform_int_distribution<int> distrib(1, 100);
+
+    for (const int cutoff : candidates) {
+        const int size = 2 * cutoff;
+        BasicMatrix<Acc> a(size, size), b(size, size), c(size, size);
+        for (std::size_t i = 0; i < a.size(); i++) {
+            a.data()[i] = static_cast<Acc>(distrib(gen));
+            b.data()[i] = static_cast<Acc>(distrib(gen));
+        }
+
+        // Best of a few runs, so a page fault or a stray interrupt does not decide the comparison
+        auto best = [](auto &&run) {
+            long best_us = -1;
+            for (int trial = 0; trial < 3; trial++) {
+                const auto start = std::chrono::high_resolution_clock::now();
+                run();
+                const long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+                best_us = best_us < 0 ? us : std::min(best_us, us);
+            }
+            return best_us;
+        };
+        const long blocked_us = best([&] {
+            const BasicPackedB<Acc> packed_b = packB(b, num_threads);
+            gemmPackedThreads(size, a.data(), size, packed_b, c.data(), size, num_threads);
+        });
+        const long strassen_us = best([&] { strassenMultiply(a, b, c, cutoff, num_threads); });
+        if (strassen_us < blocked_us) {
+            return cutoff;
+        }
+    }
+    return 2 * candidates[3];
+}
+
+// Cutoff tuned once per accumulator type, on the first call
+template <typename Acc>
+inline int strassenCutoff(const int num_threads) {
+    static const int cutoff = tuneStrassenCutoff<Acc>(num_threads);
+    return cutoff;
+}
+
+#endif // COMMON_STRASSEN_H
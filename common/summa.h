@@ -0,0 +1,128 @@
+#ifndef COMMON_SUMMA_H
+#define COMMON_SUMMA_H
+
+// SUMMA (Scalable Universal Matrix Multiplication Algorithm) on a 2D process grid
+// Ranks form a grid_rows x grid_cols Cartesian grid and each holds only its own block of A, B and C,
+// so per-rank memory is O(n^2 / p) instead of a full copy of B
+// For each panel of the shared dimension, the owning grid column broadcasts its columns of A along
+// each grid row and the owning grid row broadcasts its rows of B down each grid column, then every
+// rank accumulates C_block += A_panel * B_panel locally with the packed kernel
+// Blocks use balancedRange, so the matrix size does not need to divide by the grid dimensions
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <mpi.h>
+#include "gemm.h"
+#include "partition.h"
+
+// Default width of the k panels broadcast each SUMMA step - matches the packed kernel's k slice
+constexpr int summa_panel_width = block_k;
+
+// 2D Cartesian process grid with communicators for the ranks sharing a grid row or a grid column
+struct ProcessGrid {
+    MPI_Comm comm = MPI_COMM_NULL;  // Cartesian communicator over every rank
+    MPI_Comm row_comm = MPI_COMM_NULL;  // Ranks in my grid row, ranked by grid column
+    MPI_Comm col_comm = MPI_COMM_NULL;  // Ranks in my grid column, ranked by grid row
+    int rows = 1;
+    int cols = 1;
+    int my_row = 0;
+    int my_col = 0;
+};
+
+// Build the most square grid MPI_Dims_create can find for the ranks in comm
+inline ProcessGrid createProcessGrid(MPI_Comm comm) {
+    ProcessGrid grid;
+    int numtasks;
+    MPI_Comm_size(comm, &numtasks);
+
+    int dims[2] = {0, 0};
+    int periods[2] = {0, 0};
+    MPI_Dims_create(numtasks, 2, dims);
+    MPI_Cart_create(comm, 2, dims, periods, 0, &grid.comm);
+    grid.rows = dims[0];
+    grid.cols = dims[1];
+
+    int rank, coords[2];
+    MPI_Comm_rank(grid.comm, &rank);
+    MPI_Cart_coords(grid.comm, rank, 2, coords);
+    grid.my_row = coords[0];
+    grid.my_col = coords[1];
+
+    // Keep dimension 1 for the row communicator, dimension 0 for the column communicator
+    int keep_cols[2] = {0, 1};
+    int keep_rows[2] = {1, 0};
+    MPI_Cart_sub(grid.comm, keep_cols, &grid.row_comm);
+    MPI_Cart_sub(grid.comm, keep_rows, &grid.col_comm);
+    return grid;
+}
+
+inline void freeProcessGrid(ProcessGrid &grid) {
+    MPI_Comm_free(&grid.row_comm);
+    MPI_Comm_free(&grid.col_comm);
+    MPI_Comm_free(&grid.comm);
+}
+
+// Rows and columns of a rows x cols matrix owned by this rank's block
+struct BlockRange {
+    Range rows;
+    Range cols;
+};
+
+inline BlockRange localBlock(const ProcessGrid &grid, const int rows, const int cols) {
+    return BlockRange{balancedRange(rows, grid.rows, grid.my_row), balancedRange(cols, grid.cols, grid.my_col)};
+}
+
+// C (m x n) = A (m x k) * B (k x n) with every matrix distributed in blocks over the grid
+// a_local, b_local and c_local are this rank's row-major blocks as given by localBlock for each matrix
+inline void summaMultiply(const ProcessGrid &grid, const int m, const int k, const int n,
+                          const int *a_local, const int *b_local, int *c_local,
+                          const int num_threads = 1, const int panel_width = summa_panel_width) {
+    const BlockRange a_block = localBlock(grid, m, k);
+    const BlockRange b_block = localBlock(grid, k, n);
+    const int local_m = a_block.rows.size();
+    const int local_n = b_block.cols.size();
+
+    std::fill(c_local, c_local + static_cast<std::size_t>(local_m) * local_n, 0);
+
+    // Panel buffers reused every step
+    std::vector<int> a_panel(static_cast<std::size_t>(local_m) * panel_width);
+    std::vector<int> b_panel(static_cast<std::size_t>(panel_width) * local_n);
+    PackedB packed_panel;
+
+    int kk = 0;
+    while (kk < k) {
+        // A's k columns are split over grid columns and B's k rows over grid rows, so a panel
+        // must stop at whichever block boundary comes first
+        const int a_owner = balancedOwner(k, grid.cols, kk);
+        const int b_owner = balancedOwner(k, grid.rows, kk);
+        const Range a_cols = balancedRange(k, grid.cols, a_owner);
+        const Range b_rows = balancedRange(k, grid.rows, b_owner);
+        const int kb = std::min({panel_width, a_cols.end - kk, b_rows.end - kk});
+
+        // Owner copies its columns of A into the contiguous panel, then broadcasts along the grid row
+        if (grid.my_col == a_owner) {
+            const int local_k = a_block.cols.size();
+            for (int i = 0; i < local_m; i++) {
+                std::memcpy(a_panel.data() + static_cast<std::size_t>(i) * kb,
+                            a_local + static_cast<std::size_t>(i) * local_k + (kk - a_cols.start), kb * sizeof(int));
+            }
+        }
+        MPI_Bcast(a_panel.data(), local_m * kb, MPI_INT, a_owner, grid.row_comm);
+
+        // Owner's rows of B are already contiguous - broadcast them down the grid column
+        if (grid.my_row == b_owner) {
+            std::memcpy(b_panel.data(), b_local + static_cast<std::size_t>(kk - b_rows.start) * local_n,
+                        static_cast<std::size_t>(kb) * local_n * sizeof(int));
+        }
+        MPI_Bcast(b_panel.data(), kb * local_n, MPI_INT, b_owner, grid.col_comm);
+
+        // C_block += A_panel * B_panel
+        repackB(packed_panel, b_panel.data(), local_n, kb, local_n, num_threads);
+        gemmPackedThreads(local_m, a_panel.data(), kb, packed_panel, c_local, local_n, num_threads, true);
+
+        kk += kb;
+    }
+}
+
+#endif // COMMON_SUMMA_H
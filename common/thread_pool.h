@@ -0,0 +1,134 @@
+#ifndef COMMON_THREAD_POOL_H
+#define COMMON_THREAD_POOL_H
+
+// Long-lived pthreads worker pool
+// Threads are created once and block on a job queue, so repeated multiplies only pay for a
+// mutex/condition variable hand-off instead of pthread_create/pthread_join on every call
+// Jobs use the usual pthreads signature, void *fn(void *), so existing thread functions can be submitted as-is
+// submitTo pins a job to one worker, so work split the same way twice (first-touch fill, then compute) lands on the
+// same threads - and on the same cores and NUMA nodes once the workers are pinned
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+class ThreadPool {
+public:
+    using JobFn = void *(*)(void *);
+
+    // Start num_threads workers, which wait until jobs are submitted
+    explicit ThreadPool(const int num_threads) {
+        pthread_mutex_init(&lock, nullptr);
+        pthread_cond_init(&job_ready, nullptr);
+        pthread_cond_init(&all_done, nullptr);
+        threads.resize(num_threads);
+        worker_jobs.resize(num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            pthread_create(&threads[i], nullptr, workerMain, this);
+        }
+    }
+
+    // Finish outstanding jobs, then stop and join the workers
+    ~ThreadPool() {
+        wait();
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_broadcast(&job_ready);
+        pthread_mutex_unlock(&lock);
+        for (pthread_t &thread : threads) {
+            pthread_join(thread, nullptr);
+        }
+        pthread_cond_destroy(&all_done);
+        pthread_cond_destroy(&job_ready);
+        pthread_mutex_destroy(&lock);
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Queue fn(arg) to run on the next free worker - arg must stay valid until wait() returns
+    void submit(const JobFn fn, void *arg) {
+        pthread_mutex_lock(&lock);
+        jobs.push_back(Job{fn, arg});
+        pending++;
+        pthread_cond_signal(&job_ready);
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Queue fn(arg) to run on worker (the workerIndex() it will see) - run ahead of the shared queue's jobs
+    void submitTo(const int worker, const JobFn fn, void *arg) {
+        pthread_mutex_lock(&lock);
+        worker_jobs[worker].push_back(Job{fn, arg});
+        pending++;
+        pthread_cond_broadcast(&job_ready);  // Only the one worker can take it, and any of them may be the one signalled
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Completion barrier - block until every submitted job has finished
+    void wait() {
+        pthread_mutex_lock(&lock);
+        while (pending > 0) {
+            pthread_cond_wait(&all_done, &lock);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Number of worker threads
+    int size() const {
+        return static_cast<int>(threads.size());
+    }
+
+    // Index of the calling worker thread in [0, size()), or -1 when called from outside the pool
+    static int workerIndex() {
+        return current_worker;
+    }
+
+private:
+    struct Job {
+        JobFn fn;
+        void *arg;
+    };
+
+    // Worker loop - take jobs off the queue until the pool is stopping
+    static void *workerMain(void *args) {
+        ThreadPool *pool = static_cast<ThreadPool *>(args);
+        pthread_mutex_lock(&pool->lock);
+        current_worker = pool->next_worker++;
+        std::deque<Job> &own = pool->worker_jobs[current_worker];
+        for (;;) {
+            while (own.empty() && pool->jobs.empty() && !pool->stopping) {
+                pthread_cond_wait(&pool->job_ready, &pool->lock);
+            }
+            if (own.empty() && pool->jobs.empty()) {  // Stopping and nothing left to run
+                break;
+            }
+            std::deque<Job> &queue = own.empty() ? pool->jobs : own;
+            const Job job = queue.front();
+            queue.pop_front();
+            pthread_mutex_unlock(&pool->lock);
+
+            job.fn(job.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            if (--pool->pending == 0) {
+                pthread_cond_broadcast(&pool->all_done);
+            }
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return nullptr;
+    }
+
+    std::vector<pthread_t> threads;
+    std::deque<Job> jobs;
+    std::vector<std::deque<Job>> worker_jobs;  // Jobs for one worker each, from submitTo
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;  // Signalled when a job is queued or the pool is stopping
+    pthread_cond_t all_done;  // Signalled when pending drops to zero
+    int pending = 0;  // Jobs queued or running
+    int next_worker = 0;
+    bool stopping = false;
+
+    static inline thread_local int current_worker = -1;
+};
+
+#endif // COMMON_THREAD_POOL_H
@@ -0,0 +1,307 @@
+#ifndef COMMON_TILED_MATRIX_H
+#define COMMON_TILED_MATRIX_H
+
+// Tiled matrix files - the matrix stored as square tiles, so any one tile can be mapped without the rest
+// Used by the out-of-core multiply (out_of_core.h), where A, B and C together do not fit in memory
+// Header: as matrix_file.h's but with magic "MATT" and the tile size, then zero padding up to tiled_file_block bytes
+// Tiles follow in tile-row-major order, each tile x tile elements row-major starting on a tiled_file_block boundary
+// Edge tiles are padded with zeros to the full tile, so every tile multiplies as a whole and the padding adds nothing
+// Row-major matrix files convert to and from tiled ones with convertToTiled/convertFromTiled
+// Errors throw std::runtime_error, as in matrix_file.h
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "matrix.h"
+#include "matrix_file.h"
+#include "partition.h"
+#include "random.h"
+
+constexpr char tiled_file_magic[4] = {'M', 'A', 'T', 'T'};
+constexpr std::uint32_t tiled_file_version = 1;
+// Alignment of the first tile and of every tile after it - a page on most systems, so tiles map without slack
+constexpr std::size_t tiled_file_block = 4096;
+
+struct TiledFileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t type;  // matrixTypeCode of the elements
+    std::uint32_t reserved;
+    std::int64_t rows;
+    std::int64_t cols;
+    std::int64_t tile;  // Tiles are tile x tile elements
+    char padding[24];
+};
+
+static_assert(sizeof(TiledFileHeader) == 64, "tiled file header must match the matrix file header size");
+
+// Whether a file starts with the tiled magic - false for row-major matrix files and anything unreadable
+inline bool isTiledFile(const std::string &path) {
+    char magic[4] = {};
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    const bool read = std::fread(magic, sizeof(magic), 1, file) == 1;
+    std::fclose(file);
+    return read && std::memcmp(magic, tiled_file_magic, sizeof(magic)) == 0;
+}
+
+// One tile mapped into memory - unmapped when it goes out of scope
+template <typename T>
+class MappedTile {
+public:
+    MappedTile() = default;
+
+    MappedTile(void *mapping, const std::size_t length, T *values) : mapping(mapping), length(length), tile_values(values) {}
+
+    ~MappedTile() { reset(); }
+
+    MappedTile(const MappedTile &) = delete;
+    MappedTile &operator=(const MappedTile &) = delete;
+
+    MappedTile(MappedTile &&other) noexcept
+        : mapping(std::exchange(other.mapping, nullptr)), length(other.length), tile_values(std::exchange(other.tile_values, nullptr)) {}
+
+    MappedTile &operator=(MappedTile &&other) noexcept {
+        std::swap(mapping, other.mapping);
+        std::swap(length, other.length);
+        std::swap(tile_values, other.tile_values);
+        return *this;
+    }
+
+    // Unmap now - dirty pages of a writable tile are written back by the kernel
+    void reset() {
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+            mapping = nullptr;
+            tile_values = nullptr;
+        }
+    }
+
+    bool mapped() const { return mapping != nullptr; }
+
+    // tile x tile elements, row-major
+    T *values() { return tile_values; }
+    const T *values() const { return tile_values; }
+
+private:
+    void *mapping = nullptr;
+    std::size_t length = 0;
+    T *tile_values = nullptr;
+};
+
+// Tiled matrix file held open for mapping tiles - read-only, or read-write for outputs
+template <typename T>
+class TiledMatrix {
+public:
+    TiledMatrix() = default;
+
+    // Open an existing tiled file
+    static TiledMatrix open(const std::string &path, const bool writable = false) {
+        TiledMatrix matrix;
+        matrix.path = path;
+        matrix.writable = writable;
+        matrix.fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (matrix.fd < 0) {
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        }
+        if (pread(matrix.fd, &matrix.header, sizeof(matrix.header), 0) != static_cast<ssize_t>(sizeof(matrix.header)) ||
+            std::memcmp(matrix.header.magic, tiled_file_magic, sizeof(matrix.header.magic)) != 0 ||
+            matrix.header.version != tiled_file_version) {
+            throw std::runtime_error(path + ": not a tiled matrix file");
+        }
+        if (matrix.header.rows < 0 || matrix.header.cols < 0 || matrix.header.rows > INT32_MAX || matrix.header.cols > INT32_MAX ||
+            matrix.header.tile <= 0 || matrix.header.tile > 65536) {
+            throw std::runtime_error(path + ": bad tiled matrix dimensions");
+        }
+        if (matrix.header.type != matrixTypeCode<T>()) {
+            throw std::runtime_error(path + ": holds " + std::string(matrixTypeName(matrix.header.type)) + " elements, expected " +
+                                     matrixTypeName(matrixTypeCode<T>()));
+        }
+        struct stat info;
+        if (fstat(matrix.fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < matrix.fileSize()) {
+            throw std::runtime_error(path + ": file is shorter than its header says");
+        }
+        return matrix;
+    }
+
+    // Create (or truncate) a file for a rows x cols matrix of tile x tile tiles - every tile reads as zeros until written
+    static TiledMatrix create(const std::string &path, const int rows, const int cols, const int tile) {
+        if (rows < 0 || cols < 0 || tile <= 0) {
+            throw std::runtime_error(path + ": bad tiled matrix dimensions");
+        }
+        TiledMatrix matrix;
+        matrix.path = path;
+        matrix.writable = true;
+        std::memcpy(matrix.header.magic, tiled_file_magic, sizeof(matrix.header.magic));
+        matrix.header.version = tiled_file_version;
+        matrix.header.type = matrixTypeCode<T>();
+        matrix.header.rows = rows;
+        matrix.header.cols = cols;
+        matrix.header.tile = tile;
+        matrix.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (matrix.fd < 0) {
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        }
+        // Sized up front and sparse, so padding and unwritten tiles cost no disk
+        if (ftruncate(matrix.fd, matrix.fileSize()) != 0 ||
+            pwrite(matrix.fd, &matrix.header, sizeof(matrix.header), 0) != static_cast<ssize_t>(sizeof(matrix.header))) {
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        }
+        return matrix;
+    }
+
+    ~TiledMatrix() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    TiledMatrix(const TiledMatrix &) = delete;
+    TiledMatrix &operator=(const TiledMatrix &) = delete;
+
+    TiledMatrix(TiledMatrix &&other) noexcept
+        : path(std::move(other.path)), header(other.header), fd(std::exchange(other.fd, -1)), writable(other.writable) {}
+
+    TiledMatrix &operator=(TiledMatrix &&other) noexcept {
+        std::swap(path, other.path);
+        std::swap(header, other.header);
+        std::swap(fd, other.fd);
+        std::swap(writable, other.writable);
+        return *this;
+    }
+
+    int rows() const { return static_cast<int>(header.rows); }
+    int cols() const { return static_cast<int>(header.cols); }
+    int tile() const { return static_cast<int>(header.tile); }
+
+    // Tiles down and across
+    int tileRows() const { return (rows() + tile() - 1) / tile(); }
+    int tileCols() const { return (cols() + tile() - 1) / tile(); }
+
+    // Bytes of one tile's elements, and from one tile to the next in the file
+    std::size_t tileBytes() const { return static_cast<std::size_t>(tile()) * tile() * sizeof(T); }
+    std::size_t tileStride() const { return (tileBytes() + tiled_file_block - 1) / tiled_file_block * tiled_file_block; }
+
+    std::size_t fileSize() const {
+        return tiled_file_block + static_cast<std::size_t>(tileRows()) * tileCols() * tileStride();
+    }
+
+    // Rows or columns of the matrix covered by tile row or tile column index
+    Range tileRange(const int index, const int total) const {
+        return Range{std::min(index * tile(), total), std::min((index + 1) * tile(), total)};
+    }
+    Range tileRowRange(const int i) const { return tileRange(i, rows()); }
+    Range tileColRange(const int j) const { return tileRange(j, cols()); }
+
+    // Map tile (i, j) - the offset is rounded down to a page for systems with pages larger than tiled_file_block
+    MappedTile<T> mapTile(const int i, const int j) const {
+        const std::size_t offset = tiled_file_block + (static_cast<std::size_t>(i) * tileCols() + j) * tileStride();
+        const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const std::size_t start = offset / page * page;
+        const std::size_t length = offset - start + tileBytes();
+        void *mapping = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, static_cast<off_t>(start));
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error(path + ": " + std::strerror(errno));
+        }
+        return MappedTile<T>(mapping, length, reinterpret_cast<T *>(static_cast<char *>(mapping) + (offset - start)));
+    }
+
+    // Flush written tiles to the file - the kernel writes them back anyway, this makes the file complete on return
+    void sync() const {
+        if (writable) {
+            fsync(fd);
+        }
+    }
+
+private:
+    std::string path;
+    TiledFileHeader header{};
+    int fd = -1;
+    bool writable = false;
+};
+
+// Fill tile rows tile_rows of a tiled matrix with integers in [low, high] - the same values fillRandom gives a
+// row-major matrix of the same shape and rng, so tiled and in-core runs of one seed multiply the same matrices
+template <typename T>
+void fillRandomTiles(const TiledMatrix<T> &matrix, const Range &tile_rows, const CounterRng &rng, const int low, const int high,
+                     [[maybe_unused]] const int num_threads = 1) {
+    for (int i = tile_rows.start; i < tile_rows.end; i++) {
+        const Range rows = matrix.tileRowRange(i);
+        for (int j = 0; j < matrix.tileCols(); j++) {
+            const Range cols = matrix.tileColRange(j);
+            MappedTile<T> tile = matrix.mapTile(i, j);
+            #pragma omp parallel for num_threads(num_threads) schedule(static) if (num_threads > 1)
+            for (int r = rows.start; r < rows.end; r++) {
+                fillRandomBlock(tile.values() + static_cast<std::size_t>(r - rows.start) * matrix.tile(), matrix.cols(),
+                                Range{r, r + 1}, cols, rng, low, high);
+            }
+        }
+    }
+}
+
+// Copy a row-major matrix file into a new tiled file, one tile at a time - neither is ever resident as a whole
+template <typename T>
+void convertToTiled(const std::string &from, const std::string &to, const int tile) {
+    MappedMatrix<T> source = MappedMatrix<T>::open(from);
+    const BasicMatrix<T> &matrix = source.matrix();
+    const TiledMatrix<T> tiled = TiledMatrix<T>::create(to, matrix.rows, matrix.cols, tile);
+    for (int i = 0; i < tiled.tileRows(); i++) {
+        const Range rows = tiled.tileRowRange(i);
+        for (int j = 0; j < tiled.tileCols(); j++) {
+            const Range cols = tiled.tileColRange(j);
+            MappedTile<T> dest = tiled.mapTile(i, j);
+            for (int r = rows.start; r < rows.end; r++) {
+                std::copy(matrix.row(r) + cols.start, matrix.row(r) + cols.end, dest.values() + static_cast<std::size_t>(r - rows.start) * tile);
+            }
+        }
+    }
+    tiled.sync();
+}
+
+// Copy a tiled file into a new row-major matrix file, dropping the padding
+template <typename T>
+void convertFromTiled(const std::string &from, const std::string &to) {
+    const TiledMatrix<T> tiled = TiledMatrix<T>::open(from);
+    MappedMatrix<T> dest = MappedMatrix<T>::create(to, tiled.rows(), tiled.cols());
+    BasicMatrix<T> &matrix = dest.matrix();
+    for (int i = 0; i < tiled.tileRows(); i++) {
+        const Range rows = tiled.tileRowRange(i);
+        for (int j = 0; j < tiled.tileCols(); j++) {
+            const Range cols = tiled.tileColRange(j);
+            const MappedTile<T> source = tiled.mapTile(i, j);
+            for (int r = rows.start; r < rows.end; r++) {
+                const T *row = source.values() + static_cast<std::size_t>(r - rows.start) * tiled.tile();
+                std::copy(row, row + cols.size(), matrix.row(r) + cols.start);
+            }
+        }
+    }
+}
+
+// Element type code of a tiled file's header
+inline std::uint32_t tiledFileType(const std::string &path) {
+    TiledFileHeader header;
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error(path + ": " + std::strerror(errno));
+    }
+    const bool complete = std::fread(&header, sizeof(header), 1, file) == 1;
+    std::fclose(file);
+    if (!complete || std::memcmp(header.magic, tiled_file_magic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + ": not a tiled matrix file");
+    }
+    return header.type;
+}
+
+#endif // COMMON_TILED_MATRIX_H
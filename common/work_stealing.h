@@ -0,0 +1,153 @@
+#ifndef COMMON_WORK_STEALING_H
+#define COMMON_WORK_STEALING_H
+
+// Work-stealing scheduler for tiles of C
+// Every worker starts with a contiguous run of tiles in its own deque and works through it front to back
+// A worker that runs dry steals from the back of a randomly chosen victim's deque, so one slow or
+// preempted core no longer holds up the whole multiply
+// Workers are identified by index, so the same scheduler drives OMP threads and pthreads pool jobs
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "gemm.h"
+#include "partition.h"
+
+// Tile of C - rows [row_start, row_end) by columns [col_start, col_end)
+struct TileTask {
+    int row_start;
+    int row_end;
+    int col_start;
+    int col_end;
+};
+
+// Split an m x n product into tiles, aiming for several tiles per worker so there is something to steal
+// Tiles start at the cache block sizes and are halved (columns first, keeping gemm_nr alignment) until there are enough
+inline std::vector<TileTask> makeTileTasks(const int m, const int n, const int num_workers) {
+    constexpr int tiles_per_worker = 4;
+    int tile_m = block_m;
+    int tile_n = block_n;
+    const auto count = [&] { return ((m + tile_m - 1) / tile_m) * ((n + tile_n - 1) / tile_n); };
+    while (count() < tiles_per_worker * num_workers && tile_n > 16 * gemm_nr) {
+        tile_n /= 2;
+    }
+    while (count() < tiles_per_worker * num_workers && tile_m > 4 * gemm_mr) {
+        tile_m = tile_m / 2 / gemm_mr * gemm_mr;
+    }
+
+    std::vector<TileTask> tasks;
+    for (int i = 0; i < m; i += tile_m) {
+        for (int j = 0; j < n; j += tile_n) {
+            tasks.push_back(TileTask{i, std::min(i + tile_m, m), j, std::min(j + tile_n, n)});
+        }
+    }
+    return tasks;
+}
+
+class WorkStealingScheduler {
+public:
+    explicit WorkStealingScheduler(const int num_workers) : queues(num_workers) {
+        for (int i = 0; i < num_workers; i++) {
+            queues[i].rng.seed(std::random_device{}() + i);
+        }
+    }
+
+    // Load a new set of tiles - worker w gets the w-th balanced run of tiles, which keeps neighbouring tiles together
+    void reset(const std::vector<TileTask> &tasks) {
+        const int num_workers = static_cast<int>(queues.size());
+        for (int w = 0; w < num_workers; w++) {
+            const Range share = balancedRange(static_cast<int>(tasks.size()), num_workers, w);
+            std::lock_guard<std::mutex> guard(queues[w].lock);
+            queues[w].tasks.assign(tasks.begin() + share.start, tasks.begin() + share.end);
+            queues[w].steals = 0;
+        }
+        remaining.store(static_cast<int>(tasks.size()));
+    }
+
+    // Run tiles as worker index until every tile has been claimed - fn(const TileTask &) does the work
+    template <typename Fn>
+    void run(const int worker, Fn &&fn) {
+        const int num_workers = static_cast<int>(queues.size());
+        WorkerQueue &own = queues[worker];
+        TileTask task{};
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            if (popOwn(own, task)) {
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+                fn(task);
+                continue;
+            }
+
+            // Own deque is empty - try each other worker once, starting from a random victim
+            bool stolen = false;
+            const int first = num_workers > 1 ? static_cast<int>(own.rng() % (num_workers - 1)) : 0;
+            for (int attempt = 0; attempt < num_workers - 1 && !stolen; attempt++) {
+                const int victim = (worker + 1 + (first + attempt) % (num_workers - 1)) % num_workers;
+                stolen = stealFrom(queues[victim], task);
+            }
+            if (stolen) {
+                own.steals++;
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+                fn(task);
+            } else {
+                // Nothing visible to steal - the last tiles are being claimed or run by others
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Tiles stolen across all workers since the last reset
+    long steals() const {
+        long total = 0;
+        for (const WorkerQueue &queue : queues) {
+            total += queue.steals;
+        }
+        return total;
+    }
+
+private:
+    // Padded to a cache line so workers do not false-share each other's deque state
+    struct alignas(64) WorkerQueue {
+        std::mutex lock;
+        std::deque<TileTask> tasks;
+        std::minstd_rand rng;
+        long steals = 0;  // Only written by the owning worker
+    };
+
+    // Owner takes from the front, walking its run of tiles in order
+    static bool popOwn(WorkerQueue &queue, TileTask &task) {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    // Thieves take from the back, furthest from where the owner is working
+    static bool stealFrom(WorkerQueue &queue, TileTask &task) {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    std::vector<WorkerQueue> queues;
+    std::atomic<int> remaining{0};  // Tiles not yet claimed by any worker
+};
+
+// Multiply one tile of C using the shared packed B
+template <typename T, typename Acc>
+inline void multiplyTile(const BasicMatrix<T> &a, const BasicPackedB<T> &b, BasicMatrix<Acc> &c, const TileTask &tile) {
+    gemmPackedTile(tile.row_end - tile.row_start, a.row(tile.row_start), a.cols, b,
+                   c.row(tile.row_start), c.cols, tile.col_start, tile.col_end);
+}
+
+#endif // COMMON_WORK_STEALING_H